@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include "trace.h"
+
+/* A set-associative CPU cache hierarchy simulator.
+ *
+ * cachesim replays the same trace files as sim (through the same reader),
+ * but at cache-line granularity, so it needs raw lackey traces (see
+ * traceprogs/rawit) rather than the page-reduced ones for meaningful
+ * numbers.  Each level has its own size, associativity, line size and
+ * replacement policy.  The hierarchy is write-back and write-allocate,
+ * and neither inclusive nor exclusive: a miss fills the line into every
+ * level that missed, and a dirty victim is written into the next level.
+ */
+
+#define MAX_LEVELS 3
+
+enum policy { POL_LRU, POL_FIFO, POL_RAND };
+static const char *policy_names[] = { "lru", "fifo", "rand" };
+
+struct cache {
+	char name[8];
+	unsigned size, assoc, line;
+	enum policy policy;
+
+	unsigned line_shift;
+	unsigned long set_mask;
+	unsigned long *tags;      // per way: line number + 1, 0 if invalid
+	unsigned *stamp;          // per way: last use (lru) or fill (fifo) time
+	unsigned char *dirty;
+	unsigned now;
+	unsigned long rand_state;
+
+	unsigned long accesses, misses, writebacks;
+};
+
+static struct cache levels[MAX_LEVELS];
+static int nlevels = MAX_LEVELS;
+static int trace_code = 0;     // also simulate instruction fetches
+
+static int log2_exact(unsigned long v) {
+	int s = 0;
+	if (v == 0 || (v & (v - 1)) != 0) {
+		return -1;
+	}
+	while ((1UL << s) != v) {
+		s++;
+	}
+	return s;
+}
+
+/* Parse "size:assoc:line[:policy]"; size may end in K or M. */
+static int cache_config(struct cache *c, const char *name, const char *spec) {
+	char unit = 0;
+	char pol[8] = "lru";
+	unsigned long nsets;
+	int i, n;
+
+	n = sscanf(spec, "%u%c", &c->size, &unit);
+	if (n == 2 && (unit == 'K' || unit == 'k')) {
+		c->size <<= 10;
+	} else if (n == 2 && (unit == 'M' || unit == 'm')) {
+		c->size <<= 20;
+	}
+	spec = strchr(spec, ':');
+	if (n < 1 || spec == NULL ||
+	    sscanf(spec, ":%u:%u:%7s", &c->assoc, &c->line, pol) < 2) {
+		fprintf(stderr, "Error: bad cache spec for %s\n", name);
+		return -1;
+	}
+	for (i = 0; i < 3; i++) {
+		if (strcmp(pol, policy_names[i]) == 0) {
+			break;
+		}
+	}
+	if (i == 3) {
+		fprintf(stderr, "Error: unknown replacement policy %s\n", pol);
+		return -1;
+	}
+	c->policy = i;
+	snprintf(c->name, sizeof(c->name), "%s", name);
+
+	if (c->assoc == 0 || c->line == 0 || c->size % (c->assoc * c->line) != 0 ||
+	    log2_exact(c->line) < 0 ||
+	    log2_exact(c->size / (c->assoc * c->line)) < 0) {
+		fprintf(stderr, "Error: %s needs a power of two line size and number of sets\n",
+			name);
+		return -1;
+	}
+	c->line_shift = log2_exact(c->line);
+	nsets = c->size / (c->assoc * c->line);
+	c->set_mask = nsets - 1;
+	return 0;
+}
+
+static void cache_alloc(struct cache *c) {
+	unsigned long ways = (c->set_mask + 1) * c->assoc;
+
+	c->tags = calloc(ways, sizeof(unsigned long));
+	c->stamp = calloc(ways, sizeof(unsigned));
+	c->dirty = calloc(ways, 1);
+	if (c->tags == NULL || c->stamp == NULL || c->dirty == NULL) {
+		perror("cachesim");
+		exit(1);
+	}
+	c->rand_state = 0x9E3779B97F4A7C15UL;
+}
+
+static void cache_place(int lvl, unsigned long line, unsigned w, int dirty);
+
+/* Way of the set starting at 'base' to fill next: an invalid way if there
+ * is one, else the oldest stamp (lru, fifo) or a random way.
+ */
+static unsigned cache_victim(struct cache *c, unsigned long base) {
+	unsigned long *tags = &c->tags[base];
+	unsigned *stamp = &c->stamp[base];
+	unsigned w, victim = 0, oldest = 0;
+
+	for (w = 0; w < c->assoc; w++) {
+		// stamps wrap, so compare their distance from now
+		unsigned age = tags[w] ? c->now - stamp[w] : ~0U;
+		victim = age > oldest ? w : victim;
+		oldest = age > oldest ? age : oldest;
+	}
+	if (c->policy == POL_RAND && oldest != ~0U) {
+		c->rand_state ^= c->rand_state << 13;
+		c->rand_state ^= c->rand_state >> 7;
+		c->rand_state ^= c->rand_state << 17;
+		victim = c->rand_state % c->assoc;
+	}
+	return victim;
+}
+
+/* Look up the line holding 'addr' in level lvl, filling it on a miss.
+ * Return: 1 on a hit, 0 on a miss
+ */
+static int cache_lookup(int lvl, unsigned long addr, int write) {
+	struct cache *c = &levels[lvl];
+	unsigned long line = addr >> c->line_shift;
+	unsigned long base = (line & c->set_mask) * c->assoc;
+	unsigned long *tags = &c->tags[base];
+	unsigned w;
+
+	c->accesses++;
+	c->now++;
+	for (w = 0; w < c->assoc; w++) {
+		if (tags[w] == line + 1) {
+			if (c->policy == POL_LRU) {
+				c->stamp[base + w] = c->now;
+			}
+			c->dirty[base + w] |= write;
+			return 1;
+		}
+	}
+	c->misses++;
+	cache_place(lvl, line, cache_victim(c, base), write);
+	return 0;
+}
+
+/* Write a dirty line evicted from level lvl into the next level: mark it
+ * dirty there, or allocate it if that level does not hold it.
+ */
+static void cache_writeback(int lvl, unsigned long addr) {
+	struct cache *c = &levels[lvl];
+	unsigned long line = addr >> c->line_shift;
+	unsigned long base = (line & c->set_mask) * c->assoc;
+	unsigned w;
+
+	for (w = 0; w < c->assoc; w++) {
+		if (c->tags[base + w] == line + 1) {
+			c->dirty[base + w] = 1;
+			return;
+		}
+	}
+	cache_place(lvl, line, cache_victim(c, base), 1);
+}
+
+// Put 'line' in way w of its set in level lvl, writing back the old line
+static void cache_place(int lvl, unsigned long line, unsigned w, int dirty) {
+	struct cache *c = &levels[lvl];
+	unsigned long i = (line & c->set_mask) * c->assoc + w;
+
+	if (c->tags[i] && c->dirty[i]) {
+		c->writebacks++;
+		if (lvl + 1 < nlevels) {
+			cache_writeback(lvl + 1, (c->tags[i] - 1) << c->line_shift);
+		}
+	}
+	c->tags[i] = line + 1;
+	c->stamp[i] = c->now;
+	c->dirty[i] = dirty;
+}
+
+// One access of 'size' bytes, split at the first level's line boundaries
+static void access_range(unsigned long addr, unsigned size, int write) {
+	unsigned shift = levels[0].line_shift;
+	unsigned long first = addr >> shift;
+	unsigned long last = (addr + (size ? size - 1 : 0)) >> shift;
+	unsigned long l;
+	int lvl;
+
+	for (l = first; l <= last; l++) {
+		for (lvl = 0; lvl < nlevels; lvl++) {
+			if (cache_lookup(lvl, l << shift, lvl == 0 ? write : 0)) {
+				break;
+			}
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	char *tracefile = NULL;
+	char *specs[MAX_LEVELS] = { "32K:8:64:lru", "256K:8:64:lru", "8M:16:64:lru" };
+	char *usage = "USAGE: cachesim [-f tracefile] [-1 L1spec] [-2 L2spec] [-3 LLCspec] [-n levels] [-i]\n"
+		"  spec is size:assoc:linesize[:lru|fifo|rand], e.g. 32K:8:64:lru\n";
+	struct trace tr;
+	struct trace_ref ref;
+	unsigned long refs = 0;
+	struct timespec t0, t1;
+	double secs;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "f:1:2:3:n:i")) != -1) {
+		switch (opt) {
+		case 'f':
+			tracefile = optarg;
+			break;
+		case '1': case '2': case '3':
+			specs[opt - '1'] = optarg;
+			break;
+		case 'n':
+			nlevels = atoi(optarg);
+			break;
+		case 'i':
+			trace_code = 1;
+			break;
+		default:
+			fprintf(stderr, "%s", usage);
+			exit(1);
+		}
+	}
+	if (nlevels < 1 || nlevels > MAX_LEVELS) {
+		fprintf(stderr, "%s", usage);
+		exit(1);
+	}
+	for (i = 0; i < nlevels; i++) {
+		char name[8];
+		snprintf(name, sizeof(name), i == MAX_LEVELS - 1 ? "LLC" : "L%d", i + 1);
+		if (cache_config(&levels[i], name, specs[i]) != 0) {
+			exit(1);
+		}
+		cache_alloc(&levels[i]);
+	}
+	if (trace_open(&tr, tracefile) != 0) {
+		perror("Error opening tracefile:");
+		exit(1);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	while (trace_next(&tr, &ref)) {
+		if ((ref.type == 'I' && !trace_code) || TRACE_IS_EVENT(ref.type)) {
+			continue;
+		}
+		// M (modify) is a load and a store to the same line: the store hits
+		access_range(ref.addr, ref.size, ref.type == 'S' || ref.type == 'M');
+		refs++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	trace_close(&tr);
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	printf("References: %lu\n", refs);
+	for (i = 0; i < nlevels; i++) {
+		struct cache *c = &levels[i];
+		printf("%s: %u bytes, %u-way, %u-byte lines, %s\n", c->name, c->size,
+		       c->assoc, c->line, policy_names[c->policy]);
+		printf("  Accesses: %lu\n", c->accesses);
+		printf("  Misses: %lu\n", c->misses);
+		printf("  Miss rate: %.4f\n", c->accesses ?
+		       (double)c->misses / c->accesses * 100 : 0.0);
+		printf("  Writebacks: %lu\n", c->writebacks);
+	}
+	fprintf(stderr, "%.3f s, %.1f M references/s\n", secs,
+		secs > 0 ? refs / secs / 1e6 : 0.0);
+	return 0;
+}
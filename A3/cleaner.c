@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include "sim.h"
+#include "pagetable.h"
+
+/* A virtual-time page cleaner, in the spirit of a kernel flusher thread.
+ *
+ * Every clean_interval references the cleaner sweeps its own hand around
+ * the coremap and writes back dirty frames that have not been referenced
+ * during the last interval, up to clean_batch frames per run.  The writes
+ * are handed to swap_pageout_batch, which sorts and coalesces them.  A
+ * cleaned frame that is later evicted without being dirtied again is an
+ * eviction that did not have to wait for a write.
+ */
+
+unsigned clean_batch = 0;
+unsigned clean_interval = 1000;
+
+long clean_write_count = 0;  // frames written back by the cleaner
+long clean_saved_count = 0;  // dirty evictions the cleaner turned into clean ones
+
+// Frames looked at per run, relative to the batch size
+#define CLEAN_SCAN_FACTOR 4
+
+static unsigned clean_hand = 0;
+
+void cleaner_init(void) {
+	clean_hand = 0;
+	snapshot_register("cleaner", &clean_hand, sizeof(clean_hand));
+}
+
+void cleaner_run(void) {
+	unsigned *frames;
+	int *offsets;
+	int n = 0;
+	unsigned scanned;
+	unsigned budget = clean_batch * CLEAN_SCAN_FACTOR;
+
+	if (budget > memsize) {
+		budget = memsize;
+	}
+	frames = malloc(clean_batch * sizeof(unsigned));
+	offsets = malloc(clean_batch * sizeof(int));
+
+	for (scanned = 0; scanned < budget && n < clean_batch; scanned++) {
+		struct frame *f = &coremap[clean_hand];
+
+		if (f->in_use && (f->pte->frame & PG_DIRTY) &&
+		    ref_count - f->last_ref >= clean_interval) {
+			frames[n] = clean_hand;
+			offsets[n] = f->pte->swap_off;
+			n++;
+		}
+		clean_hand = (clean_hand + 1) % memsize;
+	}
+
+	if (n > 0 && swap_pageout_batch(frames, offsets, n) == 0) {
+		int i;
+		for (i = 0; i < n; i++) {
+			frame_swapped(frames[i], offsets[i]);
+			coremap[frames[i]].cleaned = 1;
+		}
+		clean_write_count += n;
+	}
+
+	free(frames);
+	free(offsets);
+}
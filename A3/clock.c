@@ -3,7 +3,9 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <stdlib.h>
+#include <string.h>
 #include "pagetable.h"
+#include "scan.h"
 
 
 extern int memsize;
@@ -12,31 +14,32 @@ extern int debug;
 
 extern struct frame *coremap;
 
+// record clock hand
+static int clock_hand = 0;
+
+// Reference bit of each frame, one byte per frame so that the sweep for
+// an unreferenced frame can look at a whole vector of frames at a time
+static unsigned char *clock_ref_bits;
+
 /* Page to evict is chosen using the clock algorithm.
  * Returns the page frame number (which is also the index in the coremap)
  * for the page that is to be evicted.
  */
 
 int clock_evict() {
-	// record clock hand
-	static int clock_hand = 0;
-
-	int frame = -1;
-	
-	while(1){
-		if (coremap[clock_hand].pte->frame & PG_REF){
-			coremap[clock_hand].pte->frame &= ~PG_REF;
-		}
-		else {
-			frame = clock_hand;
-		}
-		clock_hand = (clock_hand + 1) % memsize;
-
-		// find 
-		if (frame != -1){
-			break;
-		}
+	// The hand clears every reference bit it passes on the way to the
+	// first unreferenced frame; if there is none before the end, it
+	// wraps around and is sure to stop at the latest at where it started.
+	int frame = scan_zero_byte(clock_ref_bits, clock_hand, memsize);
+
+	if (frame != -1) {
+		memset(clock_ref_bits + clock_hand, 0, frame - clock_hand);
+	} else {
+		memset(clock_ref_bits + clock_hand, 0, memsize - clock_hand);
+		frame = scan_zero_byte(clock_ref_bits, 0, memsize);
+		memset(clock_ref_bits, 0, frame);
 	}
+	clock_hand = (frame + 1) % memsize;
 	return frame;
 }
 
@@ -45,7 +48,7 @@ int clock_evict() {
  * Input: The page table entry for the page that is being accessed.
  */
 void clock_ref(pgtbl_entry_t *p) {
-	// already  set PG_REF
+	clock_ref_bits[p->frame >> PAGE_SHIFT] = 1;
 	return;
 }
 
@@ -53,4 +56,9 @@ void clock_ref(pgtbl_entry_t *p) {
  * algorithm. 
  */
 void clock_init() {
+	clock_hand = 0;
+	free(clock_ref_bits);
+	clock_ref_bits = scan_alloc(memsize, 1);
+	snapshot_register("clock", &clock_hand, sizeof(clock_hand));
+	snapshot_register("clock_ref", clock_ref_bits, memsize);
 }
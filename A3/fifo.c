@@ -12,15 +12,17 @@ extern int debug;
 
 extern struct frame *coremap;
 
+// next frame to evict
+static int fifo_index = 0;
+
 /* Page to evict is chosen using the fifo algorithm.
  * Returns the page frame number (which is also the index in the coremap)
  * for the page that is to be evicted.
  */
 int fifo_evict() {
-	static int index = 0;
 	int frame;
-	frame = index;
-	index = (index + 1) % memsize;
+	frame = fifo_index;
+	fifo_index = (fifo_index + 1) % memsize;
 	return frame;
 }
 
@@ -37,4 +39,6 @@ void fifo_ref(pgtbl_entry_t *p) {
  * replacement algorithm 
  */
 void fifo_init() {
+	fifo_index = 0;
+	snapshot_register("fifo", &fifo_index, sizeof(fifo_index));
 }
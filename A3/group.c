@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "pagetable.h"
+
+/* Memory-limit groups, after the cgroup memory controller.
+ *
+ * A trace line "G n" charges the references that follow to group n (see
+ * trace.h), until the next such line; references before any are charged
+ * to the root group, 0.  A frame is charged to the group whose reference
+ * brought its page in.
+ *
+ * A group at its hard limit that needs a frame evicts one of its own, even
+ * when other frames are free.  When memory is full, the group furthest
+ * over its soft limit gives up a frame before the replacement algorithm
+ * is asked for a victim.  Either way the group evicts its least recently
+ * used frame (by last_ref), as the controller reclaims from the group's
+ * own LRU lists; the replacement algorithm only does global reclaim.
+ */
+
+int num_groups = 0;
+int cur_group = 0;
+struct group groups[MAX_GROUPS + 1];
+
+// The frames charged to each group, in no particular order
+static int *members[MAX_GROUPS + 1];
+
+static void member_add(int g, int frame) {
+	struct group *grp = &groups[g];
+
+	coremap[frame].group = g;
+	coremap[frame].group_pos = grp->frames;
+	members[g][grp->frames++] = frame;
+	if (grp->frames > grp->peak) {
+		grp->peak = grp->frames;
+	}
+}
+
+static void member_remove(int frame) {
+	struct group *grp = &groups[coremap[frame].group];
+	int *list = members[coremap[frame].group];
+	int pos = coremap[frame].group_pos;
+
+	list[pos] = list[--grp->frames];
+	coremap[list[pos]].group_pos = pos;
+	coremap[frame].group = -1;
+}
+
+// Least recently used frame of group g, which must have one
+static int group_lru(int g) {
+	int *list = members[g];
+	int i, victim = list[0];
+
+	for (i = 1; i < groups[g].frames; i++) {
+		if (coremap[list[i]].last_ref < coremap[victim].last_ref) {
+			victim = list[i];
+		}
+	}
+	groups[g].reclaims++;
+	return victim;
+}
+
+/* Frame for the current group to reuse because it is at its hard limit,
+ * or -1 if it is not.
+ */
+int group_reclaim_hard(void) {
+	struct group *grp = &groups[cur_group];
+
+	if (grp->hard == 0 || grp->frames < grp->hard) {
+		return -1;
+	}
+	return group_lru(cur_group);
+}
+
+/* Frame to reclaim from the group furthest over its soft limit, or -1 if
+ * no group is over it.
+ */
+int group_reclaim_soft(void) {
+	int g, worst = -1;
+	unsigned excess = 0;
+
+	for (g = 1; g <= num_groups; g++) {
+		struct group *grp = &groups[g];
+		if (grp->soft != 0 && grp->frames > grp->soft &&
+		    grp->frames - grp->soft > excess) {
+			excess = grp->frames - grp->soft;
+			worst = g;
+		}
+	}
+	return worst == -1 ? -1 : group_lru(worst);
+}
+
+/* Charges a frame that was just allocated to the current group. */
+void group_charge(int frame) {
+	if (coremap[frame].group == cur_group) {
+		return;
+	}
+	if (coremap[frame].group != -1) {
+		member_remove(frame);
+	}
+	member_add(cur_group, frame);
+}
+
+/* Uncharges a frame that is being freed. */
+void group_uncharge(int frame) {
+	if (coremap[frame].group != -1) {
+		member_remove(frame);
+	}
+}
+
+/* Charges the following references to group g.  Without groups, traces
+ * tagged with them are replayed as if untagged.
+ */
+void group_select(addr_t g) {
+	if (num_groups == 0) {
+		return;
+	}
+	if (g > num_groups) {
+		fprintf(stderr, "Error: trace selects group %lu, but %d are configured\n",
+			g, num_groups);
+		exit(1);
+	}
+	cur_group = g;
+}
+
+// The frame lists are not saved; they follow from the coremap
+static void group_restore() {
+	int g, i;
+
+	for (g = 0; g <= num_groups; g++) {
+		groups[g].frames = 0;
+	}
+	for (i = 0; i < memsize; i++) {
+		if (coremap[i].in_use && coremap[i].group != -1) {
+			member_add(coremap[i].group, i);
+		}
+	}
+}
+
+/* Sets up the groups configured in groups[1..num_groups] (names and
+ * limits), clearing their counters.
+ */
+void group_init(void) {
+	int g, i;
+
+	if (num_groups == 0) {
+		return;
+	}
+	assert(num_groups <= MAX_GROUPS);
+	strcpy(groups[0].name, "root");
+	groups[0].hard = groups[0].soft = 0;
+	for (g = 0; g <= num_groups; g++) {
+		groups[g].frames = groups[g].peak = 0;
+		groups[g].refs = groups[g].misses = groups[g].reclaims = 0;
+		free(members[g]);
+		members[g] = malloc(memsize * sizeof(int));
+	}
+	for (i = 0; i < memsize; i++) {
+		coremap[i].group = -1;
+	}
+	cur_group = 0;
+	snapshot_register("groups", groups, sizeof(groups));
+	snapshot_register("group_cur", &cur_group, sizeof(cur_group));
+	snapshot_hooks("groups", NULL, group_restore);
+}
@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include "pagetable.h"
+
+
+extern int memsize;
+
+extern int debug;
+
+extern struct frame *coremap;
+
+extern long ref_count;
+
+/* Least frequently used, with O(1) work per reference.
+ *
+ * Frames live in one doubly linked list per reference count (a bucket),
+ * most recently referenced at the head.  A reference moves a frame from
+ * its bucket to the head of the next one; eviction takes the tail of the
+ * lowest non-empty bucket, found through a bitmap of non-empty buckets.
+ * Counts saturate at LFU_MAX_FREQ, and every LFU_AGE_FACTOR * memsize
+ * references all counts are halved so that pages that were hot long ago
+ * do not stay resident forever.  Aging walks every frame once, which is
+ * O(1) amortized over the references between two agings.
+ */
+
+#define LFU_MAX_FREQ 255
+#define LFU_AGE_FACTOR 8
+#define LFU_NIL (-1)
+
+#define LFU_MASK_WORDS ((LFU_MAX_FREQ + 1 + 63) / 64)
+
+static struct {
+	int head[LFU_MAX_FREQ + 1];
+	int tail[LFU_MAX_FREQ + 1];
+	unsigned long nonempty[LFU_MASK_WORDS];
+	long last_age;     // ref_count at the last aging
+} lfu;
+
+static void lfu_unlink(int frame) {
+	struct frame *f = &coremap[frame];
+	int freq = f->lfu_freq;
+
+	if (f->lfu_prev != LFU_NIL) {
+		coremap[f->lfu_prev].lfu_next = f->lfu_next;
+	} else {
+		lfu.head[freq] = f->lfu_next;
+	}
+	if (f->lfu_next != LFU_NIL) {
+		coremap[f->lfu_next].lfu_prev = f->lfu_prev;
+	} else {
+		lfu.tail[freq] = f->lfu_prev;
+	}
+	if (lfu.head[freq] == LFU_NIL) {
+		lfu.nonempty[freq / 64] &= ~(1UL << (freq % 64));
+	}
+}
+
+static void lfu_push(int frame, int freq) {
+	struct frame *f = &coremap[frame];
+
+	f->lfu_freq = freq;
+	f->lfu_prev = LFU_NIL;
+	f->lfu_next = lfu.head[freq];
+	if (lfu.head[freq] != LFU_NIL) {
+		coremap[lfu.head[freq]].lfu_prev = frame;
+	} else {
+		lfu.tail[freq] = frame;
+	}
+	lfu.head[freq] = frame;
+	lfu.nonempty[freq / 64] |= 1UL << (freq % 64);
+}
+
+/* Halve every count, keeping the recency order within each new bucket:
+ * frames coming from a lower old count end up closer to the tail.
+ */
+static void lfu_age() {
+	int old_head[LFU_MAX_FREQ + 1];
+	int freq, frame;
+
+	for (freq = 1; freq <= LFU_MAX_FREQ; freq++) {
+		old_head[freq] = lfu.tail[freq];
+		lfu.head[freq] = lfu.tail[freq] = LFU_NIL;
+	}
+	for (freq = 0; freq < LFU_MASK_WORDS; freq++) {
+		lfu.nonempty[freq] = 0;
+	}
+	for (freq = 1; freq <= LFU_MAX_FREQ; freq++) {
+		int nfreq = freq / 2 > 0 ? freq / 2 : 1;
+		// Walk the old bucket from its tail using the prev links, which
+		// lfu_push only overwrites once the frame has been visited.
+		frame = old_head[freq];
+		while (frame != LFU_NIL) {
+			int prev = coremap[frame].lfu_prev;
+			lfu_push(frame, nfreq);
+			frame = prev;
+		}
+	}
+	lfu.last_age = ref_count;
+}
+
+/* Page to evict is chosen using the lfu algorithm.
+ * Returns the page frame number (which is also the index in the coremap)
+ * for the page that is to be evicted.
+ */
+int lfu_evict() {
+	int w, frame;
+
+	for (w = 0; w < LFU_MASK_WORDS; w++) {
+		if (lfu.nonempty[w]) {
+			break;
+		}
+	}
+	assert(w < LFU_MASK_WORDS);
+	frame = lfu.tail[w * 64 + __builtin_ctzl(lfu.nonempty[w])];
+	lfu_unlink(frame);
+	coremap[frame].lfu_freq = 0;
+	return frame;
+}
+
+/* This function is called on each access to a page to update any information
+ * needed by the lfu algorithm.
+ * Input: The page table entry for the page that is being accessed.
+ */
+void lfu_ref(pgtbl_entry_t *p) {
+	int frame = p->frame >> PAGE_SHIFT;
+	int freq = coremap[frame].lfu_freq;
+
+	if (freq == 0) {
+		// a page that was just brought in
+		lfu_push(frame, 1);
+	} else if (freq < LFU_MAX_FREQ) {
+		lfu_unlink(frame);
+		lfu_push(frame, freq + 1);
+	} else if (lfu.head[freq] != frame) {
+		// saturated: only refresh its recency
+		lfu_unlink(frame);
+		lfu_push(frame, freq);
+	}
+
+	if (ref_count - lfu.last_age >= LFU_AGE_FACTOR * memsize) {
+		lfu_age();
+	}
+}
+
+/* Stops tracking a frame that was freed without being evicted (its
+ * process exited), so its next page starts from scratch.
+ */
+void lfu_release(int frame) {
+	if (coremap[frame].lfu_freq != 0) {
+		lfu_unlink(frame);
+		coremap[frame].lfu_freq = 0;
+	}
+}
+
+/* Initialize any data structures needed for this
+ * replacement algorithm
+ */
+void lfu_init() {
+	int i;
+
+	for (i = 0; i <= LFU_MAX_FREQ; i++) {
+		lfu.head[i] = lfu.tail[i] = LFU_NIL;
+	}
+	for (i = 0; i < LFU_MASK_WORDS; i++) {
+		lfu.nonempty[i] = 0;
+	}
+	for (i = 0; i < memsize; i++) {
+		coremap[i].lfu_freq = 0;
+	}
+	lfu.last_age = 0;
+	snapshot_register("lfu", &lfu, sizeof(lfu));
+}
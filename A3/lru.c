@@ -4,7 +4,7 @@
 #include <getopt.h>
 #include <stdlib.h>
 #include "pagetable.h"
-#include <sys/time.h>
+#include "scan.h"
 
 
 extern int memsize;
@@ -13,27 +13,21 @@ extern int debug;
 
 extern struct frame *coremap;
 
+extern long ref_count;
+
+// Virtual time (ref_count) of the last reference to each frame, kept in
+// a dense array so that finding the oldest is one vectorized scan
+static long *lru_stamp;
+
 /* Page to evict is chosen using the accurate LRU algorithm.
  * Returns the page frame number (which is also the index in the coremap)
  * for the page that is to be evicted.
  */
 
 int lru_evict() {
-	// find min timestamp
-	long long min_timestamp = -1;
-	int frame = 0;
-	for (int i=0; i < memsize; ++i){
-		// filter  no  timestamp
-		if (coremap[i].timestamp != -1){
-			// find min timestamp
-			if (min_timestamp == -1 || min_timestamp > coremap[i].timestamp){
-				min_timestamp = coremap[i].timestamp;
-				frame = i;
-			}
-		}
-	}
-	// min timestamp   is   Least Recently Used
-	return frame;
+	// Eviction only happens once every frame is in use, so every stamp
+	// is set; the min timestamp is the Least Recently Used
+	return scan_argmin(lru_stamp, memsize);
 }
 
 /* This function is called on each access to a page to update any information
@@ -44,9 +38,7 @@ void lru_ref(pgtbl_entry_t *p) {
 
 	int frame = p->frame >> PAGE_SHIFT;
 	// if referenced,then update timestamp
-	struct timeval t; 
-   	gettimeofday(&t, NULL); 
-    coremap[frame].timestamp = t.tv_sec*1000000 + t.tv_usec;
+	lru_stamp[frame] = ref_count;
 	return;
 }
 
@@ -55,7 +47,7 @@ void lru_ref(pgtbl_entry_t *p) {
  * replacement algorithm 
  */
 void lru_init() {
-	for (int i=0; i < memsize; ++i){
-		coremap[i].timestamp = -1;
-	}
+	free(lru_stamp);
+	lru_stamp = scan_alloc(memsize, sizeof(long));
+	snapshot_register("lru", lru_stamp, memsize * sizeof(long));
 }
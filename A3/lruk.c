@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pagetable.h"
+
+
+extern int memsize;
+
+extern int debug;
+
+extern struct frame *coremap;
+
+extern long ref_count;
+
+/* LRU-K (O'Neil, O'Neil and Weikum), with K = LRUK_K.
+ *
+ * The victim is the page whose K-th most recent reference is oldest;
+ * pages with fewer than K references count as infinitely old and are
+ * evicted first, least recently used among them.  Time is virtual (the
+ * reference count), so results do not depend on the host.
+ *
+ * A reference within LRUK_CRP references of the page's previous one is
+ * correlated with it and only updates the page's last reference time.  The
+ * next uncorrelated reference shifts the history, moving the older entries
+ * forward by the length of the correlated period so that the whole period
+ * counts as one reference.  A page in its correlated period is not evicted
+ * unless every page is.  Without this, a page touched a few times in
+ * passing looks as hot as one that is really reused, and a page that has
+ * just been brought in is the first to go.  The period is memsize
+ * references, about as long as LRU keeps a page that is no longer
+ * referenced, so LRU-K only departs from LRU for longer reuse distances.
+ *
+ * Frames in their correlated period are kept in a list, oldest last
+ * reference at the head.  Before each eviction, the frames at the head
+ * whose period has ended move to a binary min-heap ordered by (K-th most
+ * recent reference, last reference), whose top is the victim.  Keys only
+ * change while a frame is in the list, so every operation costs
+ * O(log memsize).
+ *
+ * The reference history of evicted pages is retained in a direct-mapped
+ * table of at least memsize entries, so a page that comes back soon after
+ * its eviction is not treated as never seen.  Collisions simply drop the
+ * older history, which keeps the table bounded.
+ */
+
+#define LRUK_CRP ((long)memsize)
+#define LRUK_NIL (-1)
+#define LRUK_RECENT (-2)       // lruk_heap of a frame in the list
+
+struct lruk_hist {
+	addr_t vaddr;          // page the history belongs to, 0 if empty
+	long hist[LRUK_K];
+};
+
+static int *heap;              // frame numbers
+static int heap_size;
+static struct lruk_hist *history;
+static unsigned history_mask;  // table size - 1, a power of two
+
+// Frames in their correlated period, oldest last reference at the head
+static struct {
+	int head, tail;
+} recent;
+
+// Nonzero if frame a should be evicted before frame b
+static int lruk_before(int a, int b) {
+	struct frame *fa = &coremap[a];
+	struct frame *fb = &coremap[b];
+
+	if (fa->lruk_hist[LRUK_K - 1] != fb->lruk_hist[LRUK_K - 1]) {
+		return fa->lruk_hist[LRUK_K - 1] < fb->lruk_hist[LRUK_K - 1];
+	}
+	return fa->lruk_last < fb->lruk_last;
+}
+
+static void heap_place(int pos, int frame) {
+	heap[pos] = frame;
+	coremap[frame].lruk_heap = pos;
+}
+
+static void sift_up(int pos) {
+	int frame = heap[pos];
+
+	while (pos > 0) {
+		int parent = (pos - 1) / 2;
+		if (!lruk_before(frame, heap[parent])) {
+			break;
+		}
+		heap_place(pos, heap[parent]);
+		pos = parent;
+	}
+	heap_place(pos, frame);
+}
+
+static void sift_down(int pos) {
+	int frame = heap[pos];
+
+	for (;;) {
+		int child = 2 * pos + 1;
+		if (child >= heap_size) {
+			break;
+		}
+		if (child + 1 < heap_size && lruk_before(heap[child + 1], heap[child])) {
+			child++;
+		}
+		if (!lruk_before(heap[child], frame)) {
+			break;
+		}
+		heap_place(pos, heap[child]);
+		pos = child;
+	}
+	heap_place(pos, frame);
+}
+
+static void heap_remove(int pos) {
+	coremap[heap[pos]].lruk_heap = LRUK_NIL;
+	heap_size--;
+	if (pos < heap_size) {
+		int last = heap[heap_size];
+		heap_place(pos, last);
+		sift_up(pos);
+		sift_down(coremap[last].lruk_heap);
+	}
+}
+
+static void recent_unlink(int frame) {
+	struct frame *f = &coremap[frame];
+
+	if (f->lruk_prev != LRUK_NIL) {
+		coremap[f->lruk_prev].lruk_next = f->lruk_next;
+	} else {
+		recent.head = f->lruk_next;
+	}
+	if (f->lruk_next != LRUK_NIL) {
+		coremap[f->lruk_next].lruk_prev = f->lruk_prev;
+	} else {
+		recent.tail = f->lruk_prev;
+	}
+	f->lruk_heap = LRUK_NIL;
+}
+
+static void recent_append(int frame) {
+	struct frame *f = &coremap[frame];
+
+	f->lruk_heap = LRUK_RECENT;
+	f->lruk_next = LRUK_NIL;
+	f->lruk_prev = recent.tail;
+	if (recent.tail != LRUK_NIL) {
+		coremap[recent.tail].lruk_next = frame;
+	} else {
+		recent.head = frame;
+	}
+	recent.tail = frame;
+}
+
+// Stop tracking a frame, wherever it is
+static void lruk_untrack(int frame) {
+	if (coremap[frame].lruk_heap == LRUK_RECENT) {
+		recent_unlink(frame);
+	} else if (coremap[frame].lruk_heap >= 0) {
+		heap_remove(coremap[frame].lruk_heap);
+	}
+}
+
+static struct lruk_hist *history_slot(addr_t vaddr) {
+	unsigned long h = (vaddr >> PAGE_SHIFT) * 0x9E3779B97F4A7C15UL;
+	return &history[(h >> 32) & history_mask];
+}
+
+// Record a new uncorrelated reference at the current time.  The older
+// history moves forward by the length of the correlated period just ended.
+static void lruk_shift(struct frame *f) {
+	long period = f->lruk_last - f->lruk_hist[0];
+	int i;
+
+	for (i = LRUK_K - 1; i > 0; i--) {
+		f->lruk_hist[i] = f->lruk_hist[i - 1] ? f->lruk_hist[i - 1] + period : 0;
+	}
+	f->lruk_hist[0] = ref_count;
+	f->lruk_last = ref_count;
+}
+
+/* Page to evict is chosen using the lru-k algorithm.
+ * Returns the page frame number (which is also the index in the coremap)
+ * for the page that is to be evicted.
+ */
+int lruk_evict() {
+	int frame;
+	struct lruk_hist *h;
+
+	// Frames whose correlated period has ended become candidates
+	while (recent.head != LRUK_NIL &&
+	       ref_count - coremap[recent.head].lruk_last > LRUK_CRP) {
+		frame = recent.head;
+		recent_unlink(frame);
+		heap[heap_size] = frame;
+		heap_size++;
+		sift_up(heap_size - 1);
+	}
+	if (heap_size > 0) {
+		frame = heap[0];
+		heap_remove(0);
+	} else {
+		// Every page is in its correlated period: take the least
+		// recently used
+		assert(recent.head != LRUK_NIL);
+		frame = recent.head;
+		recent_unlink(frame);
+	}
+
+	// Retain the history of the evicted page
+	h = history_slot(coremap[frame].vaddr);
+	h->vaddr = coremap[frame].vaddr;
+	memcpy(h->hist, coremap[frame].lruk_hist, sizeof(h->hist));
+	return frame;
+}
+
+/* This function is called on each access to a page to update any information
+ * needed by the lru-k algorithm.
+ * Input: The page table entry for the page that is being accessed.
+ */
+void lruk_ref(pgtbl_entry_t *p) {
+	int frame = p->frame >> PAGE_SHIFT;
+	struct frame *f = &coremap[frame];
+
+	if (f->lruk_heap != LRUK_NIL) {
+		lruk_untrack(frame);
+		if (ref_count - f->lruk_last > LRUK_CRP) {
+			lruk_shift(f);
+		} else {
+			f->lruk_last = ref_count;
+		}
+		recent_append(frame);
+		return;
+	}
+
+	// A page that was just brought in: pick up its retained history.  Its
+	// last correlated period ended with its eviction.
+	struct lruk_hist *h = history_slot(f->vaddr);
+	if (h->vaddr == f->vaddr) {
+		memcpy(f->lruk_hist, h->hist, sizeof(f->lruk_hist));
+		h->vaddr = 0;
+	} else {
+		memset(f->lruk_hist, 0, sizeof(f->lruk_hist));
+	}
+	f->lruk_last = f->lruk_hist[0];
+	lruk_shift(f);
+	recent_append(frame);
+}
+
+/* Stops tracking a frame that was freed without being evicted (its
+ * process exited).  Its history goes with it.
+ */
+void lruk_release(int frame) {
+	lruk_untrack(frame);
+}
+
+/* Initialize any data structures needed for this
+ * replacement algorithm
+ */
+void lruk_init() {
+	unsigned size = 1;
+	int i;
+
+	while (size < memsize) {
+		size <<= 1;
+	}
+	history_mask = size - 1;
+	free(history);
+	free(heap);
+	history = calloc(size, sizeof(struct lruk_hist));
+	heap = malloc(memsize * sizeof(int));
+	if (history == NULL || heap == NULL) {
+		perror("lruk_init");
+		exit(1);
+	}
+	heap_size = 0;
+	recent.head = recent.tail = LRUK_NIL;
+	for (i = 0; i < memsize; i++) {
+		coremap[i].lruk_heap = LRUK_NIL;
+	}
+
+	snapshot_register("lruk_heap", heap, memsize * sizeof(int));
+	snapshot_register("lruk_size", &heap_size, sizeof(heap_size));
+	snapshot_register("lruk_recent", &recent, sizeof(recent));
+	snapshot_register("lruk_history", history, size * sizeof(struct lruk_hist));
+}
@@ -4,8 +4,8 @@
 #include <getopt.h>
 #include <stdlib.h>
 #include "pagetable.h"
-
-#define MAXLINE 256
+#include "scan.h"
+#include "trace.h"
 
 
 extern int memsize;
@@ -16,27 +16,18 @@ extern struct frame *coremap;
 
 extern char  *tracefile;
 
-int  file_line_size;  // tracefile  line number
+long file_line_size;  // tracefile  line number
 addr_t * trace_file_vaddr;   //  record trace file virtual address
+static long file_line_idx = 0;  // current trace file line number
+static long *opt_dist;   // per frame: distance to the next use of its page
 
 /* Page to evict is chosen using the optimal (aka MIN) algorithm. 
  * Returns the page frame number (which is also the index in the coremap)
  * for the page that is to be evicted.
  */
 int opt_evict() {
-
-	int frame = 0;
-	int max_dis = 0;
-
 	// find max distance
-	for (int i=0; i < memsize; ++i){
-		if (max_dis < coremap[i].dis){
-			max_dis = coremap[i].dis;
-			frame = i;
-		}
-	}	
-	
-	return frame;
+	return scan_argmax(opt_dist, memsize);
 }
 
 /* This function is called on each access to a page to update any information
@@ -47,15 +38,12 @@ void opt_ref(pgtbl_entry_t *p) {
 
 	int frame = p->frame >> PAGE_SHIFT;
 
-	// record  current trace file line number
-	static int file_line_idx = 0;
-
 	addr_t cur_vaddr = trace_file_vaddr[file_line_idx];
 
-	int dis = 0;
+	long dis = 0;
 
 	//cur virtual address to next simple virtual address distance
-	for (int i = file_line_idx + 1; i < file_line_size; ++i){
+	for (long i = file_line_idx + 1; i < file_line_size; ++i){
 		if (cur_vaddr != trace_file_vaddr[i]){
 			dis++;
 		}
@@ -64,7 +52,7 @@ void opt_ref(pgtbl_entry_t *p) {
 		}
 	}
     
-	coremap[frame].dis = dis;
+	opt_dist[frame] = dis;
 
 	// move file index
 	file_line_idx ++;
@@ -76,42 +64,41 @@ void opt_ref(pgtbl_entry_t *p) {
  */
 void opt_init() {
 	file_line_size = 0;
-	char buf[MAXLINE];
-	addr_t vaddr = 0;
-	char type;
-	int i;
-	FILE * tfp;
-
-	for (i=0; i < memsize; ++i){
-		coremap[i].dis = 0;
-	}
+	struct trace tr;
+	struct trace_ref ref;
+	long i;
+
+	file_line_idx = 0;
+	free(opt_dist);
+	opt_dist = scan_alloc(memsize, sizeof(long));
+	snapshot_register("opt", &file_line_idx, sizeof(file_line_idx));
+	snapshot_register("opt_dist", opt_dist, memsize * sizeof(long));
 
 	//read virtual address from tracefile
-	if((tfp = fopen(tracefile, "r")) == NULL) {
+	if (trace_open(&tr, tracefile) != 0) {
 		perror("Error opening tracefile:");
 		exit(1);
 	}
 
-	// count total line number
-	while(fgets(buf, MAXLINE, tfp) != NULL) {
-		if(buf[0] != '=') {
+	// count total line number; process events are not references
+	while (trace_next(&tr, &ref)) {
+		if (!TRACE_IS_EVENT(ref.type)) {
 			file_line_size ++;
 		}
 	}
 
 	// malloc 
+	free(trace_file_vaddr);
 	trace_file_vaddr = (addr_t *)malloc(file_line_size * sizeof (addr_t));
 	// recovery  file pointer 
-	fseek(tfp, 0, SEEK_SET);
+	trace_seek(&tr, 0);
 	//  read content
 	i = 0;
-	while(fgets(buf, MAXLINE, tfp) != NULL) {
-		if(buf[0] != '=') {
-			sscanf(buf, "%c %lx", &type, &vaddr);
-			trace_file_vaddr[i] = vaddr;
+	while (trace_next(&tr, &ref)) {
+		if (!TRACE_IS_EVENT(ref.type)) {
+			trace_file_vaddr[i] = ref.addr;
 			i++;
 		}
 	}
-	fclose(tfp);
+	trace_close(&tr);
 }
-
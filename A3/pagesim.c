@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "pagetable.h"
+#include "scan.h"
+#include "pagesim.h"
+#include "trace.h"
+
+//---------------------------------------------------------------------
+// The library interface to the simulator (see pagesim.h).  The simulator
+// modules keep their state in globals; a pagesim_t only marks that they
+// are set up, so there is at most one at a time.
+
+// Define global variables declared in sim.h
+unsigned memsize = 0;
+int debug = 0;
+char *physmem = NULL;
+struct frame *coremap = NULL;
+char *tracefile = NULL;
+char *replacement_alg = NULL;
+
+/* The algs array gives us a mapping between the name of an eviction
+ * algorithm as given in a command line argument, and the function to
+ * call to select the victim page.
+ */
+struct functions algs[] = {
+	{"rand", rand_init, rand_ref, rand_evict, NULL},
+	{"lru", lru_init, lru_ref, lru_evict, NULL},
+	{"fifo", fifo_init, fifo_ref, fifo_evict, NULL},
+	{"clock",clock_init, clock_ref, clock_evict, NULL},
+	{"opt", opt_init, opt_ref, opt_evict, NULL},
+	{"lfu", lfu_init, lfu_ref, lfu_evict, lfu_release},
+	{"lruk", lruk_init, lruk_ref, lruk_evict, lruk_release}
+};
+int num_algs = sizeof(algs) / sizeof(algs[0]);
+
+void (*init_fcn)() = NULL;
+void (*ref_fcn)(pgtbl_entry_t *) = NULL;
+int (*evict_fcn)() = NULL;
+void (*release_fcn)(int) = NULL;
+
+#if PAGESIM_MAX_GROUPS != MAX_GROUPS || PAGESIM_GROUP_NAMELEN != GROUP_NAMELEN
+#error "pagesim.h and sim.h disagree on the groups"
+#endif
+
+struct pagesim {
+	char alg[16];
+	long resume_off;
+};
+
+static struct pagesim the_sim;
+static int sim_alive = 0;
+
+
+/* An actual memory access based on the vaddr from the trace file.
+ *
+ * The find_physpage() function is called to translate the virtual address
+ * to a (simulated) physical address -- that is, a pointer to the right
+ * location in physmem array. The find_physpage() function is responsible for
+ * everything to do with memory management - including translation using the
+ * pagetable, allocating a frame of (simulated) physical memory (if needed),
+ * evicting an existing page from the frame (if needed) and reading the page
+ * in from swap (if needed).
+ *
+ * We then check that the memory has the expected content (just a copy of the
+ * virtual address) and, in case of a write reference, increment the version
+ * counter.
+ *
+ * A reference with a count stands for that many consecutive references to
+ * the page; all but the first are hits, and are only counted.
+ *
+ * Process events (fork, switch and exit, see proc.c) and group selections
+ * (see group.c) come in the same stream as the references, with the pid or
+ * group in place of the vaddr.
+ */
+static inline void access_mem(char type, addr_t vaddr, unsigned count) {
+	if (TRACE_IS_EVENT(type)) {
+		if (type == 'G') {
+			group_select(vaddr);
+		} else {
+			proc_event(type, vaddr);
+		}
+		return;
+	}
+	if (pgdir == NULL) {
+		fprintf(stderr, "Error: reference after the current process exited\n");
+		exit(1);
+	}
+	char *memptr = find_physpage(vaddr, type, count ? count : 1);
+	int *versionptr = (int *)memptr;
+	addr_t *checkaddr = (addr_t *)(memptr + sizeof(int));
+	if (*checkaddr != vaddr) {
+		fprintf(stderr,"Error, simulated page returned by pagetable lookup doese not have expected value.\n");
+	}
+
+	if (type == 'S' || type == 'M') {
+		// write access to page, increment version number
+		(*versionptr)++;
+	}
+
+}
+
+void pagesim_access(pagesim_t *ps, const struct pagesim_ref *refs, size_t n) {
+	size_t i;
+
+	assert(ps == &the_sim && sim_alive);
+	for (i = 0; i < n; i++) {
+		access_mem(refs[i].type, refs[i].addr, refs[i].count);
+	}
+}
+
+void pagesim_config_default(struct pagesim_config *cfg) {
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->swapsize = 4096;
+	cfg->clean_interval = 1000;
+	cfg->tier_fast_ns = 80;
+	cfg->tier_slow_ns = 250;
+	cfg->zswap_page_bytes = ZSWAP_PAGE_BYTES;
+	cfg->rand_seed = 1;
+}
+
+pagesim_t *pagesim_create(const struct pagesim_config *cfg) {
+	unsigned swapsize = cfg->swapsize;
+	int vabits = cfg->vabits ? cfg->vabits : VABITS_DEFAULT;
+	int i;
+
+	if (sim_alive) {
+		fprintf(stderr, "pagesim: only one simulator can exist at a time\n");
+		return NULL;
+	}
+	memset(&the_sim, 0, sizeof(the_sim));
+	memsize = cfg->memsize;
+	if (cfg->alg != NULL) {
+		strncpy(the_sim.alg, cfg->alg, sizeof(the_sim.alg) - 1);
+	}
+
+	if (cfg->resume != NULL) {
+		// The snapshot determines the memory size and algorithm.
+		unsigned snap_mem;
+		char snap_alg[sizeof(the_sim.alg)];
+		int snap_vabits;
+		if (cfg->tracefile == NULL) {
+			fprintf(stderr, "Error: resuming requires a tracefile (-f)\n");
+			return NULL;
+		}
+		if (snapshot_open(cfg->resume, &snap_mem, &swapsize, &snap_vabits,
+				  snap_alg, sizeof(snap_alg)) != 0) {
+			return NULL;
+		}
+		if ((memsize != 0 && memsize != snap_mem) ||
+		    (cfg->alg != NULL && strcmp(cfg->alg, snap_alg) != 0)) {
+			fprintf(stderr, "Error: snapshot was taken with -m %u -a %s\n",
+				snap_mem, snap_alg);
+			return NULL;
+		}
+		memsize = snap_mem;
+		vabits = snap_vabits;
+		strcpy(the_sim.alg, snap_alg);
+	}
+
+	evict_fcn = NULL;
+	for (i = 0; i < num_algs; i++) {
+		if(strcmp(algs[i].name, the_sim.alg) == 0) {
+			init_fcn = algs[i].init;
+			ref_fcn = algs[i].ref;
+			evict_fcn = algs[i].evict;
+			release_fcn = algs[i].release;
+			break;
+		}
+	}
+	if(evict_fcn == NULL) {
+		fprintf(stderr, "Error: invalid replacement algorithm - %s\n",
+				the_sim.alg);
+		return NULL;
+	}
+	if (memsize == 0) {
+		fprintf(stderr, "Error: memory size must be at least one frame\n");
+		return NULL;
+	}
+	if (pagetable_geometry(vabits) != 0) {
+		return NULL;
+	}
+	replacement_alg = the_sim.alg;
+	tracefile = (char *)cfg->tracefile;
+	rand_seed = cfg->rand_seed;
+	clean_batch = cfg->clean_batch;
+	clean_interval = cfg->clean_interval ? cfg->clean_interval : 1;
+	zswap_pool_bytes = cfg->zswap_bytes;
+	zswap_page_bytes = cfg->zswap_page_bytes;
+	tier_fast_frames = cfg->tier_fast_frames;
+	tier_fast_ns = cfg->tier_fast_ns;
+	tier_slow_ns = cfg->tier_slow_ns;
+	if (cfg->ngroups > PAGESIM_MAX_GROUPS) {
+		fprintf(stderr, "Error: at most %d memory-limit groups\n",
+			PAGESIM_MAX_GROUPS);
+		return NULL;
+	}
+	num_groups = cfg->ngroups;
+	for (i = 0; i < num_groups; i++) {
+		struct group *g = &groups[i + 1];
+		memset(g->name, 0, sizeof(g->name));
+		strncpy(g->name, cfg->groups[i].name, sizeof(g->name) - 1);
+		g->hard = cfg->groups[i].hard;
+		g->soft = cfg->groups[i].soft;
+	}
+
+	hit_count = miss_count = ref_count = 0;
+	evict_clean_count = evict_dirty_count = 0;
+	clean_write_count = clean_saved_count = 0;
+
+	// Initialize main data structures for simulation.
+	// This happens before calling the replacement algorithm init function
+	// so that the init_fcn can refer to the coremap if needed.
+	coremap = calloc(memsize, sizeof(struct frame));
+	physmem = malloc(memsize * SIMPAGESIZE);
+	swap_init(swapsize);
+	zswap_init(swapsize);
+	init_pagetable();
+	proc_init();
+
+	// Call replacement algorithm's init_fcn before replaying trace.
+	scan_init();
+	cleaner_init();
+	tier_init();
+	group_init();
+	init_fcn();
+	sim_alive = 1;
+
+	// Resuming replaces everything init_fcn set up with the saved state.
+	if (cfg->resume != NULL) {
+		the_sim.resume_off = snapshot_restore();
+		if (the_sim.resume_off < 0) {
+			fprintf(stderr, "Error: cannot resume from %s\n", cfg->resume);
+			pagesim_destroy(&the_sim);
+			return NULL;
+		}
+	}
+	return &the_sim;
+}
+
+void pagesim_counters(pagesim_t *ps, struct pagesim_counters *out) {
+	int i;
+
+	assert(ps == &the_sim && sim_alive);
+	memset(out, 0, sizeof(*out));
+	out->refs = ref_count;
+	out->hits = hit_count;
+	out->misses = miss_count;
+	out->evict_clean = evict_clean_count;
+	out->evict_dirty = evict_dirty_count;
+	out->clean_writes = clean_write_count;
+	out->clean_saved = clean_saved_count;
+	out->zswap_pageouts = zswap_stats.pageouts;
+	out->zswap_pageins = zswap_stats.pageins;
+	out->zswap_stores = zswap_stats.stores;
+	out->zswap_rejects = zswap_stats.rejects;
+	out->zswap_loads = zswap_stats.loads;
+	out->zswap_writebacks = zswap_stats.writebacks;
+	out->zswap_bytes_in = zswap_stats.bytes_in;
+	out->zswap_bytes_out = zswap_stats.bytes_out;
+	out->tier_fast_accesses = tier_stats.accesses[TIER_FAST];
+	out->tier_slow_accesses = tier_stats.accesses[TIER_SLOW];
+	out->tier_promotions = tier_stats.promotions;
+	out->tier_demotions = tier_stats.demotions;
+	out->forks = fork_count;
+	out->exits = exit_count;
+	out->cow_faults = cow_fault_count;
+	out->cow_reuses = cow_reuse_count;
+	out->shared_saved = shared_saved;
+	out->shared_saved_peak = shared_saved_peak;
+	out->ngroups = num_groups;
+	for (i = 0; num_groups && i <= num_groups; i++) {
+		struct pagesim_group_counters *g = &out->groups[i];
+		strcpy(g->name, groups[i].name);
+		g->frames = groups[i].frames;
+		g->peak = groups[i].peak;
+		g->refs = groups[i].refs;
+		g->misses = groups[i].misses;
+		g->reclaims = groups[i].reclaims;
+	}
+}
+
+unsigned pagesim_memsize(pagesim_t *ps) {
+	return memsize;
+}
+
+const char *pagesim_alg(pagesim_t *ps) {
+	return ps->alg;
+}
+
+int pagesim_save(pagesim_t *ps, const char *path, long trace_off) {
+	assert(ps == &the_sim && sim_alive);
+	return snapshot_save(path, trace_off, ps->alg);
+}
+
+long pagesim_resume_offset(pagesim_t *ps) {
+	return ps->resume_off;
+}
+
+void pagesim_print_pagedirectory(pagesim_t *ps) {
+	print_pagedirectory();
+}
+
+void pagesim_destroy(pagesim_t *ps) {
+	assert(ps == &the_sim && sim_alive);
+
+	// Processes give back their frames and swap slots first, then
+	// cleanup removes the temporary swapfile.
+	proc_destroy();
+	swap_destroy();
+	snapshot_reset();
+	free(coremap);
+	free(physmem);
+	coremap = NULL;
+	physmem = NULL;
+	sim_alive = 0;
+}
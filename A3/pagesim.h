@@ -0,0 +1,135 @@
+#ifndef __PAGESIM_H__
+#define __PAGESIM_H__
+
+#include <stddef.h>
+
+/* libpagesim: the paging simulator as a library.
+ *
+ *	struct pagesim_config cfg;
+ *	pagesim_config_default(&cfg);
+ *	cfg.memsize = 64;
+ *	cfg.alg = "clock";
+ *	pagesim_t *ps = pagesim_create(&cfg);
+ *	pagesim_access(ps, refs, nrefs);     // as often as needed
+ *	pagesim_counters(ps, &counters);
+ *	pagesim_destroy(ps);
+ *
+ * The simulator keeps its state in globals, so only one simulator can
+ * exist at a time: pagesim_create fails while another one is alive.
+ */
+
+#define PAGESIM_MAX_GROUPS 16
+#define PAGESIM_GROUP_NAMELEN 16
+
+// A memory-limit group; the trace refers to groups by number, from 1
+struct pagesim_group {
+	const char *name;
+	unsigned hard;             // frame limit, 0 = none
+	unsigned soft;             // reclaimed first above this, 0 = none
+};
+
+struct pagesim_config {
+	unsigned memsize;          // frames of physical memory
+	unsigned swapsize;         // pages of swap
+	const char *alg;           // replacement algorithm name
+	const char *tracefile;     // trace being replayed; required by "opt"
+	int vabits;                // virtual address width: 32, 36 or 48,
+				   // 0 = 36
+	unsigned long rand_seed;   // seed for "rand"; same seed, same victims
+
+	unsigned clean_batch;      // page cleaner batch, 0 = no cleaner
+	unsigned clean_interval;   // references between cleaner runs
+	unsigned zswap_bytes;      // compressed swap pool, 0 = none
+	unsigned zswap_page_bytes; // mean compressed size of a 4 KiB page
+	unsigned tier_fast_frames; // fast memory tier, 0 = untiered
+	unsigned tier_fast_ns;
+	unsigned tier_slow_ns;
+	int ngroups;               // memory-limit groups, 0 = none
+	struct pagesim_group groups[PAGESIM_MAX_GROUPS];
+
+	const char *resume;        // snapshot to resume from, or NULL; its
+				   // memsize, swapsize and alg override the above
+};
+
+struct pagesim_ref {
+	char type;                 // 'I', 'L', 'S' or 'M', or an event
+				   // 'F', 'P', 'X' or 'G' (see trace.h)
+	unsigned long addr;        // or the pid or group, for an event
+	unsigned count;            // consecutive references to the page it
+				   // stands for (see tracerle); 0 means 1
+};
+
+struct pagesim_group_counters {
+	char name[PAGESIM_GROUP_NAMELEN];
+	unsigned frames;           // charged now, and at most
+	unsigned peak;
+	long refs;
+	long misses;
+	int reclaims;              // own frames evicted because of its limits
+};
+
+struct pagesim_counters {
+	long refs;
+	long hits;
+	long misses;
+	long evict_clean;
+	long evict_dirty;
+
+	long clean_writes;         // page cleaner
+	long clean_saved;
+
+	long zswap_pageouts;       // compressed swap tier
+	long zswap_pageins;
+	long zswap_stores;
+	long zswap_rejects;
+	long zswap_loads;
+	long zswap_writebacks;
+	long zswap_bytes_in;
+	long zswap_bytes_out;
+
+	long tier_fast_accesses;   // tiered memory
+	long tier_slow_accesses;
+	long tier_promotions;
+	long tier_demotions;
+
+	long forks;                // processes (see proc.c)
+	long exits;
+	long cow_faults;           // writes that copied a shared page
+	long cow_reuses;           // writes to a COW page no longer shared
+	int shared_saved;          // frames saved by sharing, now and at most
+	int shared_saved_peak;
+
+	int ngroups;               // memory-limit groups; groups[0] is the
+	struct pagesim_group_counters groups[PAGESIM_MAX_GROUPS + 1]; // root
+};
+
+typedef struct pagesim pagesim_t;
+
+extern void pagesim_config_default(struct pagesim_config *cfg);
+
+// Return: the simulator, or NULL (after printing why) on a bad config
+extern pagesim_t *pagesim_create(const struct pagesim_config *cfg);
+
+// Simulate n references, in order
+extern void pagesim_access(pagesim_t *ps, const struct pagesim_ref *refs, size_t n);
+
+extern void pagesim_counters(pagesim_t *ps, struct pagesim_counters *out);
+
+// Memory size and algorithm in effect (they come from the snapshot when
+// resuming)
+extern unsigned pagesim_memsize(pagesim_t *ps);
+extern const char *pagesim_alg(pagesim_t *ps);
+
+// Write a snapshot of the state; trace_off is where in the trace the next
+// reference is, for the resume.  Return: 0 on success
+extern int pagesim_save(pagesim_t *ps, const char *path, long trace_off);
+
+// Trace offset recorded in the snapshot the simulator resumed from, or 0
+extern long pagesim_resume_offset(pagesim_t *ps);
+
+// Print the page directory and tables to standard output
+extern void pagesim_print_pagedirectory(pagesim_t *ps);
+
+extern void pagesim_destroy(pagesim_t *ps);
+
+#endif /* __PAGESIM_H__ */
@@ -3,85 +3,260 @@
 #include "sim.h"
 #include "pagetable.h"
 
-// The top-level page table (also known as the 'page directory')
-pgdir_entry_t pgdir[PTRS_PER_PGDIR]; 
+// The top-level page table (also known as the 'page directory') of the
+// current process
+pgdir_entry_t *pgdir;
 
 // Counters for various events.
 // Your code must increment these when the related events occur.
-int hit_count = 0;
-int miss_count = 0;
-int ref_count = 0;
-int evict_clean_count = 0;
-int evict_dirty_count = 0;
+long hit_count = 0;
+long miss_count = 0;
+long ref_count = 0;
+long evict_clean_count = 0;
+long evict_dirty_count = 0;
+
+long cow_fault_count = 0;
+long cow_reuse_count = 0;
+int shared_saved = 0;
+int shared_saved_peak = 0;
+
+// Frames are handed out from the fill cursor (the lowest-numbered frame
+// that has never been allocated) and, once processes exit, from a stack
+// of freed frames.
+static struct {
+	unsigned next_free_frame;
+	unsigned nfree;
+} frames;
+static int *free_frames;
+
+// Swap cache: for each swap slot shared copy-on-write, the frame it was
+// last read into (or -1), so that the other processes sharing the slot
+// map that frame instead of reading their own copy.  It is only a hint;
+// the frame is checked to still hold the slot.
+static int *swapcache;
+
+/*
+ * Sharing of frames between processes.  A frame holds one page, which
+ * any number of processes may map after a fork: coremap[frame].pte is one
+ * of the ptes mapping it and coremap[frame].rmap lists the others.  All
+ * ptes mapping a frame agree on its dirty bit and swap slot (a write to a
+ * shared page first gives the writer a private copy), so the state of the
+ * page can be read from any of them but must be changed in all of them.
+ */
+
+#define for_each_pte(f, p, r) \
+	for ((r) = NULL, (p) = (f)->pte; (p) != NULL; \
+	     (r) = (r) ? (r)->next : (f)->rmap, (p) = (r) ? (r)->pte : NULL)
+
+// Adds pte p to the ptes mapping a frame that is already in use
+static void frame_map(int frame, pgtbl_entry_t *p) {
+	struct frame *f = &coremap[frame];
+	struct rmap *r = malloc(sizeof(struct rmap));
+
+	r->pte = p;
+	r->next = f->rmap;
+	f->rmap = r;
+	f->mapcount++;
+	if (++shared_saved > shared_saved_peak) {
+		shared_saved_peak = shared_saved;
+	}
+}
+
+// Removes pte p from the ptes mapping a shared frame
+static void frame_unmap(int frame, pgtbl_entry_t *p) {
+	struct frame *f = &coremap[frame];
+	struct rmap **rp, *r;
+
+	assert(f->mapcount > 1);
+	if (f->pte == p) {
+		r = f->rmap;
+		f->pte = r->pte;
+		f->rmap = r->next;
+	} else {
+		for (rp = &f->rmap; (*rp)->pte != p; rp = &(*rp)->next) {
+			;
+		}
+		r = *rp;
+		*rp = r->next;
+	}
+	free(r);
+	f->mapcount--;
+	shared_saved--;
+}
+
+// Marks the page in frame invalid in every pte mapping it
+static void frame_unmap_all(int frame) {
+	struct frame *f = &coremap[frame];
+	struct rmap *r, *next;
+
+	f->pte->frame &= ~(PG_VALID | PG_DIRTY);
+	for (r = f->rmap; r != NULL; r = next) {
+		r->pte->frame &= ~(PG_VALID | PG_DIRTY);
+		next = r->next;
+		free(r);
+	}
+	shared_saved -= f->mapcount - 1;
+	f->rmap = NULL;
+	f->mapcount = 0;
+}
+
+// Puts a frame whose page is gone on the free stack
+static void frame_release(int frame) {
+	if (num_groups) {
+		group_uncharge(frame);
+	}
+	coremap[frame].in_use = 0;
+	coremap[frame].pte = NULL;
+	coremap[frame].mapcount = 0;
+	free_frames[frames.nfree++] = frame;
+	if (release_fcn != NULL) {
+		release_fcn(frame);
+	}
+}
+
+/* Records in every pte mapping frame that its page is now clean and on
+ * swap at swap_off.  The ptes had the same slot before, or none, in which
+ * case the new slot gets a reference for each of them.
+ */
+void frame_swapped(int frame, int swap_off) {
+	struct frame *f = &coremap[frame];
+	pgtbl_entry_t *p;
+	struct rmap *r;
+	int new_slot = f->pte->swap_off == INVALID_SWAP;
+
+	for_each_pte(f, p, r) {
+		if (new_slot && p != f->pte) {
+			swap_dup(swap_off);
+		}
+		p->swap_off = swap_off;
+		p->frame |= PG_ONSWAP;
+		p->frame &= ~PG_DIRTY;
+	}
+}
+
+/* Clears PG_REF in every pte mapping frame.
+ * Return: nonzero if any of them had it set
+ */
+int frame_clear_ref(int frame) {
+	struct frame *f = &coremap[frame];
+	pgtbl_entry_t *p;
+	struct rmap *r;
+	int ref = 0;
+
+	for_each_pte(f, p, r) {
+		ref |= p->frame & PG_REF;
+		p->frame &= ~PG_REF;
+	}
+	return ref;
+}
+
+// Frame holding the page of the shared slot p is on, or -1
+static int swapcache_lookup(pgtbl_entry_t *p) {
+	int frame = swapcache[p->swap_off / SIMPAGESIZE];
+
+	if (frame >= 0 && coremap[frame].in_use &&
+	    coremap[frame].pte->swap_off == p->swap_off) {
+		return frame;
+	}
+	return -1;
+}
+
+/*
+ * Evicts the page in the given frame: writes it to swap if needed, and
+ * updates the pagetable entries mapping it to indicate that the virtual
+ * page is no longer in (simulated) physical memory.
+ *
+ * Counters for evictions should be updated appropriately in this function.
+ */
+static void evict_page(int frame) {
+	//the victim page is dirty
+	if (coremap[frame].pte->frame & PG_DIRTY){
+		//write victim page to swap, recording it in every
+		//process that maps it
+		frame_swapped(frame, swap_pageout(frame, coremap[frame].pte->swap_off));
+		// increment dirty count
+		evict_dirty_count ++;
+	}
+	else{
+		evict_clean_count ++;
+		if (coremap[frame].cleaned) {
+			// the page cleaner already wrote this page back
+			clean_saved_count ++;
+		}
+	}
+
+	//set to invalid, not dirty
+	frame_unmap_all(frame);
+}
 
 /*
  * Allocates a frame to be used for the virtual page represented by p.
  * If all frames are in use, calls the replacement algorithm's evict_fcn to
- * select a victim frame.  Writes victim to swap if needed, and updates 
- * pagetable entry for victim to indicate that virtual page is no longer in
- * (simulated) physical memory.
+ * select a victim frame, and evicts the page in it.
  *
- * Counters for evictions should be updated appropriately in this function.
+ * With memory-limit groups, a group at its hard limit reclaims one of its
+ * own frames instead, even if others are free, and when memory is full a
+ * group over its soft limit gives up one of its frames first (see
+ * group.c).  The replacement algorithm did not choose those frames, so
+ * it is told to forget them.
  */
 int allocate_frame(pgtbl_entry_t *p) {
-	int i;
 	int frame = -1;
-	for(i = 0; i < memsize; i++) {
-		if(!coremap[i].in_use) {
-			frame = i;
-			break;
+	if (num_groups && (frame = group_reclaim_hard()) != -1) {
+		evict_page(frame);
+		if (release_fcn != NULL) {
+			release_fcn(frame);
 		}
-	}
-	if(frame == -1) { // Didn't find a free page.
+	} else if (frames.nfree > 0) {
+		frame = free_frames[--frames.nfree];
+		assert(!coremap[frame].in_use);
+	} else if (frames.next_free_frame < memsize) {
+		frame = frames.next_free_frame++;
+		assert(!coremap[frame].in_use);
+	} else if (num_groups && (frame = group_reclaim_soft()) != -1) {
+		evict_page(frame);
+		if (release_fcn != NULL) {
+			release_fcn(frame);
+		}
+	} else {
 		// Call replacement algorithm's evict function to select victim
+		// All frames are in use, so victim frame must hold some page
 		frame = evict_fcn();
-
-		// All frames were in use, so victim frame must hold some page
-		// Write victim page to swap, if needed, and update pagetable
-		// IMPLEMENTATION NEEDED
-
-		//the victim page is dirty
-		if (coremap[frame].pte->frame & PG_DIRTY){
-			//write victim page to swap
-			coremap[frame].pte->swap_off = swap_pageout(coremap[frame].pte->frame >> PAGE_SHIFT, coremap[frame].pte->swap_off);
-			// set status
-			coremap[frame].pte->frame |= PG_ONSWAP;
-			// increment dirty count
-			evict_dirty_count ++;
-		}
-		else{
-			evict_clean_count ++;
-		}
-
-		//set to invalid, not dirty
-		coremap[frame].pte->frame &= ~PG_VALID; 
-		coremap[frame].pte->frame &= ~PG_DIRTY;
+		evict_page(frame);
 	}
 
 	// Record information for virtual page that will now be stored in frame
 	coremap[frame].in_use = 1;
 	coremap[frame].pte = p;
+	coremap[frame].mapcount = 1;
+	coremap[frame].cleaned = 0;
+	coremap[frame].tier_heat = 0;
+	if (num_groups) {
+		group_charge(frame);
+	}
 
 	return frame;
 }
 
 /*
  * Initializes the top-level pagetable.
- * This function is called once at the start of the simulation.
- * For the simulation, there is a single "process" whose reference trace is 
- * being simulated, so there is just one top-level page table (page directory).
- * To keep things simple, we use a global array of 'page directory entries'.
- *
- * In a real OS, each process would have its own page directory, which would
- * need to be allocated and initialized as part of process creation.
+ * This function is called once at the start of the simulation, after
+ * pagetable_geometry.  The first process is set up by proc_init, which
+ * creates its page directory; each fork in the trace creates another one
+ * (see proc.c).
  */
 void init_pagetable() {
-	int i;
-	// Set all entries in top-level pagetable to 0, which ensures valid
-	// bits are all 0 initially.
-	for (i=0; i < PTRS_PER_PGDIR; i++) {
-		pgdir[i].pde = 0;
-	}
+	frames.next_free_frame = 0;
+	frames.nfree = 0;
+	free(free_frames);
+	free_frames = malloc(memsize * sizeof(int));
+	free(swapcache);
+	swapcache = malloc(swap_size() * sizeof(int));
+	memset(swapcache, 0xff, swap_size() * sizeof(int));
+	cow_fault_count = cow_reuse_count = 0;
+	shared_saved = shared_saved_peak = 0;
+	snapshot_register("pagetable", &frames, sizeof(frames));
+	snapshot_register("frame_free", free_frames, memsize * sizeof(int));
 }
 
 // For simulation, we get second-level pagetables from ordinary memory
@@ -110,6 +285,145 @@ pgdir_entry_t init_second_level() {
 	return new_entry;
 }
 
+/*
+ * Address-space geometries.  The walk from a vaddr to its pte is
+ * generated once per geometry with the shifts and masks as constants, and
+ * find_physpage calls the one selected at startup, so the choice costs
+ * nothing per reference beyond the call.  The walk also rejects addresses
+ * too wide for the geometry, which would otherwise index past the page
+ * directory.
+ */
+struct va_geometry geom;
+static pgtbl_entry_t *(*pte_lookup)(addr_t vaddr);
+
+static void va_too_wide(addr_t vaddr) {
+	fprintf(stderr, "Error: address %lx does not fit in %d bits; use a wider geometry\n",
+		vaddr, geom.vabits);
+	exit(1);
+}
+
+#define DEFINE_PTE_LOOKUP(bits, dir_shift)				\
+static pgtbl_entry_t *pte_lookup_##bits(addr_t vaddr) {			\
+	unsigned idx = vaddr >> (dir_shift);				\
+									\
+	if (vaddr >> (bits)) {						\
+		va_too_wide(vaddr);					\
+	}								\
+	/* no 2nd-level, need create */					\
+	if (pgdir[idx].pde == 0) {					\
+		pgdir[idx] = init_second_level();			\
+	}								\
+	return (pgtbl_entry_t *)(pgdir[idx].pde & PAGE_MASK) +		\
+		((vaddr >> PAGE_SHIFT) & ((1UL << ((dir_shift) - PAGE_SHIFT)) - 1)); \
+}
+
+DEFINE_PTE_LOOKUP(32, 22)
+DEFINE_PTE_LOOKUP(36, 24)
+DEFINE_PTE_LOOKUP(48, 30)
+
+static const struct {
+	struct va_geometry geom;
+	pgtbl_entry_t *(*lookup)(addr_t vaddr);
+} geometries[] = {
+	{{32, 22, 1 << 10, 1 << 10}, pte_lookup_32},
+	{{36, 24, 1 << 12, 1 << 12}, pte_lookup_36},
+	{{48, 30, 1 << 18, 1 << 18}, pte_lookup_48},
+};
+
+/* Selects the geometry for virtual addresses of 'vabits' bits.
+ * Return: 0, or -1 (after printing why) if there is none
+ */
+int pagetable_geometry(int vabits) {
+	int i;
+	for (i = 0; i < sizeof(geometries) / sizeof(geometries[0]); i++) {
+		if (geometries[i].geom.vabits == vabits) {
+			geom = geometries[i].geom;
+			pte_lookup = geometries[i].lookup;
+			return 0;
+		}
+	}
+	fprintf(stderr, "Error: unsupported virtual address width %d (32, 36 or 48)\n",
+		vabits);
+	return -1;
+}
+
+// Page directories come from ordinary memory too; all entries invalid
+pgdir_entry_t *pgdir_create(void) {
+	pgdir_entry_t *dir = calloc(PTRS_PER_PGDIR, sizeof(pgdir_entry_t));
+
+	if (dir == NULL) {
+		perror("Failed to allocate page directory");
+		exit(1);
+	}
+	return dir;
+}
+
+/*
+ * Gives the process with page directory 'child' a copy of the address
+ * space of 'parent', as fork does.  Nothing is copied yet: both map the
+ * same frames and swap slots, marked PG_COW, and a write to such a page
+ * gets a private copy first (see cow_break).
+ */
+void pgdir_fork(pgdir_entry_t *parent, pgdir_entry_t *child) {
+	int i, j;
+
+	for (i = 0; i < PTRS_PER_PGDIR; i++) {
+		pgtbl_entry_t *from, *to;
+		if (!(parent[i].pde & PG_VALID)) {
+			continue;
+		}
+		child[i] = init_second_level();
+		from = (pgtbl_entry_t *)(parent[i].pde & PAGE_MASK);
+		to = (pgtbl_entry_t *)(child[i].pde & PAGE_MASK);
+		for (j = 0; j < PTRS_PER_PGTBL; j++) {
+			if (!(from[j].frame & (PG_VALID | PG_ONSWAP))) {
+				continue;
+			}
+			from[j].frame |= PG_COW;
+			to[j].frame = from[j].frame & ~PG_REF;
+			to[j].swap_off = from[j].swap_off;
+			if (from[j].frame & PG_VALID) {
+				frame_map(from[j].frame >> PAGE_SHIFT, &to[j]);
+			}
+			if (from[j].swap_off != INVALID_SWAP) {
+				swap_dup(from[j].swap_off);
+			}
+		}
+	}
+}
+
+/*
+ * Releases everything the process with page directory 'dir' holds, as
+ * exit does: frames no other process maps are freed, as are swap slots,
+ * and then the page tables and 'dir' itself.
+ */
+void pgdir_release(pgdir_entry_t *dir) {
+	int i, j;
+
+	for (i = 0; i < PTRS_PER_PGDIR; i++) {
+		pgtbl_entry_t *pgtbl;
+		if (!(dir[i].pde & PG_VALID)) {
+			continue;
+		}
+		pgtbl = (pgtbl_entry_t *)(dir[i].pde & PAGE_MASK);
+		for (j = 0; j < PTRS_PER_PGTBL; j++) {
+			if (pgtbl[j].frame & PG_VALID) {
+				unsigned frame = pgtbl[j].frame >> PAGE_SHIFT;
+				if (coremap[frame].mapcount > 1) {
+					frame_unmap(frame, &pgtbl[j]);
+				} else {
+					frame_release(frame);
+				}
+			}
+			if (pgtbl[j].swap_off != INVALID_SWAP) {
+				swap_free(pgtbl[j].swap_off);
+			}
+		}
+		free(pgtbl);
+	}
+	free(dir);
+}
+
 /* 
  * Initializes the content of a (simulated) physical memory frame when it 
  * is first allocated for some virtual address.  Just like in a real OS,
@@ -132,6 +446,38 @@ void init_frame(int frame, addr_t vaddr) {
 	return;
 }
 
+/*
+ * Handles a write to a PG_COW page that is resident (in p's frame): if
+ * other processes still map the frame, the writer gets a private copy of
+ * it in a new frame (a COW fault); otherwise it simply becomes the sole
+ * owner.  A swap slot shared with other processes is given up too, so
+ * the private page is written to a slot of its own.
+ */
+static void cow_break(pgtbl_entry_t *p, addr_t vaddr) {
+	int frame = p->frame >> PAGE_SHIFT;
+
+	if (coremap[frame].mapcount > 1) {
+		char copy[SIMPAGESIZE];
+		unsigned flags = p->frame & ~PAGE_MASK;
+
+		memcpy(copy, &physmem[frame*SIMPAGESIZE], SIMPAGESIZE);
+		frame_unmap(frame, p);
+		frame = allocate_frame(p);
+		memcpy(&physmem[frame*SIMPAGESIZE], copy, SIMPAGESIZE);
+		coremap[frame].vaddr = vaddr & PAGE_MASK;
+		p->frame = (frame << PAGE_SHIFT) | flags;
+		cow_fault_count ++;
+	} else {
+		cow_reuse_count ++;
+	}
+	if (p->swap_off != INVALID_SWAP && swap_refcount(p->swap_off) > 1) {
+		swap_free(p->swap_off);
+		p->swap_off = INVALID_SWAP;
+		p->frame &= ~PG_ONSWAP;
+	}
+	p->frame &= ~PG_COW;
+}
+
 /*
  * Locate the physical frame number for the given vaddr using the page table.
  *
@@ -144,23 +490,17 @@ void init_frame(int frame, addr_t vaddr) {
  *
  * Counters for hit, miss and reference events should be incremented in
  * this function.
+ *
+ * 'count' consecutive references to the page are made at once (see
+ * tracerle): the ones after the first are hits, and the replacement
+ * algorithm sees the run as a single reference.
  */
-char *find_physpage(addr_t vaddr, char type) {
+char *find_physpage(addr_t vaddr, char type, unsigned count) {
 	pgtbl_entry_t *p=NULL; // pointer to the full page table entry for vaddr
-	unsigned idx = PGDIR_INDEX(vaddr); // get index into page directory
-
-	// IMPLEMENTATION NEEDED
-	// Use top-level page directory to get pointer to 2nd-level page table
-	//(void)idx; // To keep compiler happy - remove when you have a real use.
-
-	//no 2nd-level, need create 
-	if (pgdir[idx].pde == 0){
-		pgdir[idx] = init_second_level();
-	}
 
-	// Use vaddr to get index into 2nd-level page table and initialize 'p'
-	// top-level  find  2nd-level  address, then find vaddr
-	p = (pgtbl_entry_t *)(pgdir[idx].pde & PAGE_MASK) + PGTBL_INDEX(vaddr);
+	// Use top-level page directory to get pointer to 2nd-level page
+	// table, creating it if needed, and the entry for vaddr in it
+	p = pte_lookup(vaddr);
 
 
 	// Check if p is valid or not, on swap or not, and handle appropriately
@@ -170,26 +510,45 @@ char *find_physpage(addr_t vaddr, char type) {
 		frame = allocate_frame(p);
 		// init frame
 		init_frame(frame, vaddr);
+		coremap[frame].vaddr = vaddr & PAGE_MASK;
 		// set the frame to p
 		p->frame = frame << PAGE_SHIFT;
 
 		// no physical
 		miss_count ++;
+		if (num_groups) {
+			groups[cur_group].misses ++;
+		}
+	}
+	else if (!(p->frame & PG_VALID) && (p->frame & PG_ONSWAP) &&
+		 (p->frame & PG_COW) && (frame = swapcache_lookup(p)) >= 0){
+		// on a shared slot that another process has brought back:
+		// share its frame again
+		frame_map(frame, p);
+		p->frame = coremap[frame].pte->frame | PG_COW;
+		hit_count ++;
 	}
 	else if (!(p->frame & PG_VALID) && (p->frame & PG_ONSWAP)){
 		// no valid , on swap
 		frame = allocate_frame(p);
 		// swap  
 		swap_pagein(frame, p->swap_off);
+		coremap[frame].vaddr = vaddr & PAGE_MASK;
 
-		//set the frame to p
-		p->frame = frame << PAGE_SHIFT;
+		//set the frame to p; the slot may still be shared
+		p->frame = (frame << PAGE_SHIFT) | (p->frame & PG_COW);
+		if (p->frame & PG_COW) {
+			swapcache[p->swap_off / SIMPAGESIZE] = frame;
+		}
 
 		//set status
 		p->frame |= PG_ONSWAP;
 
 		//no  physical
 		miss_count ++;
+		if (num_groups) {
+			groups[cur_group].misses ++;
+		}
 	}
 	else{
 		// valid, on physical
@@ -202,13 +561,33 @@ char *find_physpage(addr_t vaddr, char type) {
 	p->frame |= PG_VALID;
 	p->frame |= PG_REF;
 	if (type == 'M' || type == 'S'){
+		if (p->frame & PG_COW) {
+			cow_break(p, vaddr);
+		}
         p->frame |= PG_DIRTY;
+		coremap[p->frame >> PAGE_SHIFT].cleaned = 0;
     }
-	ref_count ++;
+	hit_count += count - 1;
+	ref_count += count;
+	coremap[p->frame >> PAGE_SHIFT].last_ref = ref_count - 1;
+	if (num_groups) {
+		groups[cur_group].refs += count;
+	}
 
 	// Call replacement algorithm's ref_fcn for this page
 	ref_fcn(p);
 
+	// Account the access to its memory tier, and migrate, if tiered
+	if (tier_fast_frames) {
+		tier_access(p->frame >> PAGE_SHIFT, count);
+	}
+
+	// Let the page cleaner write back idle dirty pages, if enabled and due
+	// within these references
+	if (clean_batch && ref_count % clean_interval < count) {
+		cleaner_run();
+	}
+
 	// Return pointer into (simulated) physical memory at start of frame
 	return  &physmem[(p->frame >> PAGE_SHIFT)*SIMPAGESIZE];
 }
@@ -237,6 +616,9 @@ void print_pagetbl(pgtbl_entry_t *pgtbl) {
 				if (pgtbl[i].frame & PG_DIRTY) {
 					printf("DIRTY, ");
 				}
+				if (pgtbl[i].frame & PG_COW) {
+					printf("COW, ");
+				}
 				printf("in frame %d\n",pgtbl[i].frame >> PAGE_SHIFT);
 			} else {
 				assert(pgtbl[i].frame & PG_ONSWAP);
@@ -257,6 +639,9 @@ void print_pagedirectory() {
 
 	pgtbl_entry_t *pgtbl;
 
+	if (pgdir == NULL) { // the current process has exited
+		return;
+	}
 	for (i=0; i < PTRS_PER_PGDIR; i++) {
 		if (!(pgdir[i].pde & PG_VALID)) {
 			if (first_invalid == -1) {
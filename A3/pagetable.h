@@ -5,8 +5,6 @@
 #include <stdlib.h>
 #include <stdint.h>
 
-#define TRACE_64
-
 #define PAGE_SHIFT      12     // number of bits 2^(PAGE_SHIFT) == PAGE_SIZE
 #define PAGE_SIZE       4096 // Size of pagetable pages
 #define PAGE_MASK       (~(PAGE_SIZE-1))
@@ -14,34 +12,42 @@
 #define PG_DIRTY        (0x2) // Dirty bit in pgd or pte, set if modified
 #define PG_REF          (0x4) // Reference bit, set if page has been referenced
 #define PG_ONSWAP       (0x8) // Set if page has been evicted to swap
+#define PG_COW          (0x10) // Page (frame or swap slot) may be shared
+                               // with another process: copy before writing
 #define INVALID_SWAP    -1
 
-#ifdef TRACE_64
-// User-level virtual addresses on 64-bit Linux system are 36 bits in our traces
-// and the page size is still 4096 (12 bits). 
-// We split the remaining 24 bits evenly into top-level (page directory) index
-// and second-level (page table) index, using 12 bits for each. 
-#define PGDIR_SHIFT         24     // Leaves just top 12 bits of vaddr 
-#define PTRS_PER_PGDIR    4096
-#define PTRS_PER_PGTBL    4096
+// The split of virtual addresses between the page directory and the
+// second-level page tables depends on the width of the addresses in the
+// trace, which is chosen at startup (see init_pagetable):
+//
+//   32 bits (32-bit Linux):       10-bit directory and table indices
+//   36 bits (our usual traces):   12-bit indices
+//   48 bits (64-bit Linux, e.g. raw lackey output): 18-bit indices
+//
+// In each case the page size is still 4096 (12 bits).
+#define VABITS_DEFAULT 36
+
+struct va_geometry {
+	int vabits;              // width of virtual addresses
+	int pgdir_shift;         // leaves just the directory index of a vaddr
+	unsigned ptrs_per_pgdir;
+	unsigned ptrs_per_pgtbl;
+};
+extern struct va_geometry geom;
 
-#else // TRACE_32
-// User-level virtual addresses on 32-bit Linux system are 32 bits, and the 
-// page size is still 4096 (12 bits).
-// We split the remaining 20 bits evenly into top-level (page directory) index
-// and second level (page table) index, using 10 bits for each.
-#define PGDIR_SHIFT       22     // Leaves just top 10 bits of vaddr 
-#define PTRS_PER_PGDIR  1024
-#define PTRS_PER_PGTBL  1024
+#define PGDIR_SHIFT      (geom.pgdir_shift)
+#define PTRS_PER_PGDIR   (geom.ptrs_per_pgdir)
+#define PTRS_PER_PGTBL   (geom.ptrs_per_pgtbl)
 
-#endif
 
-#define PGTBL_MASK        (PTRS_PER_PGTBL-1)
-#define PGDIR_INDEX(x)   ((x) >> PGDIR_SHIFT)
-#define PGTBL_INDEX(x)   (((x) >> PAGE_SHIFT) & PGTBL_MASK)
+typedef unsigned long addr_t;
 
+// Memory tiers of a frame (see tier.c)
+#define TIER_FAST 0
+#define TIER_SLOW 1
 
-typedef unsigned long addr_t;
+// Number of past references the lru-k replacement algorithm considers
+#define LRUK_K 2
 
 // These defines allow us to take advantage of the compiler's typechecking
 
@@ -56,18 +62,53 @@ typedef struct {
 	off_t swap_off;       // offset in swap file of vpage, if any
 } pgtbl_entry_t;    
 
+// Page directory of the process whose references are being simulated
+extern pgdir_entry_t *pgdir;
+
+extern int pagetable_geometry(int vabits);
 extern void init_pagetable();
-extern char *find_physpage(addr_t vaddr, char type);
+extern char *find_physpage(addr_t vaddr, char type, unsigned count);
 
 extern void print_pagedirectory(void);
 
+// Page directories of the simulated processes (see proc.c)
+extern pgdir_entry_t *pgdir_create(void);
+extern void pgdir_fork(pgdir_entry_t *parent, pgdir_entry_t *child);
+extern void pgdir_release(pgdir_entry_t *dir);
+
+// Further page table entries mapping a shared frame
+struct rmap {
+	pgtbl_entry_t *pte;
+	struct rmap *next;
+};
+
 struct frame {
 	char in_use;       // True if frame is allocated, False if frame is free
 	pgtbl_entry_t *pte;// Pointer back to pagetable entry (pte) for page
 	                   // stored in this frame
-
-	long long timestamp; //referenced   timestamp  for lru
-	int dis;        // cur virtual address to next simple virtual address distance for opt
+	int mapcount;      // number of ptes mapping the frame (> 1 if shared)
+	struct rmap *rmap; // the ptes other than 'pte', if shared
+
+	long last_ref;     // virtual time (ref_count) of the last reference
+	char cleaned;      // written back by the page cleaner, not dirtied since
+	addr_t vaddr;      // virtual address of the page stored in this frame
+	char tier;         // TIER_FAST or TIER_SLOW, in tiered mode
+	short group;       // memory-limit group charged for it, -1 if none
+	int group_pos;     // and its position in that group's frame list
+	unsigned char tier_heat; // recent PG_REF samples, newest in the top bit
+
+	// lfu: frequency count (0 if not tracked) and links in its bucket
+	int lfu_freq;
+	int lfu_prev, lfu_next;
+
+	// lru-k: times of the last LRUK_K uncorrelated references, most
+	// recent first (0 = no such reference), and of the last reference;
+	// position in the eviction heap (-1 if not tracked, -2 if in the list
+	// of frames in their correlated period) and links in that list
+	long lruk_hist[LRUK_K];
+	long lruk_last;
+	int lruk_heap;
+	int lruk_prev, lruk_next;
 };
 
 /* The coremap holds information about physical memory.
@@ -76,18 +117,43 @@ struct frame {
  */
 extern struct frame *coremap;
 
+// Applying a change of state to every pte mapping a frame
+extern void frame_swapped(int frame, int swap_off);
+extern int frame_clear_ref(int frame);
+
 
 // Swap functions for use in other files
 extern int swap_init(unsigned swapsize);
 extern void swap_destroy(void);
 extern int swap_pagein(unsigned frame, int swap_offset);
 extern int swap_pageout(unsigned frame, int swap_offset);
+extern void swap_dup(int swap_offset);
+extern void swap_free(int swap_offset);
+extern int swap_refcount(int swap_offset);
+extern int swap_pageout_batch(unsigned *frames, int *swap_offsets, int n);
+extern int swap_write_slot(int swap_offset, const char *data);
+extern unsigned swap_size(void);
+extern int swap_copy_out(int fd, off_t off, size_t *len);
+extern int swap_copy_in(int fd, off_t off, size_t len);
+
+// Modules register any state that is not in the coremap, physmem, page
+// tables or swap, so that it is saved in snapshots (see snapshot.c).
+extern void snapshot_register(const char *name, void *data, size_t len);
+extern void snapshot_reset(void);
+extern void snapshot_hooks(const char *name, void (*save)(void),
+			   void (*restore)(void));
+
+// Background page cleaner (see cleaner.c)
+extern void cleaner_init(void);
+extern void cleaner_run(void);
 
 extern void rand_init();
 extern void lru_init();
 extern void clock_init();
 extern void fifo_init();
 extern void opt_init();
+extern void lfu_init();
+extern void lruk_init();
 
 // These may not need to do anything for some algorithms
 extern void rand_ref(pgtbl_entry_t *);
@@ -95,11 +161,20 @@ extern void lru_ref(pgtbl_entry_t *);
 extern void clock_ref(pgtbl_entry_t *);
 extern void fifo_ref(pgtbl_entry_t *);
 extern void opt_ref(pgtbl_entry_t *);
+extern void lfu_ref(pgtbl_entry_t *);
+extern void lruk_ref(pgtbl_entry_t *);
 
 extern int rand_evict();
 extern int lru_evict();
 extern int clock_evict();
 extern int fifo_evict();
 extern int opt_evict();
+extern int lfu_evict();
+extern int lruk_evict();
+
+// Called when a frame is freed other than by eviction (NULL if the
+// algorithm keeps no per-frame state that needs resetting)
+extern void lfu_release(int frame);
+extern void lruk_release(int frame);
 
 #endif /* PAGETABLE_H */
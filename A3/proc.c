@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include "sim.h"
+#include "pagetable.h"
+
+/* Simulated processes.  A trace starts with a single process, pid 0, and
+ * may contain process events besides references (see trace.h):
+ *
+ *	F pid   the current process forks a child with the given pid
+ *	P pid   the following references are made by process pid
+ *	X pid   process pid exits
+ *
+ * Each process has its own page directory; pgdir always points to the
+ * current process's.  A child starts out sharing all of its parent's
+ * pages copy-on-write (see pgdir_fork).
+ */
+
+long fork_count = 0;
+long exit_count = 0;
+
+struct proc {
+	addr_t pid;
+	pgdir_entry_t *dir;
+};
+
+static struct proc *procs;
+static int nprocs, maxprocs;
+
+static struct proc *proc_find(addr_t pid) {
+	int i;
+	for (i = 0; i < nprocs; i++) {
+		if (procs[i].pid == pid) {
+			return &procs[i];
+		}
+	}
+	return NULL;
+}
+
+static struct proc *proc_add(addr_t pid) {
+	if (nprocs == maxprocs) {
+		maxprocs = maxprocs ? 2 * maxprocs : 16;
+		procs = realloc(procs, maxprocs * sizeof(struct proc));
+		if (procs == NULL) {
+			perror("proc_add");
+			exit(1);
+		}
+	}
+	procs[nprocs].pid = pid;
+	procs[nprocs].dir = pgdir_create();
+	return &procs[nprocs++];
+}
+
+void proc_init(void) {
+	nprocs = 0;
+	fork_count = exit_count = 0;
+	pgdir = proc_add(0)->dir;
+}
+
+/* Applies a process event from the trace. */
+void proc_event(char type, addr_t pid) {
+	struct proc *p = proc_find(pid);
+
+	switch (type) {
+	case 'F':
+		if (p != NULL || pgdir == NULL) {
+			fprintf(stderr, "Error: fork of process %lx without a parent or over an existing one\n",
+				pid);
+			exit(1);
+		}
+		pgdir_fork(pgdir, proc_add(pid)->dir);
+		fork_count++;
+		break;
+	case 'P':
+		if (p == NULL) {
+			fprintf(stderr, "Error: switch to unknown process %lx\n", pid);
+			exit(1);
+		}
+		pgdir = p->dir;
+		break;
+	case 'X':
+		if (p == NULL) {
+			fprintf(stderr, "Error: exit of unknown process %lx\n", pid);
+			exit(1);
+		}
+		if (pgdir == p->dir) {
+			pgdir = NULL;
+		}
+		pgdir_release(p->dir);
+		*p = procs[--nprocs];
+		exit_count++;
+		break;
+	default:
+		assert(0);
+	}
+}
+
+/* Releases all processes, when the simulator is torn down. */
+void proc_destroy(void) {
+	while (nprocs > 0) {
+		pgdir_release(procs[--nprocs].dir);
+	}
+	pgdir = NULL;
+}
@@ -3,6 +3,8 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include "sim.h"
 #include "pagetable.h"
 
@@ -10,13 +12,58 @@
 
 extern struct frame *coremap;
 
+unsigned long rand_seed = 1;
+
+/* The victims are drawn from xoshiro256** (Blackman and Vigna), seeded
+ * from rand_seed through splitmix64, rather than from random(): the
+ * sequence is the same on every host, the seed can be chosen per run, and
+ * the state is plain data that snapshots save as it is.
+ */
+static uint64_t rand_state[4];
+
+static inline uint64_t rotl(uint64_t x, int k) {
+	return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t rand_next(void) {
+	uint64_t *s = rand_state;
+	uint64_t result = rotl(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+	return result;
+}
+
+/* Uniform in [0, n), by Lemire's multiply-shift: the high half of a
+ * 32-bit draw times n.  Draws that would favour some results are
+ * rejected, which needs a division only in the rare case l < n.
+ */
+static uint32_t rand_below(uint32_t n) {
+	uint64_t m = (rand_next() >> 32) * n;
+	uint32_t l = (uint32_t)m;
+
+	if (l < n) {
+		uint32_t t = -n % n;
+		while (l < t) {
+			m = (rand_next() >> 32) * n;
+			l = (uint32_t)m;
+		}
+	}
+	return m >> 32;
+}
+
 /* Page to evict is chosen using the rand algorithm.
  * Returns the page frame number (which is also the index in the coremap)
  * for the page that is to be evicted.
  */
 int rand_evict() {
 	// choose index in coremap to evict a page from
-	int idx = (int)(random() % memsize);
+	int idx = (int)rand_below(memsize);
 	
 	return idx;
 }
@@ -31,4 +78,15 @@ void rand_ref(pgtbl_entry_t *p) {
 }
 
 void rand_init() {
+	uint64_t x = rand_seed;
+	int i;
+
+	// splitmix64 spreads any seed, 0 included, over the whole state
+	for (i = 0; i < 4; i++) {
+		uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		rand_state[i] = z ^ (z >> 31);
+	}
+	snapshot_register("rand", rand_state, sizeof(rand_state));
 }
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+/* The argmin/argmax kernels make two passes: a vertical min (max) over
+ * whole vectors followed by a horizontal reduction, then a compare pass
+ * for the first lane equal to the result.  Both passes are branch-free
+ * streams over the array, which is what makes them fast; the arrays are
+ * small enough (8 bytes per frame) to stay in cache between the passes.
+ * There is no 64-bit min or max instruction before AVX-512, so the
+ * kernels compare and blend; the compare needs SSE4.2.
+ */
+
+static int argmin_scalar(const long *a, int n) {
+	int i, best = 0;
+	for (i = 1; i < n; i++) {
+		if (a[i] < a[best]) {
+			best = i;
+		}
+	}
+	return best;
+}
+
+static int argmax_scalar(const long *a, int n) {
+	int i, best = 0;
+	for (i = 1; i < n; i++) {
+		if (a[i] > a[best]) {
+			best = i;
+		}
+	}
+	return best;
+}
+
+static int zero_byte_scalar(const unsigned char *a, int from, int n) {
+	const unsigned char *p = memchr(a + from, 0, n - from);
+	return p ? p - a : -1;
+}
+
+#ifdef SCAN_X86
+
+// Index of the first element of a[0..n-1] equal to v, 4 lanes at a time
+__attribute__((target("avx2")))
+static int find_avx2(const long *a, int n, long v) {
+	__m256i vv = _mm256_set1_epi64x(v);
+	int i;
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+		int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(x, vv)));
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	for (; i < n; i++) {
+		if (a[i] == v) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+__attribute__((target("avx2")))
+static int argmin_avx2(const long *a, int n) {
+	__m256i vmin = _mm256_set1_epi64x(LONG_MAX);
+	long lane[4];
+	long m;
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+		vmin = _mm256_blendv_epi8(vmin, x, _mm256_cmpgt_epi64(vmin, x));
+	}
+	_mm256_storeu_si256((__m256i *)lane, vmin);
+	m = lane[0];
+	for (i = 1; i < 4; i++) {
+		if (lane[i] < m) {
+			m = lane[i];
+		}
+	}
+	for (i = n & ~3; i < n; i++) {
+		if (a[i] < m) {
+			m = a[i];
+		}
+	}
+	return find_avx2(a, n, m);
+}
+
+__attribute__((target("avx2")))
+static int argmax_avx2(const long *a, int n) {
+	__m256i vmax = _mm256_set1_epi64x(LONG_MIN);
+	long lane[4];
+	long m;
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+		vmax = _mm256_blendv_epi8(vmax, x, _mm256_cmpgt_epi64(x, vmax));
+	}
+	_mm256_storeu_si256((__m256i *)lane, vmax);
+	m = lane[0];
+	for (i = 1; i < 4; i++) {
+		if (lane[i] > m) {
+			m = lane[i];
+		}
+	}
+	for (i = n & ~3; i < n; i++) {
+		if (a[i] > m) {
+			m = a[i];
+		}
+	}
+	return find_avx2(a, n, m);
+}
+
+__attribute__((target("avx2")))
+static int zero_byte_avx2(const unsigned char *a, int from, int n) {
+	__m256i zero = _mm256_setzero_si256();
+	int i;
+	for (i = from; i + 32 <= n; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+		unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, zero));
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	for (; i < n; i++) {
+		if (a[i] == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+__attribute__((target("sse4.2")))
+static int find_sse(const long *a, int n, long v) {
+	__m128i vv = _mm_set1_epi64x(v);
+	int i;
+	for (i = 0; i + 2 <= n; i += 2) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+		int mask = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(x, vv)));
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	for (; i < n; i++) {
+		if (a[i] == v) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+__attribute__((target("sse4.2")))
+static int argmin_sse(const long *a, int n) {
+	__m128i v = _mm_set1_epi64x(LONG_MAX);
+	long lane[2];
+	long m;
+	int i;
+
+	for (i = 0; i + 2 <= n; i += 2) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+		v = _mm_blendv_epi8(v, x, _mm_cmpgt_epi64(v, x));
+	}
+	_mm_storeu_si128((__m128i *)lane, v);
+	m = lane[0] < lane[1] ? lane[0] : lane[1];
+	for (; i < n; i++) {
+		if (a[i] < m) {
+			m = a[i];
+		}
+	}
+	return find_sse(a, n, m);
+}
+
+__attribute__((target("sse4.2")))
+static int argmax_sse(const long *a, int n) {
+	__m128i v = _mm_set1_epi64x(LONG_MIN);
+	long lane[2];
+	long m;
+	int i;
+
+	for (i = 0; i + 2 <= n; i += 2) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+		v = _mm_blendv_epi8(v, x, _mm_cmpgt_epi64(x, v));
+	}
+	_mm_storeu_si128((__m128i *)lane, v);
+	m = lane[0] > lane[1] ? lane[0] : lane[1];
+	for (; i < n; i++) {
+		if (a[i] > m) {
+			m = a[i];
+		}
+	}
+	return find_sse(a, n, m);
+}
+
+#endif /* SCAN_X86 */
+
+int (*scan_argmin)(const long *a, int n) = argmin_scalar;
+int (*scan_argmax)(const long *a, int n) = argmax_scalar;
+int (*scan_zero_byte)(const unsigned char *a, int from, int n) = zero_byte_scalar;
+
+void *scan_alloc(int n, size_t size) {
+	size_t bytes = ((n * size + SCAN_ALIGN - 1) / SCAN_ALIGN) * SCAN_ALIGN;
+	void *p;
+
+	if (bytes == 0) {
+		bytes = SCAN_ALIGN;
+	}
+	if ((p = aligned_alloc(SCAN_ALIGN, bytes)) == NULL) {
+		perror("scan_alloc");
+		exit(1);
+	}
+	memset(p, 0, bytes);
+	return p;
+}
+
+/* Pick the kernels for this host.  SIM_SCAN=scalar|sse|avx2 in the
+ * environment forces a particular (supported) set, for comparisons.
+ */
+void scan_init(void) {
+#ifdef SCAN_X86
+	char *force = getenv("SIM_SCAN");
+
+	if (force != NULL && strcmp(force, "scalar") == 0) {
+		return;
+	}
+	if (__builtin_cpu_supports("avx2") &&
+	    (force == NULL || strcmp(force, "avx2") == 0)) {
+		scan_argmin = argmin_avx2;
+		scan_argmax = argmax_avx2;
+		scan_zero_byte = zero_byte_avx2;
+	} else if (__builtin_cpu_supports("sse4.2")) {
+		scan_argmin = argmin_sse;
+		scan_argmax = argmax_sse;
+		// memchr is already vectorized by the C library
+	}
+#endif
+}
@@ -0,0 +1,25 @@
+#ifndef __SCAN_H__
+#define __SCAN_H__
+
+/* Vectorized scans over the dense per-frame arrays kept by the scan-based
+ * replacement algorithms.  Each kernel has an AVX2, an SSE4.2 and a plain
+ * C version; scan_init picks the best one the host supports.
+ */
+
+// Alignment of the arrays handed to the kernels
+#define SCAN_ALIGN 32
+
+// Index of the first smallest / largest of a[0..n-1] (n > 0)
+extern int (*scan_argmin)(const long *a, int n);
+extern int (*scan_argmax)(const long *a, int n);
+
+// Index of the first zero byte in a[from..n-1], or -1 if there is none
+extern int (*scan_zero_byte)(const unsigned char *a, int from, int n);
+
+// Allocate a zeroed array of n elements of the given size, SCAN_ALIGN
+// aligned and padded to a whole number of vectors
+extern void *scan_alloc(int n, size_t size);
+
+extern void scan_init(void);
+
+#endif /* __SCAN_H__ */
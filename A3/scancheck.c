@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include "scan.h"
+
+/* Checks the scan kernels scan_init picks (SIM_SCAN forces a set, see
+ * scan.c) against plain loops, on random arrays of every length up to
+ * MAX_N: values from a narrow range, so that ties are common and the first
+ * of equal elements must be found, and from the whole range of long,
+ * including its extremes.  Run once per kernel set by "make check".
+ * Exits with 1 at the first mismatch.
+ */
+
+#define MAX_N 300
+#define ROUNDS 20
+
+static unsigned long state = 0x9E3779B97F4A7C15UL;
+
+// xorshift64*, enough for test data
+static unsigned long next_rand(void) {
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return state * 0x2545F4914F6CDD1DUL;
+}
+
+static long pick(int narrow) {
+	unsigned long r = next_rand();
+
+	if (narrow) {
+		return (long)(r % 7) - 3;
+	}
+	switch (r % 16) {
+	case 0:
+		return LONG_MIN;
+	case 1:
+		return LONG_MAX;
+	default:
+		return (long)next_rand();
+	}
+}
+
+static int check_arg(const long *a, int n) {
+	int i, lo = 0, hi = 0;
+
+	for (i = 1; i < n; i++) {
+		if (a[i] < a[lo]) {
+			lo = i;
+		}
+		if (a[i] > a[hi]) {
+			hi = i;
+		}
+	}
+	if (scan_argmin(a, n) != lo) {
+		printf("scan_argmin: n=%d got %d, want %d\n", n, scan_argmin(a, n), lo);
+		return 1;
+	}
+	if (scan_argmax(a, n) != hi) {
+		printf("scan_argmax: n=%d got %d, want %d\n", n, scan_argmax(a, n), hi);
+		return 1;
+	}
+	return 0;
+}
+
+static int check_zero_byte(const unsigned char *b, int n) {
+	int from, i;
+
+	for (from = 0; from < n; from++) {
+		for (i = from; i < n && b[i] != 0; i++) {
+			;
+		}
+		if (i == n) {
+			i = -1;
+		}
+		if (scan_zero_byte(b, from, n) != i) {
+			printf("scan_zero_byte: n=%d from=%d got %d, want %d\n",
+			       n, from, scan_zero_byte(b, from, n), i);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	long *a = scan_alloc(MAX_N, sizeof(long));
+	unsigned char *b = scan_alloc(MAX_N, 1);
+	int n, i, round;
+	char *set = getenv("SIM_SCAN");
+
+	scan_init();
+	for (round = 0; round < ROUNDS; round++) {
+		for (n = 1; n <= MAX_N; n++) {
+			for (i = 0; i < n; i++) {
+				a[i] = pick(round % 2 == 0);
+				// zero bytes get rarer with the round
+				b[i] = next_rand() % (2 + round * 8) == 0 ? 0 : 1 + next_rand() % 255;
+			}
+			if (check_arg(a, n) || check_zero_byte(b, n)) {
+				return 1;
+			}
+		}
+	}
+	printf("scancheck (%s): ok\n", set ? set : "default");
+	return 0;
+}
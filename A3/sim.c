@@ -4,162 +4,275 @@
 #include <getopt.h>
 #include <stdlib.h>
 #include <string.h>
-#include "sim.h"
-#include "pagetable.h"
-
-// Define global variables declared in sim.h
-unsigned memsize = 0;
-int debug = 0;
-char *physmem = NULL;
-struct frame *coremap = NULL;
-char *tracefile = NULL;
-
-/* The algs array gives us a mapping between the name of an eviction
- * algorithm as given in a command line argument, and the function to
- * call to select the victim page.
+#include <signal.h>
+#include "pagesim.h"
+#include "trace.h"
+
+/* The sim command: replays a trace file through libpagesim and prints the
+ * statistics.
  */
-struct functions algs[] = {
-	{"rand", rand_init, rand_ref, rand_evict}, 
-	{"lru", lru_init, lru_ref, lru_evict},
-	{"fifo", fifo_init, fifo_ref, fifo_evict},
-	{"clock",clock_init, clock_ref, clock_evict},
-	{"opt", opt_init, opt_ref, opt_evict}
-};
-int num_algs = 5;
-
-void (*init_fcn)() = NULL;
-void (*ref_fcn)(pgtbl_entry_t *) = NULL;
-int (*evict_fcn)() = NULL;
-
-
-/* An actual memory access based on the vaddr from the trace file.
- *
- * The find_physpage() function is called to translate the virtual address
- * to a (simulated) physical address -- that is, a pointer to the right
- * location in physmem array. The find_physpage() function is responsible for
- * everything to do with memory management - including translation using the
- * pagetable, allocating a frame of (simulated) physical memory (if needed),
- * evicting an existing page from the frame (if needed) and reading the page
- * in from swap (if needed).
- *
- * We then check that the memory has the expected content (just a copy of the
- * virtual address) and, in case of a write reference, increment the version
- * counter. 
+
+#define PAGE_SIZE 4096
+
+// References handed to the simulator per call
+#define SIM_BATCH 4096
+
+static int debug = 0;
+
+/* Checkpointing: the state is written to snapfile after snap_after
+ * references (and the run stops), on SIGUSR1 (and the run continues) or on
+ * SIGINT (and the run stops).
  */
-void access_mem(char type, addr_t vaddr) {
-	char *memptr = find_physpage(vaddr, type);
-	int *versionptr = (int *)memptr;
-	addr_t *checkaddr = (addr_t *)(memptr + sizeof(int));
-	if (*checkaddr != vaddr) {
-		fprintf(stderr,"Error, simulated page returned by pagetable lookup doese not have expected value.\n");
-	}
-	
-	if (type == 'S' || type == 'M') {
-		// write access to page, increment version number
-		(*versionptr)++;
+char *snapfile = NULL;
+long snap_after = -1;
+static volatile sig_atomic_t snap_requested = 0;
+static volatile sig_atomic_t snap_stop = 0;
+
+static struct pagesim_ref batch[SIM_BATCH];
+
+
+void snap_signal(int sig) {
+	snap_requested = 1;
+	if (sig == SIGINT) {
+		snap_stop = 1;
 	}
+}
 
+/* Writes a snapshot if one is due, that is if the references from 'from'
+ * up to 'refs' reached snap_after or one was requested.  A record with a
+ * repeat count may take the run past snap_after.  Returns 1 if the run
+ * should stop.
+ */
+int check_snapshot(pagesim_t *ps, struct trace *tr, long from, long refs) {
+	int stop;
+	int reached = from < snap_after && refs >= snap_after;
+	if (!reached && !snap_requested) {
+		return 0;
+	}
+	stop = (reached || snap_stop);
+	snap_requested = 0;
+	if (pagesim_save(ps, snapfile, trace_tell(tr)) == 0) {
+		printf("Snapshot written to %s after %ld references\n",
+		       snapfile, refs);
+	}
+	return stop;
 }
 
+void replay_trace(pagesim_t *ps, struct trace *tr) {
+	struct pagesim_counters c;
+	struct trace_ref ref;
+	long refs;
 
-void replay_trace(FILE *infp) {
-	char buf[MAXLINE];
-	addr_t vaddr = 0;
-	char type;
+	pagesim_counters(ps, &c);
+	refs = c.refs;
+	for (;;) {
+		size_t n = 0;
+		long from = refs;
 
-	while(fgets(buf, MAXLINE, infp) != NULL) {
-		if(buf[0] != '=') {
-			sscanf(buf, "%c %lx", &type, &vaddr);
+		// End the batch where a snapshot is due
+		while (n < SIM_BATCH &&
+		       !(snapfile != NULL && from < snap_after && refs >= snap_after) &&
+		       trace_next(tr, &ref)) {
 			if(debug)  {
-				printf("%c %lx\n", type, vaddr);
+				printf("%c %lx\n", ref.type, ref.addr);
+			}
+			batch[n].type = ref.type;
+			batch[n].addr = ref.addr;
+			batch[n].count = ref.count;
+			if (!TRACE_IS_EVENT(ref.type)) {
+				refs += ref.count;
 			}
-			access_mem(type, vaddr);
-		} else {
-			continue;
+			n++;
+		}
+		if (n == 0) {
+			break;
+		}
+		pagesim_access(ps, batch, n);
+		if (snapfile != NULL && check_snapshot(ps, tr, from, refs)) {
+			break;
 		}
-
 	}
 }
 
 
 int main(int argc, char *argv[]) {
 	int opt;
-	unsigned swapsize = 4096;
-	FILE *tfp = stdin;
-	char *replacement_alg = NULL;
-	char *usage = "USAGE: sim -f tracefile -m memorysize -s swapsize -a algorithm\n";
+	struct pagesim_config cfg;
+	struct pagesim_counters c;
+	pagesim_t *ps;
+	struct trace tr;
+	static char group_names[PAGESIM_MAX_GROUPS][PAGESIM_GROUP_NAMELEN];
+	struct pagesim_group *g;
+	int i;
+	char *usage = "USAGE: sim -f tracefile -m memorysize -s swapsize -a algorithm [-r seed] [-w cleanbatch] [-i cleaninterval] [-z zswapbytes[:pagebytes]] [-T fastframes [-L fastns:slowns]] [-g name:hard[:soft]]... [-b vabits] [-S snapshot [-n refs]] [-R snapshot]\n";
 
-	while ((opt = getopt(argc, argv, "f:m:a:s:")) != -1) {
+	pagesim_config_default(&cfg);
+	while ((opt = getopt(argc, argv, "f:m:a:r:s:w:i:z:T:L:g:b:S:n:R:")) != -1) {
 		switch (opt) {
 		case 'f':
-			tracefile = optarg;
+			cfg.tracefile = optarg;
 			break;
 		case 'm':
-			memsize = (unsigned)strtoul(optarg, NULL, 10);
+			cfg.memsize = (unsigned)strtoul(optarg, NULL, 10);
 			break;
 		case 'a':
-			replacement_alg = optarg;
+			cfg.alg = optarg;
+			break;
+		case 'r':
+			cfg.rand_seed = strtoul(optarg, NULL, 0);
 			break;
 		case 's':
-			swapsize = (unsigned)strtoul(optarg, NULL, 10);
+			cfg.swapsize = (unsigned)strtoul(optarg, NULL, 10);
+			break;
+		case 'w':
+			cfg.clean_batch = (unsigned)strtoul(optarg, NULL, 10);
+			break;
+		case 'i':
+			cfg.clean_interval = (unsigned)strtoul(optarg, NULL, 10);
+			break;
+		case 'z':
+			// the pool size, and the mean compressed size of a page
+			if (sscanf(optarg, "%u:%u", &cfg.zswap_bytes,
+				   &cfg.zswap_page_bytes) < 1) {
+				fprintf(stderr, "%s", usage);
+				exit(1);
+			}
+			break;
+		case 'T':
+			cfg.tier_fast_frames = (unsigned)strtoul(optarg, NULL, 10);
+			break;
+		case 'L':
+			if (sscanf(optarg, "%u:%u", &cfg.tier_fast_ns, &cfg.tier_slow_ns) != 2) {
+				fprintf(stderr, "%s", usage);
+				exit(1);
+			}
+			break;
+		case 'g':
+			// groups are numbered in the order they are given
+			if (cfg.ngroups == PAGESIM_MAX_GROUPS) {
+				fprintf(stderr, "Error: at most %d groups\n", PAGESIM_MAX_GROUPS);
+				exit(1);
+			}
+			g = &cfg.groups[cfg.ngroups];
+			g->name = group_names[cfg.ngroups];
+			if (sscanf(optarg, "%15[^:]:%u:%u", group_names[cfg.ngroups],
+				   &g->hard, &g->soft) < 2) {
+				fprintf(stderr, "%s", usage);
+				exit(1);
+			}
+			cfg.ngroups++;
+			break;
+		case 'b':
+			cfg.vabits = (int)strtol(optarg, NULL, 10);
+			break;
+		case 'S':
+			snapfile = optarg;
+			break;
+		case 'n':
+			snap_after = strtol(optarg, NULL, 10);
+			break;
+		case 'R':
+			cfg.resume = optarg;
 			break;
 		default:
 			fprintf(stderr, "%s", usage);
 			exit(1);
 		}
 	}
-	if(tracefile != NULL) {
-		if((tfp = fopen(tracefile, "r")) == NULL) {
-			perror("Error opening tracefile:");
+	if (cfg.alg == NULL && cfg.resume == NULL) {
+		fprintf(stderr, "%s", usage);
+		exit(1);
+	}
+	if (snapfile != NULL) {
+		if (cfg.tracefile == NULL) {
+			fprintf(stderr, "Error: snapshots require a tracefile (-f)\n");
 			exit(1);
 		}
+		signal(SIGUSR1, snap_signal);
+		signal(SIGINT, snap_signal);
+	}
+	if (trace_open(&tr, cfg.tracefile) != 0) {
+		perror("Error opening tracefile:");
+		exit(1);
 	}
 
-	// Initialize main data structures for simulation.
-	// This happens before calling the replacement algorithm init function
-	// so that the init_fcn can refer to the coremap if needed.
-	coremap = calloc(memsize, sizeof(struct frame));
-	physmem = malloc(memsize * SIMPAGESIZE);
-	swap_init(swapsize);
-	init_pagetable();
+	// Without -b, the trace may say how wide its addresses are
+	if (cfg.vabits == 0) {
+		cfg.vabits = trace_vabits(&tr);
+	}
 
-	// Initialize replacement algorithm functions.
-	if(replacement_alg == NULL) {
-		fprintf(stderr, "%s", usage);
+	if ((ps = pagesim_create(&cfg)) == NULL) {
+		exit(1);
+	}
+	if (cfg.resume != NULL &&
+	    trace_seek(&tr, pagesim_resume_offset(ps)) != 0) {
+		fprintf(stderr, "Error: cannot resume from %s\n", cfg.resume);
 		exit(1);
-	} else {
-		int i;
-		for (i = 0; i < num_algs; i++) {
-			if(strcmp(algs[i].name, replacement_alg) == 0) {
-				init_fcn = algs[i].init;
-				ref_fcn = algs[i].ref;
-				evict_fcn = algs[i].evict;
-				break;
-			}
-		}
-		if(evict_fcn == NULL) {
-			fprintf(stderr, "Error: invalid replacement algorithm - %s\n", 
-					replacement_alg);
-			exit(1);
-		}
 	}
-	// Call replacement algorithm's init_fcn before replaying trace.
-	init_fcn();
 
-	replay_trace(tfp);
-	print_pagedirectory();
+	replay_trace(ps, &tr);
+	trace_close(&tr);
+	pagesim_print_pagedirectory(ps);
+	pagesim_counters(ps, &c);
 
 	// Cleanup - removes temporary swapfile.
-	swap_destroy();
+	pagesim_destroy(ps);
 
 	printf("\n");
-	printf("Hit count: %d\n", hit_count);
-	printf("Miss count: %d\n", miss_count);
-	printf("Clean evictions: %d\n",evict_clean_count);
-	printf("Dirty evictions: %d\n",evict_dirty_count); 
-	printf("Total references : %d\n", ref_count);
-	printf("Hit rate: %.4f\n", (double)hit_count/ref_count * 100);
-	printf("Miss rate: %.4f\n", (double)miss_count/ref_count *100);
-		
+	printf("Hit count: %ld\n", c.hits);
+	printf("Miss count: %ld\n", c.misses);
+	printf("Clean evictions: %ld\n", c.evict_clean);
+	printf("Dirty evictions: %ld\n", c.evict_dirty);
+	if (cfg.clean_batch) {
+		printf("Cleaner writes: %ld\n", c.clean_writes);
+		printf("Dirty evictions prevented: %ld\n", c.clean_saved);
+	}
+	if (cfg.zswap_bytes) {
+		long file_writes = c.zswap_writebacks + c.zswap_rejects;
+		long file_reads = c.zswap_pageins - c.zswap_loads;
+		printf("Zswap stores: %ld\n", c.zswap_stores);
+		printf("Zswap rejected: %ld\n", c.zswap_rejects);
+		printf("Zswap writebacks: %ld\n", c.zswap_writebacks);
+		printf("Zswap compression ratio: %.2f\n", c.zswap_bytes_out ?
+		       (double)c.zswap_bytes_in/c.zswap_bytes_out : 0.0);
+		printf("Zswap hit rate: %.4f\n", c.zswap_pageins ?
+		       (double)c.zswap_loads/c.zswap_pageins * 100 : 0.0);
+		printf("Swap writes saved: %ld of %ld\n",
+		       c.zswap_pageouts - file_writes, c.zswap_pageouts);
+		printf("Swap reads saved: %ld of %ld\n",
+		       c.zswap_pageins - file_reads, c.zswap_pageins);
+	}
+	if (cfg.tier_fast_frames) {
+		long fast = c.tier_fast_accesses;
+		long slow = c.tier_slow_accesses;
+		long moved = c.tier_promotions + c.tier_demotions;
+		printf("Fast tier accesses: %ld (%.4f%%)\n", fast,
+		       fast + slow ? (double)fast/(fast + slow) * 100 : 0.0);
+		printf("Slow tier accesses: %ld\n", slow);
+		printf("Average access cost: %.2f ns\n", fast + slow ?
+		       (double)(fast*cfg.tier_fast_ns + slow*cfg.tier_slow_ns)/(fast + slow) : 0.0);
+		printf("Promotions: %ld\n", c.tier_promotions);
+		printf("Demotions: %ld\n", c.tier_demotions);
+		printf("Migration traffic: %ld KB\n", moved * PAGE_SIZE / 1024);
+	}
+	if (c.forks) {
+		printf("Forks: %ld\n", c.forks);
+		printf("Exits: %ld\n", c.exits);
+		printf("COW faults: %ld\n", c.cow_faults);
+		printf("COW writes without copy: %ld\n", c.cow_reuses);
+		printf("Frames saved by sharing: %d (peak %d)\n",
+		       c.shared_saved, c.shared_saved_peak);
+	}
+	for (i = 0; c.ngroups && i <= c.ngroups; i++) {
+		struct pagesim_group_counters *gc = &c.groups[i];
+		printf("Group %s: %ld references, fault rate %.4f, %d reclaims, peak %u frames\n",
+		       gc->name, gc->refs,
+		       gc->refs ? (double)gc->misses/gc->refs * 100 : 0.0,
+		       gc->reclaims, gc->peak);
+	}
+	printf("Total references : %ld\n", c.refs);
+	printf("Hit rate: %.4f\n", (double)c.hits/c.refs * 100);
+	printf("Miss rate: %.4f\n", (double)c.misses/c.refs *100);
+
 	return(0);
 }
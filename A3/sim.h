@@ -8,11 +8,102 @@
 extern unsigned memsize;
 extern int debug;
 
-extern int hit_count;
-extern int miss_count;
-extern int ref_count;
-extern int evict_clean_count;
-extern int evict_dirty_count;
+extern long hit_count;
+extern long miss_count;
+extern long ref_count;
+extern long evict_clean_count;
+extern long evict_dirty_count;
+
+// Seed of the generator the rand algorithm draws its victims from
+extern unsigned long rand_seed;
+
+/* Optional page cleaner: every clean_interval references, up to clean_batch
+ * idle dirty frames are written back ahead of eviction.  Disabled when
+ * clean_batch is 0.
+ */
+extern unsigned clean_batch;
+extern unsigned clean_interval;
+extern long clean_write_count;
+extern long clean_saved_count;
+
+/* Optional compressed swap tier (see zswap.c), enabled by a non-zero
+ * pool size in bytes.  Pages are modelled as 4 KiB that compress to
+ * zswap_page_bytes on average.
+ */
+#define ZSWAP_PAGE_BYTES 1365
+
+struct zswap_stats {
+	long pageouts;       // pages written to swap while the tier is on
+	long pageins;        // pages read from swap while the tier is on
+	long stores;         // pages compressed into the pool
+	long rejects;        // pages that went straight to the file
+	long loads;          // page-ins served from the pool
+	long writebacks;     // pages moved from the pool to the file
+	long bytes_in;       // uncompressed bytes stored, 4 KiB a page
+	long bytes_out;      // pool bytes they took, headers included
+};
+extern unsigned zswap_pool_bytes;
+extern unsigned zswap_page_bytes;
+extern struct zswap_stats zswap_stats;
+extern void zswap_init(unsigned swapsize);
+extern int zswap_store(int swap_offset, const char *page);
+extern int zswap_load(int swap_offset, char *page);
+extern void zswap_invalidate(int swap_offset);
+
+/* Optional tiered memory (see tier.c): the first tier_fast_frames frames
+ * are fast, the rest slow.  Disabled when tier_fast_frames is 0.
+ */
+struct tier_stats {
+	long accesses[2];    // references to resident pages, per tier
+	long promotions;
+	long demotions;
+};
+extern unsigned tier_fast_frames;
+extern unsigned tier_fast_ns;
+extern unsigned tier_slow_ns;
+extern struct tier_stats tier_stats;
+extern void tier_init(void);
+extern void tier_access(int frame, unsigned count);
+
+/* Processes (see proc.c).  Traces may fork, switch between and exit
+ * processes; forked processes share their pages copy-on-write.
+ */
+extern long fork_count;
+extern long exit_count;
+extern long cow_fault_count; // writes that had to copy a shared page
+extern long cow_reuse_count; // writes to a COW page no longer shared
+extern int shared_saved;     // frames saved by sharing, now
+extern int shared_saved_peak;
+extern void proc_init(void);
+extern void proc_event(char type, addr_t pid);
+extern void proc_destroy(void);
+
+/* Optional memory-limit groups (see group.c).  Groups 1..num_groups are
+ * configured with frame limits; group 0 is the unlimited root group.  The
+ * trace selects the group the following references are charged to.
+ * Disabled when num_groups is 0.
+ */
+#define MAX_GROUPS 16
+#define GROUP_NAMELEN 16
+struct group {
+	char name[GROUP_NAMELEN];
+	unsigned hard;       // frames the group may never exceed, 0 = no limit
+	unsigned soft;       // frames above which it is reclaimed first, 0 = none
+	unsigned frames;     // frames charged to the group
+	unsigned peak;
+	long refs;
+	long misses;
+	int reclaims;        // own frames evicted because of its limits
+};
+extern int num_groups;
+extern int cur_group;
+extern struct group groups[MAX_GROUPS + 1];
+extern void group_init(void);
+extern void group_select(addr_t group);
+extern int group_reclaim_hard(void);
+extern int group_reclaim_soft(void);
+extern void group_charge(int frame);
+extern void group_uncharge(int frame);
 
 /* We simulate physical memory with a large array of bytes */
 extern char *physmem;
@@ -23,17 +114,28 @@ extern char *physmem;
  */
 extern char *tracefile;
 
+// Name of the replacement algorithm in use
+extern char *replacement_alg;
+
+/* Checkpoint and resume (see snapshot.c). */
+extern int snapshot_save(const char *path, long trace_off, const char *alg);
+extern int snapshot_open(const char *path, unsigned *mem, unsigned *swap,
+			 int *vabits, char *alg, size_t alglen);
+extern long snapshot_restore(void);
+
 // Each eviction algorithm is represented by a structure with its name
-// and three functions.
+// and the functions that implement it.
 struct functions {
 	char *name;                  // String name of eviction algorithm
 	void (*init)(void);          // Initialize any data needed by alg
 	void (*ref)(pgtbl_entry_t *);    // Called on each reference
 	int (*evict)();              // Called to choose victim for eviction
+	void (*release)(int);        // Called when a frame is freed, or NULL
 };
 
 extern void (*init_fcn)();
 extern void (*ref_fcn)(pgtbl_entry_t *);
 extern int (*evict_fcn)();
+extern void (*release_fcn)(int);
 
 #endif // __SIM_H 
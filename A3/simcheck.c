@@ -0,0 +1,485 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "pagesim.h"
+#include "trace.h"
+
+/* Regression checks for libpagesim and the trace reader, run by
+ * "make check":
+ *
+ *  - the trace reader: reduced and lackey lines, events, "*N" counts, the
+ *    "=vabits" header, lines it must skip, tell/seek, and a trace longer
+ *    than its buffer;
+ *  - repeat counts: a run of references given as one line with a count
+ *    must end with the same counts as the run written out, for the
+ *    algorithms whose state does not depend on how often a page was
+ *    referenced in a row;
+ *  - snapshots: stopping part way, saving, and resuming in a new
+ *    simulator must end exactly like a run straight through, for every
+ *    algorithm, with and without the cleaner, zswap and tiers;
+ *  - copy-on-write: a fork followed by writes from both processes gives
+ *    the expected COW faults, reuses and sharing, and runs under memory
+ *    pressure end with nothing shared once the children have exited.
+ *
+ * The simulator reports a page with the wrong content on standard error,
+ * so anything written there counts as a failure too.  Exits with 1 if any
+ * check failed.
+ */
+
+#define BASE 0x10000000UL    // of the pages the checks reference
+#define NPAGES 200
+#define NREFS 20000
+
+static const char *algs[] = { "rand", "fifo", "lru", "clock", "opt", "lfu", "lruk" };
+#define NALGS (sizeof(algs) / sizeof(algs[0]))
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+static unsigned long state;
+
+// xorshift64*, enough for test data
+static unsigned long next_rand(void) {
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return state * 0x2545F4914F6CDD1DUL;
+}
+
+static char trace_path[] = "/tmp/simcheck-trace.XXXXXX";
+static char snap_path[] = "/tmp/simcheck-snap.XXXXXX";
+
+// Write the text to a fresh temporary trace, and return its name
+static const char *write_trace(const char *text) {
+	FILE *f = fopen(trace_path, "w");
+
+	if (f == NULL || fputs(text, f) == EOF || fclose(f) != 0) {
+		perror(trace_path);
+		exit(1);
+	}
+	return trace_path;
+}
+
+/* The trace reader */
+
+static void check_trace_lines(void) {
+	static const char text[] =
+		"=vabits 48\n"
+		"L 7ff000\n"
+		" S 7ff000398,8\n"
+		"I  0400d7d4,4\n"
+		"==12345== lackey chatter\n"
+		"not a reference\n"
+		"M 1000 *5\n"
+		"F 1a\n"
+		"P 1a\n"
+		"G 2\n"
+		"X 1a\n"
+		"L abc*12\n";
+	static const struct trace_ref want[] = {
+		{ 'L', 0x7ff000, 0, 1 },
+		{ 'S', 0x7ff000398, 8, 1 },
+		{ 'I', 0x400d7d4, 4, 1 },
+		{ 'M', 0x1000, 0, 5 },
+		{ 'F', 0x1a, 0, 1 },
+		{ 'P', 0x1a, 0, 1 },
+		{ 'G', 0x2, 0, 1 },
+		{ 'X', 0x1a, 0, 1 },
+		{ 'L', 0xabc, 0, 12 },
+	};
+	struct trace t;
+	struct trace_ref r;
+	long at_m = 0;
+	int i;
+
+	if (trace_open(&t, write_trace(text)) != 0) {
+		perror("trace_open");
+		exit(1);
+	}
+	CHECK(trace_vabits(&t) == 48, "vabits %d, want 48", trace_vabits(&t));
+	for (i = 0; i < sizeof(want) / sizeof(want[0]); i++) {
+		if (want[i].type == 'M') {
+			at_m = trace_tell(&t);
+		}
+		if (!trace_next(&t, &r)) {
+			CHECK(0, "trace ended at reference %d", i);
+			break;
+		}
+		CHECK(r.type == want[i].type && r.addr == want[i].addr &&
+		      r.size == want[i].size && r.count == want[i].count,
+		      "reference %d: %c %lx,%u *%u, want %c %lx,%u *%u", i,
+		      r.type, r.addr, r.size, r.count, want[i].type,
+		      want[i].addr, want[i].size, want[i].count);
+	}
+	CHECK(!trace_next(&t, &r), "reference past the end: %c %lx", r.type, r.addr);
+
+	// Back to the "M" line, which the lines skipped before it precede
+	CHECK(trace_seek(&t, at_m) == 0, "trace_seek failed");
+	CHECK(trace_next(&t, &r) && r.type == 'M' && r.count == 5,
+	      "after seek: %c %lx *%u, want M 1000 *5", r.type, r.addr, r.count);
+	trace_close(&t);
+}
+
+// A trace several buffers long reads back exactly as it was written
+static void check_trace_long(void) {
+	int n = 3 * TRACE_BUFSIZE / 16;
+	size_t len = (size_t)n * 24 + 1;
+	char *text = malloc(len), *p = text;
+	struct trace t;
+	struct trace_ref r;
+	int i;
+
+	state = 1;
+	for (i = 0; i < n; i++) {
+		p += sprintf(p, "%c %lx\n", i % 3 ? 'L' : 'S', next_rand() >> 16);
+	}
+	if (trace_open(&t, write_trace(text)) != 0) {
+		perror("trace_open");
+		exit(1);
+	}
+	state = 1;
+	for (i = 0; i < n && trace_next(&t, &r); i++) {
+		unsigned long addr = next_rand() >> 16;
+		if (r.type != (i % 3 ? 'L' : 'S') || r.addr != addr) {
+			CHECK(0, "long trace, reference %d: %c %lx, want %c %lx",
+			      i, r.type, r.addr, i % 3 ? 'L' : 'S', addr);
+			break;
+		}
+	}
+	CHECK(i == n && !trace_next(&t, &r), "long trace: %d references, want %d", i, n);
+	trace_close(&t);
+	free(text);
+}
+
+/* Runs of the simulator */
+
+static void config(struct pagesim_config *cfg, const char *alg, unsigned memsize) {
+	pagesim_config_default(cfg);
+	cfg->alg = alg;
+	cfg->memsize = memsize;
+	cfg->swapsize = 4 * NPAGES;
+}
+
+static pagesim_t *create(const struct pagesim_config *cfg) {
+	pagesim_t *ps = pagesim_create(cfg);
+
+	if (ps == NULL) {
+		printf("FAIL: cannot create a simulator with %s\n", cfg->alg);
+		exit(1);
+	}
+	return ps;
+}
+
+// Counters that must agree between two runs that should be the same
+#define SAME_COUNTERS(X) \
+	X(refs) X(hits) X(misses) X(evict_clean) X(evict_dirty) \
+	X(clean_writes) X(clean_saved) X(zswap_pageouts) X(zswap_pageins) \
+	X(zswap_stores) X(zswap_rejects) X(zswap_writebacks) \
+	X(tier_fast_accesses) X(tier_slow_accesses) X(tier_promotions) \
+	X(tier_demotions)
+
+static void compare(const char *what, const char *alg,
+		    const struct pagesim_counters *a, const struct pagesim_counters *b) {
+#define X(field) \
+	CHECK(a->field == b->field, "%s with %s: " #field " %ld, want %ld", \
+	      what, alg, b->field, a->field);
+	SAME_COUNTERS(X)
+#undef X
+}
+
+/* References with some locality: a loop over part of the pages, and
+ * random pages, a quarter of them stores, some in runs of repeats.
+ */
+static void make_refs(struct pagesim_ref *refs, int n, unsigned long seed) {
+	int i, loop = 0;
+
+	state = seed;
+	for (i = 0; i < n; i++) {
+		unsigned long r = next_rand();
+		unsigned page = r % 4 ? (loop++ % (NPAGES / 4)) : (r >> 8) % NPAGES;
+
+		refs[i].type = (r >> 20) % 4 == 0 ? 'S' : 'L';
+		refs[i].addr = BASE + (unsigned long)page * 4096;
+		refs[i].count = (r >> 24) % 8 == 0 ? 1 + (r >> 28) % 20 : 1;
+	}
+}
+
+// Write refs as a trace, noting where each line starts in off[]
+static const char *refs_trace(const struct pagesim_ref *refs, int n, long *off) {
+	char *text = malloc((size_t)n * 32 + 1), *p = text;
+	const char *path;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		off[i] = p - text;
+		p += sprintf(p, "%c %lx *%u\n", refs[i].type, refs[i].addr, refs[i].count);
+	}
+	off[n] = p - text;
+	path = write_trace(text);
+	free(text);
+	return path;
+}
+
+// A run given as one reference with a count, against the run written out
+static void check_repeats(void) {
+	static const char *simple[] = { "rand", "fifo", "lru", "clock" };
+	struct pagesim_ref *refs = malloc(NREFS * sizeof(*refs));
+	struct pagesim_ref *flat = malloc(NREFS * 20 * sizeof(*flat));
+	struct pagesim_counters a, b;
+	struct pagesim_config cfg;
+	pagesim_t *ps;
+	int i, j, n = 0, k;
+
+	make_refs(refs, NREFS, 7);
+	for (i = 0; i < NREFS; i++) {
+		for (j = 0; j < refs[i].count; j++) {
+			flat[n] = refs[i];
+			flat[n++].count = 1;
+		}
+	}
+	for (k = 0; k < sizeof(simple) / sizeof(simple[0]); k++) {
+		config(&cfg, simple[k], 32);
+		ps = create(&cfg);
+		pagesim_access(ps, refs, NREFS);
+		pagesim_counters(ps, &a);
+		pagesim_destroy(ps);
+
+		ps = create(&cfg);
+		pagesim_access(ps, flat, n);
+		pagesim_counters(ps, &b);
+		pagesim_destroy(ps);
+		compare("repeat counts", simple[k], &b, &a);
+	}
+	free(refs);
+	free(flat);
+}
+
+/* A run straight through, against one saved at 'split' and resumed from
+ * the snapshot.  The trace is written out, as opt and the resume need it.
+ */
+static void check_snapshot(struct pagesim_config *cfg, const char *what) {
+	struct pagesim_ref *refs = malloc(NREFS * sizeof(*refs));
+	long *off = malloc((NREFS + 1) * sizeof(long));
+	struct pagesim_counters a, b;
+	struct pagesim_config rcfg;
+	int split = NREFS / 3;
+	pagesim_t *ps;
+
+	make_refs(refs, NREFS, 11);
+	cfg->tracefile = refs_trace(refs, NREFS, off);
+
+	ps = create(cfg);
+	pagesim_access(ps, refs, NREFS);
+	pagesim_counters(ps, &a);
+	pagesim_destroy(ps);
+
+	ps = create(cfg);
+	pagesim_access(ps, refs, split);
+	CHECK(pagesim_save(ps, snap_path, off[split]) == 0,
+	      "%s with %s: snapshot not saved", what, cfg->alg);
+	pagesim_destroy(ps);
+
+	rcfg = *cfg;
+	rcfg.resume = snap_path;
+	ps = pagesim_create(&rcfg);
+	if (ps == NULL) {
+		CHECK(0, "%s with %s: cannot resume", what, cfg->alg);
+	} else {
+		CHECK(pagesim_resume_offset(ps) == off[split],
+		      "%s with %s: resume offset %ld, want %ld", what, cfg->alg,
+		      pagesim_resume_offset(ps), off[split]);
+		pagesim_access(ps, refs + split, NREFS - split);
+		pagesim_counters(ps, &b);
+		pagesim_destroy(ps);
+		compare(what, cfg->alg, &a, &b);
+	}
+	unlink(snap_path);
+	free(refs);
+	free(off);
+}
+
+static void check_snapshots(void) {
+	struct pagesim_config cfg;
+	int k;
+
+	for (k = 0; k < NALGS; k++) {
+		config(&cfg, algs[k], 32);
+		check_snapshot(&cfg, "snapshot");
+
+		config(&cfg, algs[k], 32);
+		cfg.clean_batch = 8;
+		cfg.clean_interval = 200;
+		cfg.zswap_bytes = 16 * 4096;
+		check_snapshot(&cfg, "snapshot with cleaner and zswap");
+
+		config(&cfg, algs[k], 32);
+		cfg.tier_fast_frames = 8;
+		check_snapshot(&cfg, "snapshot with tiers");
+	}
+}
+
+/* Copy-on-write */
+
+static struct pagesim_ref ref(char type, unsigned long addr) {
+	struct pagesim_ref r = { type, addr, 1 };
+	return r;
+}
+
+static unsigned long page(int i) {
+	return BASE + (unsigned long)i * 4096;
+}
+
+// A fork, then writes from the child and the parent, with memory to spare
+static void check_cow_exact(void) {
+	struct pagesim_ref refs[64];
+	struct pagesim_counters c;
+	struct pagesim_config cfg;
+	pagesim_t *ps;
+	int n = 0, i;
+
+	for (i = 0; i < 10; i++) {
+		refs[n++] = ref('S', page(i));       // 10 private pages
+	}
+	refs[n++] = ref('F', 1);                 // all 10 shared
+	refs[n++] = ref('P', 1);
+	for (i = 0; i < 4; i++) {
+		refs[n++] = ref('S', page(i));       // 4 COW faults
+	}
+	for (i = 4; i < 10; i++) {
+		refs[n++] = ref('L', page(i));       // still shared
+	}
+	refs[n++] = ref('P', 0);
+	for (i = 0; i < 4; i++) {
+		refs[n++] = ref('S', page(i));       // sole owner: 4 reuses
+	}
+	refs[n++] = ref('S', page(4));           // 1 more COW fault
+	refs[n++] = ref('X', 1);                 // nothing shared
+
+	config(&cfg, "lru", 64);
+	ps = create(&cfg);
+	pagesim_access(ps, refs, n);
+	pagesim_counters(ps, &c);
+	pagesim_destroy(ps);
+	CHECK(c.forks == 1 && c.exits == 1, "forks %ld exits %ld, want 1 and 1",
+	      c.forks, c.exits);
+	CHECK(c.cow_faults == 5, "COW faults %ld, want 5", c.cow_faults);
+	CHECK(c.cow_reuses == 4, "COW reuses %ld, want 4", c.cow_reuses);
+	CHECK(c.shared_saved == 0 && c.shared_saved_peak == 10,
+	      "shared %d (peak %d), want 0 (peak 10)", c.shared_saved, c.shared_saved_peak);
+	CHECK(c.misses == 10, "misses %ld, want 10", c.misses);
+}
+
+/* Three processes sharing and writing pages in a memory much smaller than
+ * they use, so that shared pages are swapped out and in; the children
+ * exit at the end.
+ */
+static void check_cow_pressure(void) {
+	struct pagesim_ref *refs = malloc(4 * NREFS * sizeof(*refs));
+	struct pagesim_counters c;
+	struct pagesim_config cfg;
+	pagesim_t *ps;
+	int n = 0, i, k, pid = 0;
+
+	state = 5;
+	for (i = 0; i < 40; i++) {
+		refs[n++] = ref('S', page(i));
+	}
+	refs[n++] = ref('F', 1);
+	refs[n++] = ref('F', 2);
+	for (i = 0; i < NREFS; i++) {
+		unsigned long r = next_rand();
+		if (r % 50 == 0) {
+			pid = (r >> 8) % 3;
+			refs[n++] = ref('P', pid);
+		}
+		refs[n++] = ref((r >> 16) % 3 == 0 ? 'S' : 'L', page((r >> 24) % 40));
+	}
+	refs[n++] = ref('X', 1);
+	refs[n++] = ref('X', 2);
+	if (pid != 0) {
+		refs[n++] = ref('P', 0);
+	}
+	for (i = 0; i < 40; i++) {
+		refs[n++] = ref('L', page(i));
+	}
+
+	for (k = 0; k < NALGS; k++) {
+		if (strcmp(algs[k], "opt") == 0) {
+			continue;   // needs a trace file, and nothing here is special to it
+		}
+		config(&cfg, algs[k], 8);
+		ps = create(&cfg);
+		pagesim_access(ps, refs, n);
+		pagesim_counters(ps, &c);
+		pagesim_destroy(ps);
+		CHECK(c.forks == 2 && c.exits == 2, "%s: forks %ld exits %ld, want 2 and 2",
+		      algs[k], c.forks, c.exits);
+		CHECK(c.hits + c.misses == c.refs, "%s: %ld hits and %ld misses in %ld references",
+		      algs[k], c.hits, c.misses, c.refs);
+		CHECK(c.shared_saved == 0, "%s: %d frames still shared", algs[k], c.shared_saved);
+		// Most shared pages are on swap by the time they are written;
+		// one read back in is only shared again once another process
+		// touches it, so most writes are reuses (see cow_break)
+		CHECK(c.cow_faults + c.cow_reuses > 0 && c.shared_saved_peak > 0,
+		      "%s: %ld COW faults, %ld reuses, peak sharing %d", algs[k],
+		      c.cow_faults, c.cow_reuses, c.shared_saved_peak);
+	}
+	free(refs);
+}
+
+int main(int argc, char *argv[]) {
+	FILE *errs = tmpfile();
+	int saved_stderr = dup(2);
+	int fd;
+	long nerr;
+
+	if ((fd = mkstemp(trace_path)) < 0 || close(fd) != 0 ||
+	    (fd = mkstemp(snap_path)) < 0 || close(fd) != 0 ||
+	    errs == NULL || saved_stderr < 0) {
+		perror("simcheck");
+		return 1;
+	}
+	unlink(snap_path);
+
+	// What the simulator prints on standard error goes to errs
+	fflush(stderr);
+	dup2(fileno(errs), 2);
+
+	check_trace_lines();
+	check_trace_long();
+	check_repeats();
+	check_snapshots();
+	check_cow_exact();
+	check_cow_pressure();
+
+	fflush(stderr);
+	dup2(saved_stderr, 2);
+	unlink(trace_path);
+	nerr = lseek(fileno(errs), 0, SEEK_END);
+	if (nerr > 0) {
+		char buf[4096];
+		size_t got;
+
+		printf("FAIL: the simulator reported errors:\n");
+		lseek(fileno(errs), 0, SEEK_SET);
+		while ((got = read(fileno(errs), buf, sizeof(buf))) > 0) {
+			fwrite(buf, 1, got, stdout);
+		}
+		failures++;
+	}
+	if (failures) {
+		printf("simcheck: %d failed\n", failures);
+		return 1;
+	}
+	printf("simcheck: ok\n");
+	return 0;
+}
@@ -0,0 +1,434 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sim.h"
+#include "pagetable.h"
+
+//---------------------------------------------------------------------
+// Checkpoint and resume of the complete simulator state.
+//
+// A snapshot file starts with a header (counters, configuration, trace
+// offset and a table of sections), followed by one section per piece of
+// state.  Every section starts on a page boundary, so on resume the
+// coremap and physmem sections are mmap'd privately straight from the
+// file: several continuations can be started from the same warmed-up
+// snapshot and only pay for the pages they actually touch.
+//
+// Besides the core state (coremap, physmem, page tables and swap file),
+// each module registers its private state with snapshot_register, e.g.
+// the clock hand.  Registered state is restored after the algorithm's
+// init function has run, so init may reset it freely.
+
+#define SNAP_MAGIC        0x50414e53  // "SNAP"
+#define SNAP_VERSION      5
+#define SNAP_NAMELEN      16
+#define SNAP_MAX_SECTIONS 32
+#define SNAP_ALIGN        4096
+
+struct snap_section {
+	char name[SNAP_NAMELEN];
+	off_t off;
+	size_t len;
+};
+
+struct snap_header {
+	unsigned magic;
+	unsigned version;
+	unsigned memsize;
+	unsigned swapsize;
+	int vabits;
+	char alg[SNAP_NAMELEN];
+	long trace_off;   // position in the tracefile of the next reference
+
+	long hit_count;
+	long miss_count;
+	long ref_count;
+	long evict_clean_count;
+	long evict_dirty_count;
+	long clean_write_count;
+	long clean_saved_count;
+
+	int nsections;
+	struct snap_section sec[SNAP_MAX_SECTIONS];
+};
+
+// A page table entry is saved as its position in the page table.
+#define PTE_KEY(dir, tbl)   (((unsigned long)(dir) << 32) | (tbl))
+#define PTE_KEY_DIR(key)    ((unsigned)((key) >> 32))
+#define PTE_KEY_TBL(key)    ((unsigned)((key) & 0xffffffff))
+#define PTE_KEY_NONE        (~0UL)
+
+// One second-level page table as stored in the "pgtables" section; its
+// size depends on the geometry
+struct snap_pgtbl {
+	unsigned long dir_idx;
+	pgtbl_entry_t entries[];
+};
+#define SNAP_PGTBL_SIZE \
+	(sizeof(struct snap_pgtbl) + PTRS_PER_PGTBL * sizeof(pgtbl_entry_t))
+#define SNAP_PGTBL(tables, i) \
+	((struct snap_pgtbl *)((char *)(tables) + (i) * SNAP_PGTBL_SIZE))
+
+struct snap_state {
+	char name[SNAP_NAMELEN];
+	void *data;
+	size_t len;
+	void (*save)(void);     // optional, called before data is saved
+	void (*restore)(void);  // optional, called after data is restored
+};
+
+static struct snap_state states[SNAP_MAX_SECTIONS];
+static int num_states = 0;
+
+static struct snap_header loaded;
+static int loaded_fd = -1;
+
+// Lengths of the coremap and physmem mappings made by a restore, 0 if the
+// coremap and physmem are ordinary heap memory
+static size_t mapped_coremap, mapped_physmem;
+
+extern pgdir_entry_t init_second_level();
+
+static struct snap_state *snap_state(const char *name) {
+	int i;
+	for (i = 0; i < num_states; i++) {
+		if (strcmp(states[i].name, name) == 0) {
+			return &states[i];
+		}
+	}
+	assert(num_states < SNAP_MAX_SECTIONS);
+	memset(&states[i], 0, sizeof(states[i]));
+	strncpy(states[i].name, name, SNAP_NAMELEN - 1);
+	num_states++;
+	return &states[i];
+}
+
+/* Registers a block of module state to be saved in, and restored from,
+ * snapshots.  Registering the same name again replaces the old entry.
+ */
+void snapshot_register(const char *name, void *data, size_t len) {
+	struct snap_state *st = snap_state(name);
+	st->data = data;
+	st->len = len;
+}
+
+/* Forgets all registered state, and unmaps the coremap and physmem if
+ * they were mapped from a snapshot (setting them to NULL), when the
+ * simulator is torn down.
+ */
+void snapshot_reset(void) {
+	num_states = 0;
+	if (mapped_coremap) {
+		munmap(coremap, mapped_coremap);
+		munmap(physmem, mapped_physmem);
+		coremap = NULL;
+		physmem = NULL;
+		mapped_coremap = mapped_physmem = 0;
+	}
+	if (loaded_fd >= 0) {
+		close(loaded_fd);
+		loaded_fd = -1;
+	}
+}
+
+/* Sets functions to run before the state registered as 'name' is saved
+ * and after it is restored, for state that lives outside the registered
+ * block (e.g. inside libc).  Either may be NULL.
+ */
+void snapshot_hooks(const char *name, void (*save)(void), void (*restore)(void)) {
+	struct snap_state *st = snap_state(name);
+	st->save = save;
+	st->restore = restore;
+}
+
+//---------------------------------------------------------------------
+// Saving
+
+static off_t snap_align(off_t off) {
+	return (off + SNAP_ALIGN - 1) & ~((off_t)SNAP_ALIGN - 1);
+}
+
+/* Appends a section to the file, recording it in the header. */
+static int snap_write_section(int fd, struct snap_header *h, off_t *pos,
+			      const char *name, const void *data, size_t len) {
+	struct snap_section *s;
+	const char *p = data;
+	size_t done = 0;
+
+	assert(h->nsections < SNAP_MAX_SECTIONS);
+	s = &h->sec[h->nsections++];
+	strncpy(s->name, name, SNAP_NAMELEN - 1);
+	s->off = snap_align(*pos);
+	s->len = len;
+	while (done < len) {
+		ssize_t n = pwrite(fd, p + done, len - done, s->off + done);
+		if (n <= 0) {
+			perror("snapshot: write failed");
+			return -1;
+		}
+		done += n;
+	}
+	*pos = s->off + len;
+	return 0;
+}
+
+/* Writes the complete simulator state to 'path'.  'trace_off' is the byte
+ * offset in the tracefile where replay should continue.
+ * Returns 0 on success, -1 on failure.
+ */
+int snapshot_save(const char *path, long trace_off, const char *alg) {
+	struct snap_header h;
+	struct frame *frames;
+	struct snap_pgtbl *tables;
+	char tmpname[1024];
+	off_t pos = sizeof(h);
+	int fd, i, j, ntables = 0;
+	int ret = -1;
+
+	// Only the single process of an ordinary trace is saved.
+	if (fork_count > 0 || exit_count > 0) {
+		fprintf(stderr, "snapshot: cannot save a run with process events\n");
+		return -1;
+	}
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp", path);
+	if ((fd = open(tmpname, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+		perror("snapshot: cannot create snapshot file");
+		return -1;
+	}
+
+	memset(&h, 0, sizeof(h));
+	h.magic = SNAP_MAGIC;
+	h.version = SNAP_VERSION;
+	h.memsize = memsize;
+	h.vabits = geom.vabits;
+	h.swapsize = swap_size();
+	strncpy(h.alg, alg, SNAP_NAMELEN - 1);
+	h.trace_off = trace_off;
+	h.hit_count = hit_count;
+	h.miss_count = miss_count;
+	h.ref_count = ref_count;
+	h.evict_clean_count = evict_clean_count;
+	h.evict_dirty_count = evict_dirty_count;
+	h.clean_write_count = clean_write_count;
+	h.clean_saved_count = clean_saved_count;
+
+	// Page tables, and the coremap with pte pointers replaced by keys.
+	for (i = 0; i < PTRS_PER_PGDIR; i++) {
+		if (pgdir[i].pde & PG_VALID) {
+			ntables++;
+		}
+	}
+	frames = malloc(memsize * sizeof(struct frame));
+	tables = malloc((ntables ? ntables : 1) * SNAP_PGTBL_SIZE);
+	memcpy(frames, coremap, memsize * sizeof(struct frame));
+	for (i = 0; i < memsize; i++) {
+		frames[i].pte = (pgtbl_entry_t *)PTE_KEY_NONE;
+	}
+	ntables = 0;
+	for (i = 0; i < PTRS_PER_PGDIR; i++) {
+		pgtbl_entry_t *pgtbl;
+		if (!(pgdir[i].pde & PG_VALID)) {
+			continue;
+		}
+		pgtbl = (pgtbl_entry_t *)(pgdir[i].pde & PAGE_MASK);
+		SNAP_PGTBL(tables, ntables)->dir_idx = i;
+		memcpy(SNAP_PGTBL(tables, ntables)->entries, pgtbl,
+		       PTRS_PER_PGTBL * sizeof(pgtbl_entry_t));
+		ntables++;
+		for (j = 0; j < PTRS_PER_PGTBL; j++) {
+			if (pgtbl[j].frame & PG_VALID) {
+				unsigned frame = pgtbl[j].frame >> PAGE_SHIFT;
+				assert(coremap[frame].pte == &pgtbl[j]);
+				frames[frame].pte = (pgtbl_entry_t *)PTE_KEY(i, j);
+			}
+		}
+	}
+
+	if (snap_write_section(fd, &h, &pos, "coremap", frames,
+			       memsize * sizeof(struct frame)) != 0 ||
+	    snap_write_section(fd, &h, &pos, "physmem", physmem,
+			       memsize * SIMPAGESIZE) != 0 ||
+	    snap_write_section(fd, &h, &pos, "pgtables", tables,
+			       ntables * SNAP_PGTBL_SIZE) != 0) {
+		goto out;
+	}
+	for (i = 0; i < num_states; i++) {
+		if (states[i].save != NULL) {
+			states[i].save();
+		}
+		if (snap_write_section(fd, &h, &pos, states[i].name,
+				       states[i].data, states[i].len) != 0) {
+			goto out;
+		}
+	}
+
+	// The swap file goes last; it is copied rather than mapped.
+	assert(h.nsections < SNAP_MAX_SECTIONS);
+	strncpy(h.sec[h.nsections].name, "swapfile", SNAP_NAMELEN - 1);
+	h.sec[h.nsections].off = snap_align(pos);
+	if (swap_copy_out(fd, h.sec[h.nsections].off,
+			  &h.sec[h.nsections].len) != 0) {
+		goto out;
+	}
+	h.nsections++;
+
+	if (pwrite(fd, &h, sizeof(h), 0) != sizeof(h) || fsync(fd) != 0) {
+		perror("snapshot: cannot write header");
+		goto out;
+	}
+	if (rename(tmpname, path) != 0) {
+		perror("snapshot: cannot rename snapshot file");
+		goto out;
+	}
+	ret = 0;
+out:
+	close(fd);
+	if (ret != 0) {
+		unlink(tmpname);
+	}
+	free(frames);
+	free(tables);
+	return ret;
+}
+
+//---------------------------------------------------------------------
+// Resuming
+
+static struct snap_section *snap_find(const char *name) {
+	int i;
+	for (i = 0; i < loaded.nsections; i++) {
+		if (strcmp(loaded.sec[i].name, name) == 0) {
+			return &loaded.sec[i];
+		}
+	}
+	return NULL;
+}
+
+/* Maps a section privately: writes stay in this process. */
+static void *snap_map(struct snap_section *s) {
+	void *p;
+	if (s->len == 0) {
+		return NULL;
+	}
+	p = mmap(NULL, s->len, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		 loaded_fd, s->off);
+	if (p == MAP_FAILED) {
+		perror("snapshot: mmap");
+		exit(1);
+	}
+	return p;
+}
+
+/* Opens a snapshot and returns the configuration it was taken with, so
+ * the caller can size the simulator before calling snapshot_restore.
+ * Returns 0 on success, -1 if the file is not a usable snapshot.
+ */
+int snapshot_open(const char *path, unsigned *mem, unsigned *swap,
+		  int *vabits, char *alg, size_t alglen) {
+	if ((loaded_fd = open(path, O_RDONLY)) < 0) {
+		perror("snapshot: cannot open snapshot file");
+		return -1;
+	}
+	if (pread(loaded_fd, &loaded, sizeof(loaded), 0) != sizeof(loaded) ||
+	    loaded.magic != SNAP_MAGIC) {
+		fprintf(stderr, "snapshot: %s is not a snapshot file\n", path);
+		return -1;
+	}
+	if (loaded.version != SNAP_VERSION) {
+		fprintf(stderr, "snapshot: unsupported snapshot version %u\n",
+			loaded.version);
+		return -1;
+	}
+	*mem = loaded.memsize;
+	*vabits = loaded.vabits;
+	*swap = loaded.swapsize;
+	strncpy(alg, loaded.alg, alglen - 1);
+	alg[alglen - 1] = '\0';
+	return 0;
+}
+
+/* Replaces the freshly initialized simulator state with the one from the
+ * snapshot opened by snapshot_open.  Must be called after the replacement
+ * algorithm's init function.  Returns the tracefile offset to resume at,
+ * or -1 on failure.
+ */
+long snapshot_restore(void) {
+	struct snap_section *s;
+	struct snap_pgtbl *tables;
+	int i, ntables;
+
+	s = snap_find("pgtables");
+	if (s == NULL || snap_find("coremap") == NULL ||
+	    snap_find("physmem") == NULL || snap_find("swapfile") == NULL) {
+		fprintf(stderr, "snapshot: missing core state\n");
+		return -1;
+	}
+
+	// Page tables are rebuilt in freshly allocated (aligned) memory.
+	tables = snap_map(s);
+	ntables = s->len / SNAP_PGTBL_SIZE;
+	for (i = 0; i < ntables; i++) {
+		struct snap_pgtbl *t = SNAP_PGTBL(tables, i);
+		pgtbl_entry_t *pgtbl;
+		pgdir[t->dir_idx] = init_second_level();
+		pgtbl = (pgtbl_entry_t *)(pgdir[t->dir_idx].pde & PAGE_MASK);
+		memcpy(pgtbl, t->entries, PTRS_PER_PGTBL * sizeof(pgtbl_entry_t));
+	}
+	if (tables != NULL) {
+		munmap(tables, s->len);
+	}
+
+	// The coremap and physmem are used in place, copy-on-write.
+	free(coremap);
+	free(physmem);
+	coremap = snap_map(snap_find("coremap"));
+	physmem = snap_map(snap_find("physmem"));
+	mapped_coremap = snap_find("coremap")->len;
+	mapped_physmem = snap_find("physmem")->len;
+	for (i = 0; i < memsize; i++) {
+		unsigned long key = (unsigned long)coremap[i].pte;
+		if (key == PTE_KEY_NONE) {
+			coremap[i].pte = NULL;
+		} else {
+			pgtbl_entry_t *pgtbl = (pgtbl_entry_t *)
+				(pgdir[PTE_KEY_DIR(key)].pde & PAGE_MASK);
+			coremap[i].pte = &pgtbl[PTE_KEY_TBL(key)];
+		}
+	}
+
+	for (i = 0; i < num_states; i++) {
+		s = snap_find(states[i].name);
+		if (s == NULL || s->len != states[i].len) {
+			fprintf(stderr, "snapshot: state '%s' missing or of the wrong size\n",
+				states[i].name);
+			return -1;
+		}
+		if (pread(loaded_fd, states[i].data, s->len, s->off) != s->len) {
+			perror("snapshot: cannot read state");
+			return -1;
+		}
+		if (states[i].restore != NULL) {
+			states[i].restore();
+		}
+	}
+
+	s = snap_find("swapfile");
+	if (swap_copy_in(loaded_fd, s->off, s->len) != 0) {
+		return -1;
+	}
+
+	hit_count = loaded.hit_count;
+	miss_count = loaded.miss_count;
+	ref_count = loaded.ref_count;
+	evict_clean_count = loaded.evict_clean_count;
+	evict_dirty_count = loaded.evict_dirty_count;
+	clean_write_count = loaded.clean_write_count;
+	clean_saved_count = loaded.clean_saved_count;
+
+	return loaded.trace_off;
+}
@@ -5,6 +5,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/uio.h>
 #include "pagetable.h"
 #include "sim.h"
 
@@ -20,6 +21,9 @@
 
 #define DIVROUNDUP(a,b) (((a)+(b)-1)/(b))
 
+// Most slots coalesced into one vectored write
+#define SWAP_IOV_MAX 64
+
 struct bitmap {
         unsigned nbits;
         unsigned *v;
@@ -148,6 +152,10 @@ static int swapfd;
 static struct bitmap *swapmap;
 static char *fname;
 
+// Number of page table entries referring to each slot; slots are shared
+// by processes forked while the page was on swap
+static unsigned short *swaprefs;
+
 int swap_init(unsigned swapsize) {
 
 	// Initialize the swap file
@@ -163,6 +171,14 @@ int swap_init(unsigned swapsize) {
 		fprintf(stderr,"Failed to create bitmap for swap\n");
 		exit(1);
 	}
+	snapshot_register("swapmap", swapmap->v,
+			  DIVROUNDUP(swapsize, BITS_PER_WORD)*sizeof(unsigned));
+
+	if ((swaprefs = calloc(swapsize, sizeof(unsigned short))) == NULL) {
+		fprintf(stderr,"Failed to create reference counts for swap\n");
+		exit(1);
+	}
+	snapshot_register("swaprefs", swaprefs, swapsize * sizeof(unsigned short));
 
 	return 0;
 }
@@ -173,11 +189,91 @@ void swap_destroy() {
 	close(swapfd);
 	unlink(fname);
 
+	free(fname);
+
 	// Destroy bitmap
 	bitmap_destroy(swapmap);
+	free(swaprefs);
 	return;
 }
 
+// Add a reference to the slot at 'swap_offset', for a page table entry
+// that now shares it.
+//
+void swap_dup(int swap_offset) {
+	unsigned idx = swap_offset / SIMPAGESIZE;
+
+	assert(swaprefs[idx] > 0 && swaprefs[idx] < 0xffff);
+	swaprefs[idx]++;
+}
+
+// Drop a reference to the slot at 'swap_offset'; the slot is freed with
+// the last one.
+//
+void swap_free(int swap_offset) {
+	unsigned idx = swap_offset / SIMPAGESIZE;
+
+	assert(swaprefs[idx] > 0);
+	if (--swaprefs[idx] == 0) {
+		bitmap_unmark(swapmap, idx);
+		zswap_invalidate(swap_offset);
+	}
+}
+
+// Number of page table entries referring to the slot at 'swap_offset'
+int swap_refcount(int swap_offset) {
+	return swaprefs[swap_offset / SIMPAGESIZE];
+}
+
+// Number of pages the swap file can hold
+unsigned swap_size() {
+	return swapmap->nbits;
+}
+
+// Copy the whole swap file into file 'fd' at 'off' (for snapshots).
+// Return: 0 on success, -1 on failure; *len is set to the bytes copied
+//
+int swap_copy_out(int fd, off_t off, size_t *len) {
+	char buf[65536];
+	ssize_t n;
+	off_t pos = 0;
+
+	while ((n = pread(swapfd, buf, sizeof(buf), pos)) > 0) {
+		if (pwrite(fd, buf, n, off + pos) != n) {
+			perror("swap_copy_out: write failed");
+			return -1;
+		}
+		pos += n;
+	}
+	if (n < 0) {
+		perror("swap_copy_out: read failed");
+		return -1;
+	}
+	*len = pos;
+	return 0;
+}
+
+// Replace the swap file contents with 'len' bytes read from file 'fd' at
+// 'off' (when resuming from a snapshot).
+// Return: 0 on success, -1 on failure
+//
+int swap_copy_in(int fd, off_t off, size_t len) {
+	char buf[65536];
+	ssize_t n;
+	size_t pos = 0;
+
+	while (pos < len) {
+		size_t chunk = len - pos < sizeof(buf) ? len - pos : sizeof(buf);
+		if ((n = pread(fd, buf, chunk, off + pos)) <= 0 ||
+		    pwrite(swapfd, buf, n, pos) != n) {
+			perror("swap_copy_in: copy failed");
+			return -1;
+		}
+		pos += n;
+	}
+	return 0;
+}
+
 // Read data into (simulated) physical memory 'frame' from 'swap_offset'
 // in swap file.
 // Input:  frame - the physical frame number (not byte offset) in physmem
@@ -195,6 +291,11 @@ int swap_pagein(unsigned frame, int swap_offset) {
 	// Get pointer to page data in (simulated) physical memory
 	frame_ptr = &physmem[frame * SIMPAGESIZE];
 
+	// The compressed tier may still hold it
+	if (zswap_load(swap_offset, frame_ptr)) {
+		return 0;
+	}
+
 	// Seek to position in swap file where this page was stored
 	pos = lseek(swapfd, swap_offset, SEEK_SET);
 	if (pos != swap_offset) {
@@ -232,12 +333,18 @@ int swap_pageout(unsigned frame, int swap_offset) {
 			return INVALID_SWAP;
 		}
 		swap_offset = idx*SIMPAGESIZE;
+		swaprefs[idx] = 1;
 	}
 	assert(swap_offset != INVALID_SWAP);
 
 	// Get pointer to page data in (simulated) physical memory
 	frame_ptr = &physmem[frame * SIMPAGESIZE];
 
+	// Only go to the file if the compressed tier does not take it
+	if (zswap_store(swap_offset, frame_ptr)) {
+		return swap_offset;
+	}
+
 	// Seek to position in swap file where this page will be stored
 	pos = lseek(swapfd, swap_offset, SEEK_SET);
 	if (pos != swap_offset) {
@@ -254,3 +361,105 @@ int swap_pageout(unsigned frame, int swap_offset) {
 	}
 	return swap_offset;
 }
+
+// Write a batch of (simulated) physical memory frames to swap.
+// Slots are allocated as in swap_pageout, and frames the compressed tier
+// takes are not written to the file.  The other writes are issued in
+// swap offset order, with adjacent slots coalesced into a single pwritev.
+// Input:  frames - the physical frame numbers to write
+//         swap_offsets - current swap offset of each frame, or INVALID_SWAP;
+//                        updated in place with the offset written to
+//         n - number of frames
+// Return: 0 on success, or -1 on failure.  On failure, the slots this call
+//         allocated are freed again and their offsets reset to INVALID_SWAP,
+//         since the caller records none of them.
+//
+struct swap_write {
+	int offset;
+	unsigned frame;
+};
+
+static int swap_write_cmp(const void *a, const void *b) {
+	const struct swap_write *x = a, *y = b;
+	return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+// Give back the slots a failed batch allocated: fresh[0..nfresh) index
+// swap_offsets
+static void swap_unreserve(int *swap_offsets, const int *fresh, int nfresh) {
+	int i;
+
+	for (i = 0; i < nfresh; i++) {
+		swap_free(swap_offsets[fresh[i]]);
+		swap_offsets[fresh[i]] = INVALID_SWAP;
+	}
+}
+
+int swap_pageout_batch(unsigned *frames, int *swap_offsets, int n) {
+	struct swap_write *writes;
+	struct iovec iov[SWAP_IOV_MAX];
+	unsigned idx;
+	int *fresh;
+	int i, j, cnt, nwrites, nfresh;
+	ssize_t bytes_written;
+
+	writes = malloc(n * sizeof(struct swap_write));
+	fresh = malloc(n * sizeof(int));
+	nwrites = nfresh = 0;
+	for (i = 0; i < n; i++) {
+		if (swap_offsets[i] == INVALID_SWAP) {
+			if (bitmap_alloc(swapmap, &idx) != 0) {
+				fprintf(stderr,"swap_pageout_batch: Could not allocate space in swapfile. Try running again with a larger swapsize.\n");
+				swap_unreserve(swap_offsets, fresh, nfresh);
+				free(writes);
+				free(fresh);
+				return -1;
+			}
+			swap_offsets[i] = idx*SIMPAGESIZE;
+			swaprefs[idx] = 1;
+			fresh[nfresh++] = i;
+		}
+		if (zswap_store(swap_offsets[i], &physmem[frames[i] * SIMPAGESIZE])) {
+			continue;
+		}
+		writes[nwrites].offset = swap_offsets[i];
+		writes[nwrites].frame = frames[i];
+		nwrites++;
+	}
+	qsort(writes, nwrites, sizeof(struct swap_write), swap_write_cmp);
+
+	for (i = 0; i < nwrites; i = j) {
+		// Gather the run of adjacent slots starting at writes[i]
+		cnt = 0;
+		for (j = i; j < nwrites && cnt < SWAP_IOV_MAX; j++, cnt++) {
+			if (j > i && writes[j].offset != writes[j-1].offset + SIMPAGESIZE) {
+				break;
+			}
+			iov[cnt].iov_base = &physmem[writes[j].frame * SIMPAGESIZE];
+			iov[cnt].iov_len = SIMPAGESIZE;
+		}
+		bytes_written = pwritev(swapfd, iov, cnt, writes[i].offset);
+		if (bytes_written != cnt * SIMPAGESIZE) {
+			fprintf(stderr,"swap_pageout_batch: did not write whole batch\n");
+			swap_unreserve(swap_offsets, fresh, nfresh);
+			free(writes);
+			free(fresh);
+			return -1;
+		}
+	}
+	free(writes);
+	free(fresh);
+	return 0;
+}
+
+// Write one page of data straight to the swap file at 'swap_offset'
+// (used by the compressed tier for writeback).
+// Return: 0 on success, -1 on failure
+//
+int swap_write_slot(int swap_offset, const char *data) {
+	if (pwrite(swapfd, data, SIMPAGESIZE, swap_offset) != SIMPAGESIZE) {
+		perror("swap_write_slot");
+		return -1;
+	}
+	return 0;
+}
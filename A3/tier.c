@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "pagetable.h"
+
+/* Tiered memory: the frames are split into a fast tier (the first
+ * tier_fast_frames frames) and a slow tier (the rest), each with its own
+ * access latency.
+ *
+ * Every TIER_EPOCH references the tiering policy samples and clears the
+ * PG_REF bits that find_physpage sets in each resident page's table entries,
+ * and shifts it into an 8-bit heat history per frame.  It then promotes
+ * the hottest slow-tier pages and demotes the coldest fast-tier pages, in
+ * pairs and only while the slow page is hotter, up to TIER_MIGRATE_MAX
+ * pairs per epoch.
+ *
+ * Migrating a pair exchanges the tier attribute of the two frames rather
+ * than the pages in them: the frames keep their numbers, so the
+ * replacement algorithms are not disturbed, and each tier keeps its size.
+ * The cost is accounted as two page copies.
+ */
+
+unsigned tier_fast_frames = 0;      // 0 = tiering disabled
+unsigned tier_fast_ns = 80;
+unsigned tier_slow_ns = 250;
+struct tier_stats tier_stats;
+
+#define TIER_EPOCH 1000
+#define TIER_MIGRATE_MAX 64
+
+static int *slow_cand, *fast_cand;
+
+static int heat_desc(const void *a, const void *b) {
+	return coremap[*(const int *)b].tier_heat - coremap[*(const int *)a].tier_heat;
+}
+
+static int heat_asc(const void *a, const void *b) {
+	return coremap[*(const int *)a].tier_heat - coremap[*(const int *)b].tier_heat;
+}
+
+static void tier_epoch() {
+	int nslow = 0, nfast = 0;
+	int i;
+
+	for (i = 0; i < memsize; i++) {
+		struct frame *f = &coremap[i];
+		if (!f->in_use) {
+			continue;
+		}
+		f->tier_heat >>= 1;
+		if (frame_clear_ref(i)) {
+			f->tier_heat |= 0x80;
+		}
+		if (f->tier == TIER_SLOW) {
+			if (f->tier_heat != 0) {
+				slow_cand[nslow++] = i;
+			}
+		} else {
+			fast_cand[nfast++] = i;
+		}
+	}
+	if (nslow == 0 || nfast == 0) {
+		return;
+	}
+
+	qsort(slow_cand, nslow, sizeof(int), heat_desc);
+	qsort(fast_cand, nfast, sizeof(int), heat_asc);
+	for (i = 0; i < nslow && i < nfast && i < TIER_MIGRATE_MAX; i++) {
+		struct frame *hot = &coremap[slow_cand[i]];
+		struct frame *cold = &coremap[fast_cand[i]];
+		if (hot->tier_heat <= cold->tier_heat) {
+			break;
+		}
+		hot->tier = TIER_FAST;
+		cold->tier = TIER_SLOW;
+		tier_stats.promotions++;
+		tier_stats.demotions++;
+	}
+}
+
+/* Account for 'count' references to 'frame'; called by find_physpage for
+ * every reference once the page is resident.
+ */
+void tier_access(int frame, unsigned count) {
+	tier_stats.accesses[(int)coremap[frame].tier] += count;
+	// an epoch ends within the references just counted
+	if (ref_count % TIER_EPOCH < count) {
+		tier_epoch();
+	}
+}
+
+void tier_init(void) {
+	int i;
+
+	if (tier_fast_frames == 0) {
+		return;
+	}
+	if (tier_fast_frames >= memsize) {
+		fprintf(stderr, "Error: the fast tier (%u frames) must be smaller than memory\n",
+			tier_fast_frames);
+		exit(1);
+	}
+	for (i = 0; i < memsize; i++) {
+		coremap[i].tier = i < tier_fast_frames ? TIER_FAST : TIER_SLOW;
+		coremap[i].tier_heat = 0;
+	}
+	free(slow_cand);
+	free(fast_cand);
+	slow_cand = malloc(memsize * sizeof(int));
+	fast_cand = malloc(memsize * sizeof(int));
+	memset(&tier_stats, 0, sizeof(tier_stats));
+	snapshot_register("tier", &tier_stats, sizeof(tier_stats));
+}
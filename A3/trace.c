@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "trace.h"
+
+/* The reader works on large read() chunks and parses lines in place with
+ * a hand-written hex parser; fgets + sscanf cost several times more than
+ * the simulation of a reference itself.
+ */
+
+int trace_open(struct trace *t, const char *path) {
+	memset(t, 0, sizeof(*t));
+	if (path == NULL) {
+		t->fd = STDIN_FILENO;
+	} else if ((t->fd = open(path, O_RDONLY)) < 0) {
+		return -1;
+	}
+	if ((t->buf = malloc(TRACE_BUFSIZE + 1)) == NULL) {
+		if (path != NULL) {
+			close(t->fd);
+		}
+		return -1;
+	}
+	t->buf[0] = '\n';
+	return 0;
+}
+
+void trace_close(struct trace *t) {
+	if (t->fd != STDIN_FILENO) {
+		close(t->fd);
+	}
+	free(t->buf);
+	t->buf = NULL;
+}
+
+// Move the unread tail of the buffer to the front and read more after it.
+// The buffer always ends with a '\n' sentinel at buf[len], so the parser
+// never has to check for its end.
+static void trace_fill(struct trace *t) {
+	ssize_t n;
+
+	memmove(t->buf, t->buf + t->pos, t->len - t->pos);
+	t->base += t->pos;
+	t->len -= t->pos;
+	t->pos = 0;
+	while (!t->eof && t->len < TRACE_BUFSIZE) {
+		n = read(t->fd, t->buf + t->len, TRACE_BUFSIZE - t->len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			t->eof = 1;
+			break;
+		}
+		t->len += n;
+		if (t->len >= TRACE_MAXLINE) {
+			break;
+		}
+	}
+	t->buf[t->len] = '\n';
+}
+
+static const signed char hexval[256] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+// Parse a line starting at *pp, leaving *pp where parsing stopped (at
+// the latest, the line's '\n').  Return: 1 if it holds a reference
+static int trace_parse(const char **pp, struct trace_ref *r) {
+	const unsigned char *p = (const unsigned char *)*pp;
+	unsigned long addr = 0;
+	unsigned size = 0, count = 0;
+	const unsigned char *digits;
+	int ok = 0;
+
+	while (*p == ' ') {
+		p++;
+	}
+	switch (*p) {
+	case 'I': case 'L': case 'S': case 'M':
+	case 'F': case 'P': case 'X': case 'G':
+		r->type = *p++;
+		break;
+	default:
+		goto out;
+	}
+	while (*p == ' ') {
+		p++;
+	}
+	for (digits = p; hexval[*p]; p++) {
+		addr = (addr << 4) | (hexval[*p] - 1);
+	}
+	if (p == digits) {
+		goto out;
+	}
+	if (*p == ',') {
+		for (p++; *p >= '0' && *p <= '9'; p++) {
+			size = size * 10 + (*p - '0');
+		}
+	}
+	while (*p == ' ') {
+		p++;
+	}
+	if (*p == '*') {
+		for (p++; *p >= '0' && *p <= '9'; p++) {
+			count = count * 10 + (*p - '0');
+		}
+	}
+	r->addr = addr;
+	r->size = size;
+	r->count = count ? count : 1;
+	ok = 1;
+out:
+	*pp = (const char *)p;
+	return ok;
+}
+
+int trace_next(struct trace *t, struct trace_ref *r) {
+	for (;;) {
+		const char *p;
+		char *nl;
+		int ok;
+
+		if (t->len - t->pos < TRACE_MAXLINE && !t->eof) {
+			trace_fill(t);
+		}
+		if (t->pos >= t->len) {
+			return 0;
+		}
+		p = t->buf + t->pos;
+		ok = *p != '=' && trace_parse(&p, r);
+		// the sentinel guarantees a newline
+		nl = memchr(p, '\n', t->buf + t->len + 1 - p);
+		t->pos = nl + 1 - t->buf;
+		if (t->pos > t->len) {
+			t->pos = t->len;
+		}
+		if (ok) {
+			return 1;
+		}
+	}
+}
+
+int trace_vabits(struct trace *t) {
+	static const char tag[] = "=vabits ";
+	int bits = 0;
+	size_t i;
+
+	if (t->len - t->pos < TRACE_MAXLINE && !t->eof) {
+		trace_fill(t);
+	}
+	if (t->len - t->pos < sizeof(tag) - 1 ||
+	    memcmp(t->buf + t->pos, tag, sizeof(tag) - 1) != 0) {
+		return 0;
+	}
+	for (i = t->pos + sizeof(tag) - 1; t->buf[i] >= '0' && t->buf[i] <= '9'; i++) {
+		bits = bits * 10 + (t->buf[i] - '0');
+	}
+	return bits;
+}
+
+long trace_tell(struct trace *t) {
+	return t->base + t->pos;
+}
+
+int trace_seek(struct trace *t, long off) {
+	if (lseek(t->fd, off, SEEK_SET) != off) {
+		return -1;
+	}
+	t->base = off;
+	t->pos = t->len = 0;
+	t->eof = 0;
+	t->buf[0] = '\n';
+	return 0;
+}
@@ -0,0 +1,60 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+/* Buffered reader for reference traces, shared by sim, the opt algorithm
+ * and cachesim.  It accepts both the reduced traces sim is usually run on
+ * ("L 7ff000", one page per line) and raw valgrind lackey output
+ * ("I  0400d7d4,8" / " S 7ff000398,8").  Lines starting with '=' and
+ * lines that do not parse as a reference are skipped.  A trace may start
+ * with a "=vabits N" line giving the width of its addresses.
+ *
+ * Traces for sim may also contain events: the process events "F pid"
+ * (fork), "P pid" (switch) and "X pid" (exit), and "G n", which charges
+ * the following references to memory-limit group n.  The number is in
+ * hex; events are returned like references, with it as the address.
+ *
+ * A reference may end in "*N" (decimal), standing for N consecutive
+ * references to its page; tracerle writes such traces.  Only sim makes
+ * use of the count.
+ */
+
+#define TRACE_BUFSIZE (1 << 20)
+#define TRACE_MAXLINE 256    // longer lines may be split in two
+
+struct trace {
+	int fd;
+	char *buf;
+	size_t pos;          // next unread byte in buf
+	size_t len;          // valid bytes in buf
+	long base;           // file offset of buf[0]
+	int eof;
+};
+
+struct trace_ref {
+	char type;           // 'I', 'L', 'S' or 'M', or an event type
+	unsigned long addr;  // or the pid or group, for an event
+	unsigned size;       // bytes accessed, 0 if the trace does not say
+	unsigned count;      // references the line stands for, at least 1
+};
+
+// Open the trace in 'path', or standard input if path is NULL.
+// Return: 0 on success, -1 (with errno set) on failure
+extern int trace_open(struct trace *t, const char *path);
+extern void trace_close(struct trace *t);
+
+// Read the next reference.  Return: 1 if one was read, 0 at end of trace
+extern int trace_next(struct trace *t, struct trace_ref *r);
+
+// Nonzero if a trace_ref of this type is an event rather than a reference
+#define TRACE_IS_EVENT(type) \
+	((type) == 'F' || (type) == 'P' || (type) == 'X' || (type) == 'G')
+
+// Address width from the trace's "=vabits N" header, or 0 if it has none.
+// Only valid before the first trace_next.
+extern int trace_vabits(struct trace *t);
+
+// Offset of the next unread line, and repositioning to such an offset
+extern long trace_tell(struct trace *t);
+extern int trace_seek(struct trace *t, long off);
+
+#endif /* __TRACE_H__ */
@@ -0,0 +1,287 @@
+/* File:     mmbench.c
+ *
+ * Purpose:  Matrix multiply benchmark with several kernels (see mmkern.h):
+ *             naive       i-j-k dot products
+ *             blocked     tiled i-k-j, bs x bs tiles
+ *             transposed  dot products against a transposed copy of B
+ *             avx2        blocked, with an AVX2/FMA 4 x 8 micro-kernel
+ *                         (only on CPUs that have both)
+ *           Each kernel is run several times; the best time gives the
+ *           GFLOP/s (2 n^3 floating point operations per multiply).  Each
+ *           result is checked against the naive one.
+ *
+ * Compile:  gcc -Wall -g -O2 -o mmbench mmbench.c
+ * Run:      ./mmbench [-n order] [-b tile] [-r repeats] [-v variant]... [-t]
+ *
+ * Output:   One line per kernel: best and median time, GFLOP/s and the
+ *           largest difference from the naive result.  With -t, each kernel
+ *           is also run once more with every load and store recorded, and
+ *           its page reference trace written to tr-mmbench-<variant>.ref,
+ *           with runs of references to one page collapsed as tracerle
+ *           does.  The traces grow with n^3, so use a small order with -t.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "timer.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define MM_HAVE_AVX2
+#endif
+
+#define MAX_REPEATS 100
+#define TRACE_PAGE 4096
+
+typedef void (*kernel_t)(int n, int bs, const double *restrict A,
+		const double *restrict B, double *restrict C, double *restrict T);
+
+/*-------------------------------------------------------------------
+ * The tracer: the current run of references to one page, written out
+ * when a reference goes to another page.
+ */
+static FILE *trace_fp;
+static uintptr_t run_page;
+static unsigned run_count;
+static int run_reads, run_writes;
+
+static void trace_flush(void) {
+	char type;
+
+	if (run_count == 0) {
+		return;
+	}
+	type = run_writes ? (run_reads ? 'M' : 'S') : 'L';
+	if (run_count == 1) {
+		fprintf(trace_fp, "%c %lx\n", type, (unsigned long)run_page);
+	} else {
+		fprintf(trace_fp, "%c %lx *%u\n", type, (unsigned long)run_page, run_count);
+	}
+	run_count = 0;
+}
+
+static void *trace_touch(char type, const void *p) {
+	uintptr_t page = (uintptr_t)p & ~((uintptr_t)TRACE_PAGE - 1);
+
+	if (page != run_page || run_count == UINT32_MAX) {
+		trace_flush();
+		run_page = page;
+		run_reads = run_writes = 0;
+	}
+	run_count++;
+	run_reads |= type != 'S';
+	run_writes |= type != 'L';
+	return (void *)p;
+}
+
+/*-------------------------------------------------------------------
+ * The kernels, once as they are timed and once traced.
+ */
+#define KERNEL(name) name
+#define LD(p) (*(p))
+#define ST(p, v) (*(p) = (v))
+#define UPD(p, v) (*(p) += (v))
+#define VLD(p) (p)
+#define VST(p) (p)
+#include "mmkern.h"
+#undef KERNEL
+#undef LD
+#undef ST
+#undef UPD
+#undef VLD
+#undef VST
+
+#define KERNEL(name) name##_traced
+#define LD(p) (*(const double *)trace_touch('L', (p)))
+#define ST(p, v) (*(double *)trace_touch('S', (p)) = (v))
+#define UPD(p, v) (*(double *)trace_touch('M', (p)) += (v))
+#define VLD(p) ((const double *)trace_touch('L', (p)))
+#define VST(p) ((double *)trace_touch('S', (p)))
+#include "mmkern.h"
+
+static int always(void) {
+	return 1;
+}
+
+#ifdef MM_HAVE_AVX2
+static int have_avx2(void) {
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+#endif
+
+struct variant {
+	const char *name;
+	kernel_t run;
+	kernel_t traced;
+	int (*available)(void);
+	int selected;
+};
+
+static struct variant variants[] = {
+	{"naive", naive, naive_traced, always},
+	{"blocked", blocked, blocked_traced, always},
+	{"transposed", transposed, transposed_traced, always},
+#ifdef MM_HAVE_AVX2
+	{"avx2", avx2, avx2_traced, have_avx2},
+#endif
+};
+static const int nvariants = sizeof(variants) / sizeof(variants[0]);
+
+/*-------------------------------------------------------------------*/
+static double *alloc_matrix(int n) {
+	size_t bytes = ((size_t)n * n * sizeof(double) + 63) & ~(size_t)63;
+	double *m = aligned_alloc(64, bytes);
+
+	if (m == NULL) {
+		fprintf(stderr, "Can't allocate storage!\n");
+		exit(1);
+	}
+	return m;
+}
+
+static int cmp_double(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static double max_diff(const double *X, const double *Y, int n) {
+	double d = 0.0;
+	int i;
+
+	for (i = 0; i < n*n; i++) {
+		if (fabs(X[i] - Y[i]) > d) {
+			d = fabs(X[i] - Y[i]);
+		}
+	}
+	return d;
+}
+
+// Runs v once with tracing, into tr-mmbench-<name>.ref
+static int write_trace(struct variant *v, int n, int bs, const double *A,
+		       const double *B, double *C, double *T) {
+	char path[64];
+
+	snprintf(path, sizeof(path), "tr-mmbench-%s.ref", v->name);
+	if ((trace_fp = fopen(path, "w")) == NULL) {
+		perror(path);
+		return -1;
+	}
+	fprintf(trace_fp, "=vabits 48\n");
+	run_count = 0;
+	v->traced(n, bs, A, B, C, T);
+	trace_flush();
+	if (fclose(trace_fp) != 0) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+static void usage(char *prog) {
+	int i;
+
+	fprintf(stderr, "usage:  %s [-n order] [-b tile] [-r repeats] [-v variant]... [-t]\n",
+		prog);
+	fprintf(stderr, "   variants:");
+	for (i = 0; i < nvariants; i++) {
+		fprintf(stderr, " %s", variants[i].name);
+	}
+	fprintf(stderr, "\n   -t also writes a page reference trace per variant\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	int n = 512, bs = 64, reps = 5, tracing = 0, any = 0;
+	double times[MAX_REPEATS];
+	double *A, *B, *C, *T, *ref;
+	int opt, i, r;
+
+	while ((opt = getopt(argc, argv, "n:b:r:v:t")) != -1) {
+		switch (opt) {
+		case 'n':
+			n = strtol(optarg, NULL, 10);
+			break;
+		case 'b':
+			bs = strtol(optarg, NULL, 10);
+			break;
+		case 'r':
+			reps = strtol(optarg, NULL, 10);
+			break;
+		case 'v':
+			for (i = 0; i < nvariants; i++) {
+				if (strcmp(optarg, variants[i].name) == 0) {
+					variants[i].selected = any = 1;
+					break;
+				}
+			}
+			if (i == nvariants) {
+				usage(argv[0]);
+			}
+			break;
+		case 't':
+			tracing = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (n < 1 || bs < 1 || reps < 1 || reps > MAX_REPEATS || optind != argc) {
+		usage(argv[0]);
+	}
+
+	A = alloc_matrix(n);
+	B = alloc_matrix(n);
+	C = alloc_matrix(n);
+	T = alloc_matrix(n);
+	ref = alloc_matrix(n);
+	srand48(1);
+	for (i = 0; i < n*n; i++) {
+		A[i] = drand48();
+		B[i] = drand48();
+	}
+	naive(n, bs, A, B, ref, T);
+
+	printf("n = %d, tile = %d, %d repeats\n", n, bs, reps);
+	printf("%-11s %12s %12s %9s %10s\n", "variant", "best (s)", "median (s)",
+	       "GFLOP/s", "max diff");
+	for (i = 0; i < nvariants; i++) {
+		struct variant *v = &variants[i];
+		double best;
+
+		if (any && !v->selected) {
+			continue;
+		}
+		if (!v->available()) {
+			printf("%-11s (not supported by this CPU)\n", v->name);
+			continue;
+		}
+		for (r = 0; r < reps; r++) {
+			double start, finish;
+			memset(C, 0, (size_t)n * n * sizeof(double));
+			GET_TIME(start);
+			v->run(n, bs, A, B, C, T);
+			GET_TIME(finish);
+			times[r] = finish - start;
+		}
+		qsort(times, reps, sizeof(double), cmp_double);
+		best = times[0];
+		printf("%-11s %12.6f %12.6f %9.2f %10.2e\n", v->name, best,
+		       times[reps / 2], best > 0 ? 2.0 * n * n * n / best / 1e9 : 0.0,
+		       max_diff(C, ref, n));
+		if (tracing && write_trace(v, n, bs, A, B, C, T) != 0) {
+			exit(1);
+		}
+	}
+
+	free(A);
+	free(B);
+	free(C);
+	free(T);
+	free(ref);
+	return 0;
+}
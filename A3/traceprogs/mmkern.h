@@ -0,0 +1,138 @@
+/* File:     mmkern.h
+ *
+ * Purpose:  The matrix multiply kernels of mmbench.  There is deliberately
+ *           no include guard: mmbench.c includes this file twice, once
+ *           with LD/ST/UPD as plain memory accesses, for timing, and once
+ *           with them also recording each access, for its traces.  KERNEL
+ *           gives the two copies different names.
+ *
+ *           All kernels compute C = A * B for n x n row-major matrices;
+ *           bs is the tile size of the blocked kernels.
+ */
+
+// i-j-k: a dot product per element of C, walking B down a column
+static void KERNEL(naive)(int n, int bs, const double *restrict A,
+		const double *restrict B, double *restrict C, double *restrict T) {
+	int i, j, k;
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < n; j++) {
+			double sum = 0.0;
+			for (k = 0; k < n; k++) {
+				sum += LD(&A[i*n + k]) * LD(&B[k*n + j]);
+			}
+			ST(&C[i*n + j], sum);
+		}
+	}
+}
+
+// Tiled i-k-j: each bs x bs tile of B is reused from cache for a whole
+// tile row of A, and the innermost loop runs along rows of B and C
+static void KERNEL(blocked)(int n, int bs, const double *restrict A,
+		const double *restrict B, double *restrict C, double *restrict T) {
+	int ii, jj, kk, i, j, k;
+
+	for (i = 0; i < n*n; i++) {
+		ST(&C[i], 0.0);
+	}
+	for (ii = 0; ii < n; ii += bs) {
+		int ie = ii + bs < n ? ii + bs : n;
+		for (kk = 0; kk < n; kk += bs) {
+			int ke = kk + bs < n ? kk + bs : n;
+			for (jj = 0; jj < n; jj += bs) {
+				int je = jj + bs < n ? jj + bs : n;
+				for (i = ii; i < ie; i++) {
+					for (k = kk; k < ke; k++) {
+						double a = LD(&A[i*n + k]);
+						for (j = jj; j < je; j++) {
+							UPD(&C[i*n + j], a * LD(&B[k*n + j]));
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// B is transposed into T first (and that is timed too), so both factors
+// of every dot product are walked along a row
+static void KERNEL(transposed)(int n, int bs, const double *restrict A,
+		const double *restrict B, double *restrict C, double *restrict T) {
+	int i, j, k;
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < n; j++) {
+			ST(&T[j*n + i], LD(&B[i*n + j]));
+		}
+	}
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < n; j++) {
+			double sum = 0.0;
+			for (k = 0; k < n; k++) {
+				sum += LD(&A[i*n + k]) * LD(&T[j*n + k]);
+			}
+			ST(&C[i*n + j], sum);
+		}
+	}
+}
+
+#ifdef MM_HAVE_AVX2
+/* The blocked i-k-j order with a 4 x 8 register micro-kernel: for each
+ * k in the tile, four broadcasts of A and two 4-wide loads of B feed eight
+ * fused multiply-adds into accumulators that stay in registers for the
+ * whole tile.  Rows and columns that do not fill a micro-tile are done
+ * one element at a time.  A vector access is traced as one access to its
+ * first element.
+ */
+__attribute__((target("avx2,fma")))
+static void KERNEL(avx2)(int n, int bs, const double *restrict A,
+		const double *restrict B, double *restrict C, double *restrict T) {
+	int i, j, k, kk, r;
+	int n4 = n - n % 4, n8 = n - n % 8;
+
+	for (i = 0; i < n*n; i++) {
+		ST(&C[i], 0.0);
+	}
+	for (kk = 0; kk < n; kk += bs) {
+		int ke = kk + bs < n ? kk + bs : n;
+		for (i = 0; i < n4; i += 4) {
+			for (j = 0; j < n8; j += 8) {
+				__m256d c[4][2];
+				for (r = 0; r < 4; r++) {
+					c[r][0] = _mm256_loadu_pd(VLD(&C[(i+r)*n + j]));
+					c[r][1] = _mm256_loadu_pd(VLD(&C[(i+r)*n + j + 4]));
+				}
+				for (k = kk; k < ke; k++) {
+					__m256d b0 = _mm256_loadu_pd(VLD(&B[k*n + j]));
+					__m256d b1 = _mm256_loadu_pd(VLD(&B[k*n + j + 4]));
+					for (r = 0; r < 4; r++) {
+						__m256d a = _mm256_broadcast_sd(VLD(&A[(i+r)*n + k]));
+						c[r][0] = _mm256_fmadd_pd(a, b0, c[r][0]);
+						c[r][1] = _mm256_fmadd_pd(a, b1, c[r][1]);
+					}
+				}
+				for (r = 0; r < 4; r++) {
+					_mm256_storeu_pd(VST(&C[(i+r)*n + j]), c[r][0]);
+					_mm256_storeu_pd(VST(&C[(i+r)*n + j + 4]), c[r][1]);
+				}
+			}
+			for (r = i; r < i + 4; r++) {
+				for (k = kk; k < ke; k++) {
+					double a = LD(&A[r*n + k]);
+					for (j = n8; j < n; j++) {
+						UPD(&C[r*n + j], a * LD(&B[k*n + j]));
+					}
+				}
+			}
+		}
+		for (i = n4; i < n; i++) {
+			for (k = kk; k < ke; k++) {
+				double a = LD(&A[i*n + k]);
+				for (j = 0; j < n; j++) {
+					UPD(&C[i*n + j], a * LD(&B[k*n + j]));
+				}
+			}
+		}
+	}
+}
+#endif
@@ -0,0 +1,558 @@
+/* File:     pagetrace.c
+ *
+ * Purpose:  Page-granularity reference tracer that does not need valgrind.
+ *           It is built as a shared object and preloaded into an unmodified
+ *           program (see runpt).  At startup, and again at every epoch, it
+ *           removes all access rights from the program's heap and data
+ *           regions.  The first load or store to a page in an epoch faults;
+ *           the SIGSEGV handler records the page and gives back just enough
+ *           access (read for a load, read/write for a store) so the program
+ *           continues.  A load followed by a store to the same page is
+ *           therefore recorded as "L" then "S".
+ *
+ * Compile:  gcc -Wall -g -O2 -shared -fPIC -o libpagetrace.so pagetrace.c -ldl
+ * Run:      LD_PRELOAD=./libpagetrace.so ./<program> <args>
+ *
+ * Environment:
+ *   PAGETRACE_OUT       trace file name (default pagetrace.ref)
+ *   PAGETRACE_INTERVAL  epoch length in microseconds of CPU time; every
+ *                       epoch all regions are protected again so repeated
+ *                       references show up in the trace (default 1000,
+ *                       0 records first touches only)
+ *   PAGETRACE_VABITS    number of address bits kept in the trace (default
+ *                       48, enough for any x86-64 user address; sim also
+ *                       has page tables for 32 and 36 bits)
+ *
+ * Output:   A "=vabits <bits>" header, from which sim picks its page table
+ *           geometry, then one "<type> <page address>" line per event, the
+ *           same format fastslim.py produces and sim consumes.
+ *
+ * Notes:
+ * 1.  Code pages are not traced (there is no "I" record); it is the
+ *     equivalent of running fastslim.py without --keepcode.
+ * 2.  Only single-threaded programs are supported: the stacks of other
+ *     threads would look like ordinary anonymous memory.
+ * 3.  A system call handed a protected buffer fails with EFAULT instead of
+ *     faulting, so the regions are made accessible again before the
+ *     program's stdio buffers are flushed at exit.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#define PT_PAGE          4096
+#define PT_PAGE_MASK     (~((uintptr_t)PT_PAGE - 1))
+#define PT_MAX_REGIONS   512
+#define PT_MAX_EXCLUDED  4
+#define PT_BUFSIZE       (1 << 16)
+#define PT_MAPSBUF       (1 << 16)
+#define PT_RESCAN_MIN    (128 * 1024)  // glibc's default mmap threshold
+#define PT_BOOT_ARENA    4096
+
+struct pt_region {
+	uintptr_t start;
+	uintptr_t end;
+};
+
+// Regions being traced, sorted by address (as /proc/self/maps is).
+static struct pt_region regions[PT_MAX_REGIONS];
+static int nregions;
+
+static struct pt_region prev_regions[PT_MAX_REGIONS];
+static int nprev;
+
+// Ranges that must stay accessible, sorted by address.
+static struct pt_region excluded[PT_MAX_EXCLUDED];
+static int nexcluded;
+
+static int active;
+static int outfd = -1;
+static char *outbuf;
+static size_t outlen;
+static uintptr_t addr_mask;
+static long interval_us;
+static unsigned long events, epochs;
+
+static char exe_path[1024];
+static char maps_buf[PT_MAPSBUF];
+static struct sigaction old_segv;
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static char boot_arena[PT_BOOT_ARENA];
+static size_t boot_used;
+static int resolving;
+
+/*-------------------------------------------------------------------
+ * Trace output.  Everything here runs inside signal handlers, so only
+ * async-signal-safe calls (write) are used.
+ */
+static void pt_flush(void) {
+	size_t off = 0;
+	while (off < outlen) {
+		ssize_t n = write(outfd, outbuf + off, outlen - off);
+		if (n <= 0) {
+			break;
+		}
+		off += n;
+	}
+	outlen = 0;
+}
+
+static void pt_emit(char type, uintptr_t page) {
+	char tmp[2 + 16 + 1];
+	int i = sizeof(tmp);
+	uintptr_t v = page & addr_mask;
+
+	tmp[--i] = '\n';
+	do {
+		tmp[--i] = "0123456789abcdef"[v & 0xf];
+		v >>= 4;
+	} while (v != 0);
+	tmp[--i] = ' ';
+	tmp[--i] = type;
+
+	if (outlen + sizeof(tmp) > PT_BUFSIZE) {
+		pt_flush();
+	}
+	memcpy(outbuf + outlen, tmp + i, sizeof(tmp) - i);
+	outlen += sizeof(tmp) - i;
+	events++;
+}
+
+/*-------------------------------------------------------------------
+ * Region discovery.  A mapping is traced if it is writable and private
+ * and is either the program's own data/bss, the brk heap, or anonymous
+ * memory that is not the bss of a shared library (large malloc blocks).
+ * The tracer's own state and the TLS block are carved out of whatever
+ * mapping they end up in (the kernel merges adjacent anonymous mappings),
+ * because the fault handler needs them.
+ */
+static uintptr_t pt_hex(const char **s) {
+	uintptr_t v = 0;
+	for (;; (*s)++) {
+		char c = **s;
+		if (c >= '0' && c <= '9') {
+			v = (v << 4) | (c - '0');
+		} else if (c >= 'a' && c <= 'f') {
+			v = (v << 4) | (c - 'a' + 10);
+		} else {
+			return v;
+		}
+	}
+}
+
+static int pt_contains(uintptr_t start, uintptr_t end, const void *p) {
+	return (uintptr_t)p >= start && (uintptr_t)p < end;
+}
+
+/* Adds [start, end) minus the excluded ranges to regions[]. */
+static int pt_add_region(int n, uintptr_t start, uintptr_t end) {
+	int i;
+	for (i = 0; i < nexcluded && start < end; i++) {
+		if (excluded[i].end <= start || excluded[i].start >= end) {
+			continue;
+		}
+		if (excluded[i].start > start) {
+			n = pt_add_region(n, start, excluded[i].start);
+		}
+		start = excluded[i].end;
+	}
+	if (start >= end) {
+		return n;
+	}
+	// Pages with different protections are separate mappings; merge
+	// them back so regions[] stays small.
+	if (n > 0 && regions[n - 1].end == start) {
+		regions[n - 1].end = end;
+	} else if (n < PT_MAX_REGIONS) {
+		regions[n].start = start;
+		regions[n].end = end;
+		n++;
+	}
+	return n;
+}
+
+/* Adds the parts of [start, end) that were traced before the rescan.
+ * Protecting pages changes their permissions, so a traced mapping stops
+ * looking like "rw-p" and may be merged with its neighbours.
+ */
+static int pt_add_known(int n, uintptr_t start, uintptr_t end) {
+	int i;
+	for (i = 0; i < nprev; i++) {
+		uintptr_t lo = prev_regions[i].start > start ?
+			prev_regions[i].start : start;
+		uintptr_t hi = prev_regions[i].end < end ?
+			prev_regions[i].end : end;
+		if (lo < hi) {
+			n = pt_add_region(n, lo, hi);
+		}
+	}
+	return n;
+}
+
+/* Re-reads /proc/self/maps into regions[].  With 'all' set, every mapping
+ * is listed as is; otherwise only the traced ones.  Returns the number of
+ * regions.
+ */
+static int pt_scan_maps(int all) {
+	int fd, n = 0;
+	ssize_t len, used = 0;
+	uintptr_t prev_end = 0;
+	int prev_lib = 0;
+
+	if ((fd = open("/proc/self/maps", O_RDONLY)) < 0) {
+		return nregions;
+	}
+	memcpy(prev_regions, regions, nregions * sizeof(regions[0]));
+	nprev = all ? 0 : nregions;
+
+	for (;;) {
+		len = read(fd, maps_buf + used, PT_MAPSBUF - 1 - used);
+		if (len <= 0 && used == 0) {
+			break;
+		}
+		used += len > 0 ? len : 0;
+		maps_buf[used] = '\0';
+
+		char *line = maps_buf;
+		char *nl;
+		while ((nl = strchr(line, '\n')) != NULL) {
+			const char *s = line;
+			uintptr_t start, end;
+			const char *perms, *path;
+			int field;
+
+			*nl = '\0';
+			start = pt_hex(&s);
+			s++;
+			end = pt_hex(&s);
+			s++;
+			perms = s;
+			// skip perms, offset, dev and inode to reach the path
+			for (field = 0; field < 4; field++) {
+				while (*s != ' ' && *s != '\0') s++;
+				while (*s == ' ') s++;
+			}
+			path = s;
+
+			int anon = (*path == '\0');
+			int is_exe = !anon && strcmp(path, exe_path) == 0;
+			int wanted = strncmp(perms, "rw-p", 4) == 0 &&
+				(is_exe || strcmp(path, "[heap]") == 0 ||
+				 (anon && !(prev_lib && prev_end == start)));
+
+			if (all && n < PT_MAX_REGIONS) {
+				regions[n].start = start;
+				regions[n].end = end;
+				n++;
+			} else if (!all && wanted) {
+				n = pt_add_region(n, start, end);
+			} else if (!all && perms[2] != 'x' && perms[3] == 'p') {
+				n = pt_add_known(n, start, end);
+			}
+			// Anonymous memory right after a library is its bss.
+			if (!anon) {
+				prev_lib = !is_exe && path[0] != '[';
+			}
+			prev_end = end;
+			line = nl + 1;
+		}
+		// Keep a partial line for the next read.
+		used = strlen(line);
+		memmove(maps_buf, line, used);
+		if (len <= 0) {
+			break;
+		}
+	}
+	close(fd);
+	nregions = n;
+	return n;
+}
+
+static int pt_scan(void) {
+	return pt_scan_maps(0);
+}
+
+static int pt_tracked(uintptr_t addr) {
+	int lo = 0, hi = nregions - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (addr < regions[mid].start) {
+			hi = mid - 1;
+		} else if (addr >= regions[mid].end) {
+			lo = mid + 1;
+		} else {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void pt_protect_all(int prot) {
+	int i;
+	for (i = 0; i < nregions; i++) {
+		// The region may have been unmapped since the last scan.
+		mprotect((void *)regions[i].start,
+			 regions[i].end - regions[i].start, prot);
+	}
+}
+
+/*-------------------------------------------------------------------
+ * Signal handlers.
+ */
+static void pt_segv(int sig, siginfo_t *si, void *ctx) {
+	ucontext_t *uc = (ucontext_t *)ctx;
+	uintptr_t addr = (uintptr_t)si->si_addr;
+	int write_fault;
+
+	if (!active || si->si_code != SEGV_ACCERR || !pt_tracked(addr)) {
+		// A genuine crash: let the original disposition handle it
+		// when the faulting instruction is restarted.
+		sigaction(SIGSEGV, &old_segv, NULL);
+		return;
+	}
+
+	// Bit 1 of the x86 page-fault error code is set for writes.
+	write_fault = (uc->uc_mcontext.gregs[REG_ERR] & 0x2) != 0;
+	pt_emit(write_fault ? 'S' : 'L', addr & PT_PAGE_MASK);
+	mprotect((void *)(addr & PT_PAGE_MASK), PT_PAGE,
+		 write_fault ? PROT_READ | PROT_WRITE : PROT_READ);
+}
+
+static void pt_epoch(int sig) {
+	if (!active) {
+		return;
+	}
+	epochs++;
+	pt_scan();
+	pt_protect_all(PROT_NONE);
+}
+
+/*-------------------------------------------------------------------
+ * Allocation hooks.  A large malloc gets its own mapping (and a small
+ * one may grow the heap), which would otherwise go untraced until the
+ * next epoch, so new memory outside the known regions triggers a rescan.
+ */
+static void pt_new_memory(void *p, size_t size) {
+	sigset_t set, old;
+
+	if (!active || p == NULL) {
+		return;
+	}
+	if (size < PT_RESCAN_MIN && pt_tracked((uintptr_t)p) &&
+	    pt_tracked((uintptr_t)p + size - 1)) {
+		return;
+	}
+	sigemptyset(&set);
+	sigaddset(&set, SIGPROF);
+	sigprocmask(SIG_BLOCK, &set, &old);
+	pt_scan();
+	// Only the new block is protected; the rest of the epoch stands.
+	if (pt_tracked((uintptr_t)p) && pt_tracked((uintptr_t)p + size - 1)) {
+		mprotect((void *)((uintptr_t)p & PT_PAGE_MASK),
+			 (uintptr_t)p + size - ((uintptr_t)p & PT_PAGE_MASK),
+			 PROT_NONE);
+	}
+	sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+static void *pt_boot_alloc(size_t size) {
+	void *p;
+	size = (size + 15) & ~(size_t)15;
+	if (boot_used + size > PT_BOOT_ARENA) {
+		return NULL;
+	}
+	p = boot_arena + boot_used;
+	boot_used += size;
+	return p;
+}
+
+static int pt_resolve(void) {
+	if (real_malloc != NULL) {
+		return 1;
+	}
+	if (resolving) {
+		return 0;
+	}
+	// dlsym may allocate, which lands in the boot arena.
+	resolving = 1;
+	real_malloc = dlsym(RTLD_NEXT, "malloc");
+	real_calloc = dlsym(RTLD_NEXT, "calloc");
+	real_realloc = dlsym(RTLD_NEXT, "realloc");
+	real_free = dlsym(RTLD_NEXT, "free");
+	resolving = 0;
+	return 1;
+}
+
+void *malloc(size_t size) {
+	void *p;
+	if (!pt_resolve()) {
+		return pt_boot_alloc(size);
+	}
+	p = real_malloc(size);
+	pt_new_memory(p, size);
+	return p;
+}
+
+void *calloc(size_t nmemb, size_t size) {
+	void *p;
+	if (!pt_resolve()) {
+		return pt_boot_alloc(nmemb * size); // arena is zero-filled
+	}
+	p = real_calloc(nmemb, size);
+	pt_new_memory(p, nmemb * size);
+	return p;
+}
+
+void *realloc(void *ptr, size_t size) {
+	void *p;
+	if (!pt_resolve()) {
+		return NULL;
+	}
+	p = real_realloc(ptr, size);
+	pt_new_memory(p, size);
+	return p;
+}
+
+void free(void *ptr) {
+	if (pt_contains((uintptr_t)boot_arena,
+			(uintptr_t)boot_arena + PT_BOOT_ARENA, ptr)) {
+		return;
+	}
+	if (pt_resolve()) {
+		real_free(ptr);
+	}
+}
+
+/*-------------------------------------------------------------------
+ * Setup and teardown.
+ */
+
+/* Records the mappings that hold the TLS block, the trace buffer and the
+ * tracer's bss, as they are before anything else can be merged into them.
+ */
+static void pt_exclude_self(void) {
+	const void *keep[] = { __builtin_thread_pointer(), outbuf, regions };
+	uintptr_t lo[3], hi[3];
+	int i, j, k, n;
+
+	nexcluded = 0;
+	n = pt_scan_maps(1);
+	for (k = 0; k < 3; k++) {
+		lo[k] = (uintptr_t)keep[k] & PT_PAGE_MASK;
+		hi[k] = lo[k] + PT_PAGE;
+		for (i = 0; i < n; i++) {
+			if (pt_contains(regions[i].start, regions[i].end, keep[k])) {
+				lo[k] = regions[i].start;
+				hi[k] = regions[i].end;
+			}
+		}
+	}
+	nregions = 0;
+	if (hi[1] - lo[1] < PT_BUFSIZE) {
+		hi[1] = lo[1] + PT_BUFSIZE;
+	}
+	// Insertion sort by start address.
+	for (k = 0; k < 3; k++) {
+		for (j = nexcluded; j > 0 && excluded[j - 1].start > lo[k]; j--) {
+			excluded[j] = excluded[j - 1];
+		}
+		excluded[j].start = lo[k];
+		excluded[j].end = hi[k];
+		nexcluded++;
+	}
+}
+__attribute__((constructor))
+static void pt_start(void) {
+	const char *out = getenv("PAGETRACE_OUT");
+	const char *interval = getenv("PAGETRACE_INTERVAL");
+	const char *vabits = getenv("PAGETRACE_VABITS");
+	struct sigaction sa;
+	ssize_t len;
+	int bits;
+
+	pt_resolve();
+	if (out == NULL) {
+		out = "pagetrace.ref";
+	}
+	if ((outfd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		perror("pagetrace: cannot open trace file");
+		return;
+	}
+	outbuf = mmap(NULL, PT_BUFSIZE, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (outbuf == MAP_FAILED) {
+		perror("pagetrace: mmap");
+		return;
+	}
+
+	bits = vabits != NULL ? atoi(vabits) : 48;
+	addr_mask = (bits <= 0 || bits >= 64) ? ~(uintptr_t)0 :
+		((uintptr_t)1 << bits) - 1;
+	if (bits > 0 && bits < 64) {
+		outlen = snprintf(outbuf, PT_BUFSIZE, "=vabits %d\n", bits);
+	}
+	interval_us = interval != NULL ? atol(interval) : 1000;
+
+	if ((len = readlink("/proc/self/exe", exe_path,
+			    sizeof(exe_path) - 1)) > 0) {
+		exe_path[len] = '\0';
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = pt_segv;
+	sa.sa_flags = SA_SIGINFO | SA_RESTART | SA_NODEFER;
+	sigemptyset(&sa.sa_mask);
+	sigaddset(&sa.sa_mask, SIGPROF);
+	sigaction(SIGSEGV, &sa, &old_segv);
+
+	pt_exclude_self();
+	pt_scan();
+	active = 1;
+	pt_protect_all(PROT_NONE);
+
+	if (interval_us > 0) {
+		struct itimerval it;
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = pt_epoch;
+		sa.sa_flags = SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGPROF, &sa, NULL);
+
+		it.it_interval.tv_sec = interval_us / 1000000;
+		it.it_interval.tv_usec = interval_us % 1000000;
+		it.it_value = it.it_interval;
+		setitimer(ITIMER_PROF, &it, NULL);
+	}
+}
+
+__attribute__((destructor))
+static void pt_stop(void) {
+	struct itimerval it;
+
+	if (!active) {
+		return;
+	}
+	memset(&it, 0, sizeof(it));
+	setitimer(ITIMER_PROF, &it, NULL);
+	active = 0;
+	// Give everything back before stdio flushes its buffers.
+	pt_protect_all(PROT_READ | PROT_WRITE);
+	pt_flush();
+	close(outfd);
+	fprintf(stderr, "pagetrace: %lu references, %lu epochs\n",
+		events, epochs);
+}
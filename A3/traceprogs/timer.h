@@ -1,12 +1,15 @@
 #ifndef _TIMER_H_
 #define _TIMER_H_
 
-#include <sys/time.h>
+#include <time.h>
 
+/* Seconds on the monotonic clock, with nanosecond resolution; unlike
+ * gettimeofday it does not jump when the system time is set.
+ */
 #define GET_TIME(now) { \
-   struct timeval t; \
-   gettimeofday(&t, NULL); \
-   now = t.tv_sec + t.tv_usec/1000000.0; \
+   struct timespec t; \
+   clock_gettime(CLOCK_MONOTONIC, &t); \
+   now = t.tv_sec + t.tv_nsec/1000000000.0; \
 }
 
 #endif
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "trace.h"
+
+/* Run-length collapsing of reference traces for sim.
+ *
+ * Lackey traces, instruction fetches above all, come in long runs of
+ * consecutive references to the same page.  All of a run but its first
+ * reference are hits whatever the replacement algorithm, so tracerle
+ * writes each run as a single line with a repeat count ("I 400000 *37",
+ * see trace.h), which sim replays as one page table walk.
+ *
+ * A run is written as a store if any of its references stores: M if it
+ * also reads, S if not; otherwise with the type of its first reference.
+ * Addresses are reduced to their page, as fastslim.py does.  Events end
+ * a run and are copied through.
+ */
+
+#define PAGE_SIZE 4096
+
+struct run {
+	char type;             // of the first reference, 0 if no run
+	unsigned long page;
+	unsigned count;
+	int reads;
+	int writes;
+};
+
+static unsigned long records;
+
+static void run_flush(struct run *r) {
+	char type = r->type;
+
+	if (type == 0) {
+		return;
+	}
+	if (r->writes) {
+		type = r->reads ? 'M' : 'S';
+	}
+	if (r->count == 1) {
+		printf("%c %lx\n", type, r->page);
+	} else {
+		printf("%c %lx *%u\n", type, r->page, r->count);
+	}
+	records++;
+	r->type = 0;
+}
+
+int main(int argc, char *argv[]) {
+	char *usage = "USAGE: tracerle [-p pagesize] [tracefile]\n";
+	unsigned long pagesize = PAGE_SIZE;
+	struct trace tr;
+	struct trace_ref ref;
+	struct run run = { 0 };
+	unsigned long refs = 0;
+	int opt, bits;
+
+	while ((opt = getopt(argc, argv, "p:")) != -1) {
+		switch (opt) {
+		case 'p':
+			pagesize = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "%s", usage);
+			exit(1);
+		}
+	}
+	if (pagesize == 0 || (pagesize & (pagesize - 1)) != 0 || optind + 1 < argc) {
+		fprintf(stderr, "%s", usage);
+		exit(1);
+	}
+	if (trace_open(&tr, optind < argc ? argv[optind] : NULL) != 0) {
+		perror("Error opening tracefile:");
+		exit(1);
+	}
+
+	if ((bits = trace_vabits(&tr)) != 0) {
+		printf("=vabits %d\n", bits);
+	}
+	while (trace_next(&tr, &ref)) {
+		unsigned long page = ref.addr & ~(pagesize - 1);
+
+		if (TRACE_IS_EVENT(ref.type)) {
+			run_flush(&run);
+			printf("%c %lx\n", ref.type, ref.addr);
+			records++;
+			continue;
+		}
+		refs += ref.count;
+		if (run.type == 0 || page != run.page || run.count > UINT_MAX - ref.count) {
+			run_flush(&run);
+			run.type = ref.type;
+			run.page = page;
+			run.count = 0;
+			run.reads = run.writes = 0;
+		}
+		run.count += ref.count;
+		run.reads |= ref.type != 'S';
+		run.writes |= ref.type == 'S' || ref.type == 'M';
+	}
+	run_flush(&run);
+	trace_close(&tr);
+	fprintf(stderr, "%lu references in %lu records\n", refs, records);
+	return 0;
+}
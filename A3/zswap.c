@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "sim.h"
+#include "pagetable.h"
+
+//---------------------------------------------------------------------
+// A compressed swap tier in front of the swap file, modelled on Linux's
+// zswap.
+//
+// Pages on their way to swap are appended to an in-memory pool of
+// zswap_pool_bytes bytes.  The pool is a ring of records, so when it fills
+// up the oldest records are written back to their slots in the swap file
+// (FIFO writeback) to make room.  Pages that would not compress to less
+// than a page bypass the pool.
+//
+// The simulated frames are SIMPAGESIZE bytes of bookkeeping, not page
+// contents, so compressing them says nothing about real pages.  Instead
+// each page is taken to be ZS_PAGE bytes, and its compressed size is
+// drawn uniformly from [zswap_page_bytes / 2, zswap_page_bytes * 3 / 2]
+// by a hash of the frame's data and rand_seed: the same contents always
+// compress alike, a rewritten page draws again, and there is no state to
+// save.  A record takes that many bytes plus its header in the pool, and
+// carries the frame's data in its first SIMPAGESIZE bytes.
+//
+// Swap slots are still allocated from the swap bitmap as before; the pool
+// only decides where the data of a slot currently lives.  Loading a page
+// leaves its record in place, since a page that is evicted again without
+// being dirtied relies on its swap copy; the record dies when the slot is
+// next written.  Dead records are dropped for free when the ring's tail
+// reaches them.
+
+unsigned zswap_pool_bytes = 0;      // pool budget, 0 = tier disabled
+unsigned zswap_page_bytes = ZSWAP_PAGE_BYTES;
+struct zswap_stats zswap_stats;
+
+// Every record starts with this header and is padded to ZS_ALIGN bytes
+struct zs_record {
+	int slot;            // swap slot, or -1 for padding at the end of the ring
+	unsigned short clen; // compressed length of the modelled page
+	unsigned short pad;
+};
+
+#define ZS_PAGE 4096
+#define ZS_ALIGN 8
+#define ZS_RECLEN(clen) \
+	((sizeof(struct zs_record) + (clen) + ZS_ALIGN - 1) & ~(ZS_ALIGN - 1))
+
+static struct {
+	unsigned size;       // pool bytes, a multiple of ZS_ALIGN
+	unsigned head;       // where the next record goes
+	unsigned tail;       // oldest record
+	unsigned used;       // bytes between tail and head, padding included
+	unsigned page_bytes; // zswap_page_bytes the records were sized with
+} zs;
+
+static unsigned char *pool;
+static int *slot_pos;        // per swap slot: offset of its record, or -1
+static unsigned nslots;
+
+// Compressed size of the modelled page whose frame holds 'page'; ZS_PAGE
+// or more means it does not compress
+static unsigned zs_clen(const char *page) {
+	uint64_t z = rand_seed;
+	unsigned lo = zswap_page_bytes / 2;
+	unsigned hi = zswap_page_bytes * 3 / 2;
+	int i;
+
+	for (i = 0; i < SIMPAGESIZE; i++) {
+		z = (z ^ (unsigned char)page[i]) * 0x100000001B3ULL;
+	}
+	// splitmix64's finalizer, to spread the FNV hash over all the bits
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z ^= z >> 31;
+	// multiply-shift onto the range: the high half of z times its size,
+	// as rand_below does, rather than a biased modulo
+	return lo + (unsigned)(((unsigned __int128)z * (hi - lo + 1)) >> 64);
+}
+
+//---------------------------------------------------------------------
+// Pool
+
+// Write the oldest record back to the swap file (if still live) and drop it
+static void zs_drop_tail() {
+	struct zs_record *r = (struct zs_record *)&pool[zs.tail];
+	unsigned len = r->slot < 0 ? zs.size - zs.tail : ZS_RECLEN(r->clen);
+
+	if (r->slot >= 0 && slot_pos[r->slot] == (int)zs.tail) {
+		if (swap_write_slot(r->slot * SIMPAGESIZE, (char *)(r + 1)) != 0) {
+			fprintf(stderr, "zswap: writeback of slot %d failed\n", r->slot);
+			exit(1);
+		}
+		slot_pos[r->slot] = -1;
+		zswap_stats.writebacks++;
+	}
+	zs.tail += len;
+	zs.used -= len;
+	if (zs.tail == zs.size) {
+		zs.tail = 0;
+	}
+}
+
+// Make room for a contiguous record of len bytes at zs.head
+static void zs_reserve(unsigned len) {
+	for (;;) {
+		if (zs.used == 0) {
+			zs.head = zs.tail = 0;
+		}
+		if (zs.head > zs.tail || zs.used == 0) {
+			unsigned room = zs.size - zs.head;
+			if (len <= room) {
+				return;
+			}
+			// Pad out the end of the ring and continue at the start
+			((struct zs_record *)&pool[zs.head])->slot = -1;
+			zs.used += room;
+			zs.head = 0;
+		} else if (zs.head < zs.tail && len <= zs.tail - zs.head) {
+			return;
+		} else {
+			zs_drop_tail();
+		}
+	}
+}
+
+/* Offer the page that is being written to 'swap_offset' to the pool.
+ * Return: 1 if the pool now holds it, 0 if it must be written to the file
+ */
+int zswap_store(int swap_offset, const char *page) {
+	unsigned slot = swap_offset / SIMPAGESIZE;
+	struct zs_record *r;
+	unsigned len;
+	unsigned clen;
+
+	if (zswap_pool_bytes == 0) {
+		return 0;
+	}
+	zswap_stats.pageouts++;
+	slot_pos[slot] = -1;    // any older copy in the pool is stale now
+
+	clen = zs_clen(page);
+	len = ZS_RECLEN(clen);
+	if (clen >= ZS_PAGE || len > zs.size) {
+		zswap_stats.rejects++;
+		return 0;
+	}
+
+	zs_reserve(len);
+	r = (struct zs_record *)&pool[zs.head];
+	r->slot = slot;
+	r->clen = clen;
+	memcpy(r + 1, page, SIMPAGESIZE);
+	slot_pos[slot] = zs.head;
+	zs.head += len;
+	zs.used += len;
+	if (zs.head == zs.size) {
+		zs.head = 0;
+	}
+
+	zswap_stats.stores++;
+	zswap_stats.bytes_in += ZS_PAGE;
+	zswap_stats.bytes_out += len;
+	return 1;
+}
+
+/* Forget any copy of the freed slot 'swap_offset' in the pool; its record
+ * is dropped without writeback when it reaches the tail.
+ */
+void zswap_invalidate(int swap_offset) {
+	if (zswap_pool_bytes != 0) {
+		slot_pos[swap_offset / SIMPAGESIZE] = -1;
+	}
+}
+
+/* Fill 'page' with the data of 'swap_offset' if the pool holds it.
+ * Return: 1 if it did, 0 if the page has to be read from the file
+ */
+int zswap_load(int swap_offset, char *page) {
+	unsigned slot = swap_offset / SIMPAGESIZE;
+	struct zs_record *r;
+
+	if (zswap_pool_bytes == 0) {
+		return 0;
+	}
+	zswap_stats.pageins++;
+	if (slot_pos[slot] < 0) {
+		return 0;
+	}
+	r = (struct zs_record *)&pool[slot_pos[slot]];
+	assert(r->slot == slot);
+	memcpy(page, r + 1, SIMPAGESIZE);
+	zswap_stats.loads++;
+	return 1;
+}
+
+// A snapshot taken with a different pool or page size cannot be resumed
+static void zswap_check_restored() {
+	if (zs.size != (zswap_pool_bytes & ~(ZS_ALIGN - 1)) ||
+	    zs.page_bytes != zswap_page_bytes) {
+		fprintf(stderr, "zswap: snapshot was taken with -z %u:%u\n",
+			zs.size, zs.page_bytes);
+		exit(1);
+	}
+}
+
+void zswap_init(unsigned swapsize) {
+	unsigned i;
+
+	zs.size = zswap_pool_bytes & ~(ZS_ALIGN - 1);
+	zs.head = zs.tail = zs.used = 0;
+	zs.page_bytes = zswap_page_bytes;
+	memset(&zswap_stats, 0, sizeof(zswap_stats));
+	snapshot_register("zswap", &zs, sizeof(zs));
+	snapshot_hooks("zswap", NULL, zswap_check_restored);
+	if (zswap_pool_bytes == 0) {
+		return;
+	}
+	if (zswap_page_bytes < 2 * SIMPAGESIZE || zswap_page_bytes >= ZS_PAGE) {
+		fprintf(stderr, "zswap: compressed page size must be from %d to %d bytes\n",
+			2 * SIMPAGESIZE, ZS_PAGE - 1);
+		exit(1);
+	}
+	if (zs.size < ZS_RECLEN(ZS_PAGE)) {
+		fprintf(stderr, "zswap: pool of %u bytes is too small\n", zswap_pool_bytes);
+		exit(1);
+	}
+
+	nslots = swapsize;
+	free(pool);
+	free(slot_pos);
+	pool = malloc(zs.size);
+	slot_pos = malloc(nslots * sizeof(int));
+	if (pool == NULL || slot_pos == NULL) {
+		perror("zswap_init");
+		exit(1);
+	}
+	for (i = 0; i < nslots; i++) {
+		slot_pos[i] = -1;
+	}
+	snapshot_register("zswap_stats", &zswap_stats, sizeof(zswap_stats));
+	snapshot_register("zswap_pool", pool, zs.size);
+	snapshot_register("zswap_slots", slot_pos, nslots * sizeof(int));
+}
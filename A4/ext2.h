@@ -18,7 +18,7 @@
 #ifndef CSC369_EXT2_FS_H
 #define CSC369_EXT2_FS_H
 
-/* The ext2 block size used in the assignment. */
+/* The smallest ext2 block size; an image's own is in its superblock. */
 #define EXT2_BLOCK_SIZE 1024
 
 /*
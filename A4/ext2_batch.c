@@ -0,0 +1,165 @@
+/*
+	ext2_batch: This program takes one or two command line arguments.
+	The first is the name of an ext2 formatted virtual disk, and the
+	second a script of commands to run on it, one per line; without it,
+	or if it is "-", the commands are read from standard input.
+	The commands are those of the other tools, without the disk image:
+		cp [-r] <native path> <absolute path>
+		mkdir <absolute path>
+		ln [-s] <absolute path> <absolute path>
+		rm <absolute path>
+		restore <absolute path>
+		check
+	Words are separated by blanks; blank lines and lines starting with
+	# are skipped.
+	The image is opened and mapped once, and every command works on the
+	same mapping, so the allocation hints and the state of the image carry
+	over from one command to the next.  A failed command does not stop the
+	script: each prints "<line>: <command>: ok", or the error it would
+	have exited with.  The image is synced once, at the end.  The program
+	exits with 0 if every command succeeded, else with the error of the
+	first one that failed.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "ext2.h"
+#include "ext2_utils.h"
+#include "ext2_cmds.h"
+
+#define MAX_WORDS 8
+#define MAX_PATH 1024       // the tools' path buffers
+
+// split line into words in place; returns how many, or -1 if too many
+static int split_words(char *line, char **words){
+	char *save;
+	char *word = strtok_r(line, " \t\r\n", &save);
+	int n = 0;
+
+	while (word != NULL){
+		if (n == MAX_WORDS){
+			return -1;
+		}
+		words[n++] = word;
+		word = strtok_r(NULL, " \t\r\n", &save);
+	}
+	return n;
+}
+
+// whether word is the option flag; if so it is taken off the front
+static int take_option(int *argc, char ***argv, const char *flag){
+	if (*argc > 1 && strcmp((*argv)[1], flag) == 0){
+		(*argv)++;
+		(*argc)--;
+		return 1;
+	}
+	return 0;
+}
+
+static int usage(const char *text){
+	fprintf(stderr, "usage: %s\n", text);
+	return EINVAL;
+}
+
+// runs one command; returns 0, or the errno its tool would exit with
+static int run_command(struct ext2_fs *fs, int argc, char **argv){
+	int flag, i;
+
+	for (i = 1; i < argc; i++){
+		if (strlen(argv[i]) >= MAX_PATH){
+			return ENAMETOOLONG;
+		}
+	}
+	if (strcmp(argv[0], "cp") == 0){
+		flag = take_option(&argc, &argv, "-r");
+		if (argc != 3)
+			return usage("cp [-r] <native path> <absolute path>");
+		return ext2_cp(fs, argv[1], argv[2], flag);
+	}
+	if (strcmp(argv[0], "mkdir") == 0){
+		if (argc != 2)
+			return usage("mkdir <absolute path>");
+		return ext2_mkdir(fs, argv[1]);
+	}
+	if (strcmp(argv[0], "ln") == 0){
+		flag = take_option(&argc, &argv, "-s");
+		if (argc != 3)
+			return usage("ln [-s] <absolute path> <absolute path>");
+		return ext2_ln(fs, argv[1], argv[2], flag);
+	}
+	if (strcmp(argv[0], "rm") == 0){
+		if (argc != 2)
+			return usage("rm <absolute path>");
+		return ext2_rm(fs, argv[1]);
+	}
+	if (strcmp(argv[0], "restore") == 0){
+		if (argc != 2)
+			return usage("restore <absolute path>");
+		return ext2_restore(fs, argv[1]);
+	}
+	if (strcmp(argv[0], "check") == 0){
+		if (argc != 1)
+			return usage("check");
+		return ext2_checker(fs);
+	}
+	fprintf(stderr, "%s: unknown command\n", argv[0]);
+	return EINVAL;
+}
+
+int main(int argc, char **argv) {
+
+    if(argc != 2 && argc != 3) {
+        fprintf(stderr, "Usage: %s <image file name> [script file name]\n", argv[0]);
+        exit(1);
+    }
+
+	FILE *script = stdin;
+	if (argc == 3 && strcmp(argv[2], "-") != 0){
+		script = fopen(argv[2], "r");
+		if (script == NULL){
+			perror(argv[2]);
+			exit(1);
+		}
+	}
+
+    struct ext2_fs fs;
+    ext2_open_image(&fs, argv[1]);
+
+	char *line = NULL;
+	size_t cap = 0;
+	char *words[MAX_WORDS];
+	char name[32];
+	int lineno = 0, nwords, ret, status = 0;
+
+	while (getline(&line, &cap, script) >= 0){
+		lineno++;
+		nwords = split_words(line, words);
+		if (nwords == 0 || words[0][0] == '#'){
+			continue;
+		}
+		// the tools may rewrite their arguments, so the name is kept for
+		// the report
+		snprintf(name, sizeof(name), "%s", words[0]);
+		ret = nwords < 0 ? E2BIG : run_command(&fs, nwords, words);
+		if (ret == 0){
+			printf("%d: %s: ok\n", lineno, name);
+		}
+		else{
+			printf("%d: %s: %s\n", lineno, name, strerror(ret));
+			if (status == 0){
+				status = ret;
+			}
+		}
+		// keep the reports in order with what the commands print
+		fflush(stdout);
+	}
+	free(line);
+	if (script != stdin){
+		fclose(script);
+	}
+
+	ext2_sync_image(&fs);
+	return status;
+}
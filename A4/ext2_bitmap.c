@@ -0,0 +1,193 @@
+#include <string.h>
+#include <stdint.h>
+#include "ext2_bitmap.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+/*
+ * The bitmaps are scanned a 64-bit word at a time.  ext2 stores them
+ * little-endian, bit n in bit (n % 8) of byte n / 8, so on a little-endian
+ * host bit n of the bitmap is bit (n % 64) of word n / 64.
+ */
+
+// Word w of the bitmap; bytes past the end of the bitmap read as all ones
+static uint64_t load_word(const unsigned char *map, unsigned int nbytes, unsigned int w){
+	uint64_t x = ~(uint64_t)0;
+	unsigned int off = w * 8;
+
+	if (off + 8 <= nbytes){
+		memcpy(&x, map + off, 8);
+	}
+	else{
+		memcpy(&x, map + off, nbytes - off);
+	}
+	return x;
+}
+
+int bitmap_find_zero(const unsigned char *map, unsigned int nbits, unsigned int start){
+	unsigned int nbytes = (nbits + 7) / 8;
+	unsigned int w;
+	uint64_t x;
+
+	if (start >= nbits){
+		return -1;
+	}
+	// ignore the bits before start in its word
+	w = start / 64;
+	x = ~load_word(map, nbytes, w) & (~(uint64_t)0 << (start % 64));
+	while (x == 0){
+		if (++w * 64 >= nbits){
+			return -1;
+		}
+		x = ~load_word(map, nbytes, w);
+	}
+	start = w * 64 + __builtin_ctzll(x);
+	return start < nbits ? (int)start : -1;
+}
+
+int bitmap_find_one(const unsigned char *map, unsigned int nbits, unsigned int start){
+	unsigned int nbytes = (nbits + 7) / 8;
+	unsigned int w;
+	uint64_t x;
+
+	if (start >= nbits){
+		return nbits;
+	}
+	w = start / 64;
+	x = load_word(map, nbytes, w) & (~(uint64_t)0 << (start % 64));
+	while (x == 0){
+		w++;
+		x = load_word(map, nbytes, w);
+	}
+	// the padding past the end reads as ones, so the loop stops there
+	start = w * 64 + __builtin_ctzll(x);
+	return start < nbits ? start : nbits;
+}
+
+/*
+ * Setting and clearing runs: the partial bytes at the ends a bit at a
+ * time, the whole bytes between with memset.
+ */
+void bitmap_set_range(unsigned char *map, unsigned int start, unsigned int count){
+	unsigned int end = start + count;
+
+	while (start < end && start % 8 != 0){
+		bitmap_set(map, start++);
+	}
+	if (end - start >= 8){
+		memset(map + start / 8, 0xff, (end - start) / 8);
+		start += (end - start) / 8 * 8;
+	}
+	while (start < end){
+		bitmap_set(map, start++);
+	}
+}
+
+void bitmap_clear_range(unsigned char *map, unsigned int start, unsigned int count){
+	unsigned int end = start + count;
+
+	while (start < end && start % 8 != 0){
+		bitmap_clear(map, start++);
+	}
+	if (end - start >= 8){
+		memset(map + start / 8, 0, (end - start) / 8);
+		start += (end - start) / 8 * 8;
+	}
+	while (start < end){
+		bitmap_clear(map, start++);
+	}
+}
+
+/*
+ * Counting set bits, in the fastest way the CPU offers: 32 bytes at a time
+ * with AVX2 (a nibble lookup table, then sums of bytes), or 8 at a time
+ * with POPCNT, or else the compiler's portable popcount.  Bitmaps are at
+ * most a block (or a few) long, so AVX2 is only worth it from AVX2_MIN
+ * bytes on.
+ */
+#define AVX2_MIN 256
+
+static unsigned long popcount_words(const unsigned char *p, unsigned int n){
+	unsigned long count = 0;
+	uint64_t x;
+	unsigned int i;
+
+	for (i = 0; i + 8 <= n; i += 8){
+		memcpy(&x, p + i, 8);
+		count += __builtin_popcountll(x);
+	}
+	for (; i < n; i++){
+		count += __builtin_popcount(p[i]);
+	}
+	return count;
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("popcnt")))
+static unsigned long popcount_popcnt(const unsigned char *p, unsigned int n){
+	unsigned long count = 0;
+	uint64_t x;
+	unsigned int i;
+
+	for (i = 0; i + 8 <= n; i += 8){
+		memcpy(&x, p + i, 8);
+		count += __builtin_popcountll(x);
+	}
+	for (; i < n; i++){
+		count += __builtin_popcount(p[i]);
+	}
+	return count;
+}
+
+__attribute__((target("avx2,popcnt")))
+static unsigned long popcount_avx2(const unsigned char *p, unsigned int n){
+	const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+					       0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low = _mm256_set1_epi8(0x0f);
+	__m256i sum = _mm256_setzero_si256();
+	unsigned int i;
+
+	for (i = 0; i + 32 <= n; i += 32){
+		__m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+		__m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(v, low));
+		__m256i hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+		// per-byte counts are at most 8, so summing them at once is safe
+		sum = _mm256_add_epi64(sum, _mm256_sad_epu8(_mm256_add_epi8(lo, hi),
+							  _mm256_setzero_si256()));
+	}
+	return (unsigned long)_mm256_extract_epi64(sum, 0) + _mm256_extract_epi64(sum, 1) +
+	       _mm256_extract_epi64(sum, 2) + _mm256_extract_epi64(sum, 3) +
+	       popcount_popcnt(p + i, n - i);
+}
+#endif
+
+static unsigned long popcount_bytes(const unsigned char *p, unsigned int n){
+#ifdef HAVE_X86_KERNELS
+	static int cpu = -1;   // 0 = neither, 1 = popcnt, 2 = avx2 and popcnt
+
+	if (cpu < 0){
+		__builtin_cpu_init();
+		cpu = !__builtin_cpu_supports("popcnt") ? 0 :
+		      __builtin_cpu_supports("avx2") ? 2 : 1;
+	}
+	if (cpu == 2 && n >= AVX2_MIN){
+		return popcount_avx2(p, n);
+	}
+	if (cpu >= 1){
+		return popcount_popcnt(p, n);
+	}
+#endif
+	return popcount_words(p, n);
+}
+
+unsigned int bitmap_count_zero(const unsigned char *map, unsigned int nbits){
+	unsigned long ones = popcount_bytes(map, nbits / 8);
+
+	if (nbits % 8){
+		ones += __builtin_popcount(map[nbits / 8] & ((1 << (nbits % 8)) - 1));
+	}
+	return nbits - ones;
+}
@@ -0,0 +1,37 @@
+#ifndef EXT2_BITMAP_H
+#define EXT2_BITMAP_H
+
+/*
+ * Operations on the inode and block bitmaps.  Bit n of a bitmap is bit
+ * (n % 8) of byte n / 8, as ext2 lays them out; bit numbers start at 0.
+ */
+
+// test, set and clear one bit
+static inline int bitmap_test(const unsigned char *map, unsigned int bit){
+	return (map[bit >> 3] >> (bit & 7)) & 1;
+}
+
+static inline void bitmap_set(unsigned char *map, unsigned int bit){
+	map[bit >> 3] |= 1 << (bit & 7);
+}
+
+static inline void bitmap_clear(unsigned char *map, unsigned int bit){
+	map[bit >> 3] &= ~(1 << (bit & 7));
+}
+
+// first clear bit at or after start, or -1 if all of the nbits are set
+int bitmap_find_zero(const unsigned char *map, unsigned int nbits, unsigned int start);
+
+// first set bit at or after start, or nbits if all the rest are clear;
+// with bitmap_find_zero this gives the runs of clear bits
+int bitmap_find_one(const unsigned char *map, unsigned int nbits, unsigned int start);
+
+// set or clear count bits from start on
+void bitmap_set_range(unsigned char *map, unsigned int start, unsigned int count);
+
+void bitmap_clear_range(unsigned char *map, unsigned int start, unsigned int count);
+
+// number of clear bits among the first nbits
+unsigned int bitmap_count_zero(const unsigned char *map, unsigned int nbits);
+
+#endif
@@ -0,0 +1,223 @@
+#include <string.h>
+#include "ext2_blockmap.h"
+
+#define EXT2_S_IFMT 0xF000
+
+unsigned long long ext2_inode_size(struct ext2_inode *ei){
+	unsigned long long size = ei->i_size;
+
+	if ((ei->i_mode & EXT2_S_IFMT) == EXT2_S_IFREG){
+		size |= (unsigned long long)ei->i_dir_acl << 32;
+	}
+	return size;
+}
+
+void ext2_set_inode_size(struct ext2_fs *fs, struct ext2_inode *ei, unsigned long long size){
+	ei->i_size = size;
+	ei->i_dir_acl = size >> 32;
+	if (size > 0x7fffffff){
+		fs->sb->s_feature_ro_compat |= EXT2_FEATURE_RO_COMPAT_LARGE_FILE;
+	}
+}
+
+unsigned long long ext2_max_file_blocks(struct ext2_fs *fs){
+	unsigned long long apb = ext2_addr_per_block(fs);
+
+	return EXT2_NDIR_BLOCKS + apb + apb * apb + apb * apb * apb;
+}
+
+unsigned long long ext2_blocks_needed(struct ext2_fs *fs, unsigned long long nblocks){
+	unsigned long long apb = ext2_addr_per_block(fs);
+	unsigned long long total = nblocks;
+	unsigned long long n;
+
+	if (nblocks <= EXT2_NDIR_BLOCKS){
+		return total;
+	}
+	// the single indirect block
+	n = nblocks - EXT2_NDIR_BLOCKS;
+	total += 1;
+	if (n <= apb){
+		return total;
+	}
+	// the double indirect block, and a single one per apb blocks under it
+	n -= apb;
+	total += 1 + ((n < apb * apb ? n : apb * apb) + apb - 1) / apb;
+	if (n <= apb * apb){
+		return total;
+	}
+	// the triple indirect block, and the double and single ones under it
+	n -= apb * apb;
+	total += 1 + (n + apb * apb - 1) / (apb * apb) + (n + apb - 1) / apb;
+	return total;
+}
+
+/*
+ * The way to block n: the entry of i_block to start from, then the entry
+ * to follow in each indirect block.  Returns the number of indirect
+ * blocks on the way, or -1 if n is past what a file can have.
+ */
+static int block_path(struct ext2_fs *fs, unsigned int n, unsigned int path[4]){
+	unsigned long long apb = ext2_addr_per_block(fs);
+	unsigned long long left = n;
+
+	if (left < EXT2_NDIR_BLOCKS){
+		path[0] = left;
+		return 0;
+	}
+	left -= EXT2_NDIR_BLOCKS;
+	if (left < apb){
+		path[0] = EXT2_IND_BLOCK;
+		path[1] = left;
+		return 1;
+	}
+	left -= apb;
+	if (left < apb * apb){
+		path[0] = EXT2_DIND_BLOCK;
+		path[1] = left / apb;
+		path[2] = left % apb;
+		return 2;
+	}
+	left -= apb * apb;
+	if (left < apb * apb * apb){
+		path[0] = EXT2_TIND_BLOCK;
+		path[1] = left / (apb * apb);
+		path[2] = left / apb % apb;
+		path[3] = left % apb;
+		return 3;
+	}
+	return -1;
+}
+
+unsigned int ext2_bmap(struct ext2_fs *fs, struct ext2_inode *ei, unsigned int n){
+	unsigned int path[4];
+	unsigned int block_num;
+	int depth = block_path(fs, n, path);
+	int i;
+
+	if (depth < 0){
+		return 0;
+	}
+	block_num = ei->i_block[path[0]];
+	for (i = 1; i <= depth && block_num != 0; i++){
+		// a bad block number is taken for a hole, not read
+		if (block_num >= fs->sb->s_blocks_count){
+			return 0;
+		}
+		block_num = ext2_indirect(fs, block_num)[path[i]];
+	}
+	if (block_num >= fs->sb->s_blocks_count){
+		return 0;
+	}
+	return block_num;
+}
+
+// the next block of the extent for the file, zeroed if it is to be an
+// indirect block; 0 if the extent is used up
+static unsigned int take_block(struct ext2_fs *fs, struct ext2_inode *ei,
+							   struct ext2_extent *ext, int indirect){
+	unsigned int block_num;
+
+	if (ext->len == 0){
+		return 0;
+	}
+	block_num = ext->start++;
+	ext->len--;
+	ei->i_blocks += ext2_blocks_to_sectors(fs, 1);
+	if (indirect){
+		memset(ext2_block(fs, block_num), 0, fs->block_size);
+	}
+	return block_num;
+}
+
+unsigned int ext2_bmap_take(struct ext2_fs *fs, struct ext2_inode *ei, unsigned int n,
+							struct ext2_extent *ext){
+	unsigned int path[4];
+	unsigned int *slot;
+	int depth = block_path(fs, n, path);
+	int i;
+
+	if (depth < 0){
+		return 0;
+	}
+	slot = &ei->i_block[path[0]];
+	for (i = 1; i <= depth; i++){
+		if (*slot == 0 && (*slot = take_block(fs, ei, ext, 1)) == 0){
+			return 0;
+		}
+		slot = &ext2_indirect(fs, *slot)[path[i]];
+	}
+	if (*slot == 0){
+		*slot = take_block(fs, ei, ext, 0);
+	}
+	return *slot;
+}
+
+/*
+ * Walking.  left counts the data blocks still to go, so that the walk
+ * ends with the file: entries past its end are not used, and need not
+ * be zero.  A hole in an indirect block skips all the blocks it would
+ * have mapped.
+ */
+static int walk_indirect(struct ext2_fs *fs, unsigned int block_num, int depth,
+						 unsigned long long *left, ext2_block_fn fn, void *arg){
+	unsigned long long apb = ext2_addr_per_block(fs);
+	unsigned long long span = 1;
+	unsigned int *map;
+	unsigned int i;
+	int ret, d;
+
+	if ((ret = fn(fs, block_num, arg)) != 0){
+		return ret;
+	}
+	// a bad block number is passed on, but not read
+	if (block_num >= fs->sb->s_blocks_count){
+		return 0;
+	}
+	for (d = 1; d < depth; d++){
+		span *= apb;
+	}
+	map = ext2_indirect(fs, block_num);
+	for (i = 0; i < apb && *left > 0; i++){
+		if (map[i] == 0){
+			*left -= span < *left ? span : *left;
+		}
+		else if (depth == 1){
+			if ((ret = fn(fs, map[i], arg)) != 0){
+				return ret;
+			}
+			(*left)--;
+		}
+		else if ((ret = walk_indirect(fs, map[i], depth - 1, left, fn, arg)) != 0){
+			return ret;
+		}
+	}
+	return 0;
+}
+
+int ext2_walk_blocks(struct ext2_fs *fs, struct ext2_inode *ei, ext2_block_fn fn, void *arg){
+	unsigned long long apb = ext2_addr_per_block(fs);
+	unsigned long long left, span = apb;
+	int i, ret;
+
+	// a fast symlink keeps its target in i_block, and has no blocks
+	if (ei->i_blocks == 0){
+		return 0;
+	}
+	left = (ext2_inode_size(ei) + fs->block_size - 1) / fs->block_size;
+	for (i = 0; i < EXT2_NDIR_BLOCKS && left > 0; i++, left--){
+		if (ei->i_block[i] != 0 && (ret = fn(fs, ei->i_block[i], arg)) != 0){
+			return ret;
+		}
+	}
+	for (i = EXT2_IND_BLOCK; i <= EXT2_TIND_BLOCK && left > 0; i++, span *= apb){
+		if (ei->i_block[i] == 0){
+			left -= span < left ? span : left;
+		}
+		else if ((ret = walk_indirect(fs, ei->i_block[i], i - EXT2_IND_BLOCK + 1,
+									  &left, fn, arg)) != 0){
+			return ret;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,60 @@
+#ifndef EXT2_BLOCKMAP_H
+#define EXT2_BLOCKMAP_H
+
+#include "ext2_utils.h"
+
+/*
+ * Mapping the blocks of a file to blocks of the disk.  i_block[0..11]
+ * point at the first 12 data blocks; i_block[12] at a single indirect
+ * block, which holds the numbers of the next ext2_addr_per_block()
+ * data blocks; i_block[13] at a double indirect block, whose entries
+ * point at single indirect blocks; and i_block[14] at a triple indirect
+ * block.  Block numbers 0 are holes.
+ */
+#define EXT2_NDIR_BLOCKS 12
+#define EXT2_IND_BLOCK   12
+#define EXT2_DIND_BLOCK  13
+#define EXT2_TIND_BLOCK  14
+
+#define EXT2_FEATURE_RO_COMPAT_LARGE_FILE 0x0002
+
+// size of the file in bytes; the high 32 bits of a regular file's size
+// are kept in i_dir_acl
+unsigned long long ext2_inode_size(struct ext2_inode *ei);
+
+// set the size, marking the file system as having large files if the
+// size needs more than 31 bits
+void ext2_set_inode_size(struct ext2_fs *fs, struct ext2_inode *ei, unsigned long long size);
+
+// the largest number of data blocks a file can have
+unsigned long long ext2_max_file_blocks(struct ext2_fs *fs);
+
+// data and indirect blocks together, for a file of nblocks data blocks
+unsigned long long ext2_blocks_needed(struct ext2_fs *fs, unsigned long long nblocks);
+
+// the disk block holding block n of the file, 0 if it is a hole or the
+// map points past the end of the image
+unsigned int ext2_bmap(struct ext2_fs *fs, struct ext2_inode *ei, unsigned int n);
+
+// a run of blocks allocated for a file and not yet used
+struct ext2_extent {
+	unsigned int start;
+	unsigned int len;
+};
+
+// the same, first mapping block n and any indirect blocks missing on the
+// way to it to blocks taken in order from the front of ext, so that an
+// indirect block lies just before the first block it maps.  i_blocks
+// counts the blocks taken.  Returns 0 if ext runs out first; what was
+// taken stays mapped, and a call with a fresh extent carries on
+unsigned int ext2_bmap_take(struct ext2_fs *fs, struct ext2_inode *ei, unsigned int n,
+							struct ext2_extent *ext);
+
+// call fn for every block of the file, each indirect block before the
+// blocks it maps, up to the end of the file.  Stops at the first call
+// that returns nonzero, and returns that
+typedef int (*ext2_block_fn)(struct ext2_fs *fs, unsigned int block_num, void *arg);
+
+int ext2_walk_blocks(struct ext2_fs *fs, struct ext2_inode *ei, ext2_block_fn fn, void *arg);
+
+#endif
@@ -17,15 +17,23 @@ ext2_checker: This program takes only one command line argument: the name of an
 #include <string.h>
 #include "ext2.h"
 #include "ext2_utils.h"
+#include "ext2_blockmap.h"
+#include "ext2_cmds.h"
 
-unsigned char *disk;
+// the file type bits of i_mode: a symlink's include a regular file's
+#define EXT2_S_IFMT 0xF000
 
 
-int check_every_file(struct ext2_super_block *sb, struct ext2_group_desc *gd, 
-						unsigned int inode_num){
+// marks a block of a file as in use, counting it if it was not
+static int mark_block_in_use(struct ext2_fs *fs, unsigned int block_num, void *arg){
+	*(int *)arg += set_block_in_use(fs, block_num, 1);
+	return 0;
+}
+
+static int check_every_file(struct ext2_fs *fs, unsigned int inode_num){
 	// find inode table
-	int len = 1024+(gd->bg_inode_table-1)*EXT2_BLOCK_SIZE + (inode_num -1)*sb->s_inode_size;
-	struct ext2_inode * ei = (struct ext2_inode *) (disk + len);   
+	struct ext2_inode * ei = get_inode(fs, inode_num);   
+	int len;
 	int fixes = 0;
 
 	struct ext2_dir_entry * ed;
@@ -34,40 +42,46 @@ int check_every_file(struct ext2_super_block *sb, struct ext2_group_desc *gd,
 	char name[255];
 
 	// look up all file
-	for (int i = 0; i < ei->i_blocks/2; ++i){
-		if (ei->i_block[i]){
+	unsigned int block_num;
+	for (int i = 0; i < ext2_size_blocks(fs, ei->i_size); ++i){
+		if ((block_num = ext2_bmap(fs, ei, i)) != 0){
 			len = 0;
 	
 			while (1){
-				ed = (struct ext2_dir_entry *) (disk+1024 + (ei->i_block[i] - 1) * EXT2_BLOCK_SIZE+len);				
-				file_ei = (struct ext2_inode *) (disk + 1024 + (gd->bg_inode_table-1)*EXT2_BLOCK_SIZE + (ed->inode-1)*sb->s_inode_size);
+				ed = (struct ext2_dir_entry *) (ext2_block(fs, block_num) + len);				
+				// an unused entry, where one was removed from the start of a block
+				if (ed->inode == 0){
+					if (ed->rec_len == 0 || len + ed->rec_len >= fs->block_size)
+						break;
+					len += ed->rec_len;
+					continue;
+				}
+				file_ei = get_inode(fs, ed->inode);
 				
 				// check i_mode
-				if((file_ei->i_mode & EXT2_S_IFDIR) == EXT2_S_IFDIR && ed->file_type != EXT2_FT_DIR ){
+				if((file_ei->i_mode & EXT2_S_IFMT) == EXT2_S_IFDIR && ed->file_type != EXT2_FT_DIR ){
 					ed->file_type = EXT2_FT_DIR;
 					fixes++;
 					printf("Fixed: Entry type vs inode mismatch: inode [%d]\n",ed->inode);
 				}
-				else if((file_ei->i_mode & EXT2_S_IFREG) == EXT2_S_IFREG && ed->file_type != EXT2_FT_REG_FILE ){
+				else if((file_ei->i_mode & EXT2_S_IFMT) == EXT2_S_IFREG && ed->file_type != EXT2_FT_REG_FILE ){
 					ed->file_type = EXT2_FT_REG_FILE;				 
 					fixes++;
 					printf("Fixed: Entry type vs inode mismatch: inode [%d]\n",ed->inode);
 				}
-				else if((file_ei->i_mode & EXT2_S_IFLNK) == EXT2_S_IFLNK && ed->file_type != EXT2_FT_SYMLINK ){
+				else if((file_ei->i_mode & EXT2_S_IFMT) == EXT2_S_IFLNK && ed->file_type != EXT2_FT_SYMLINK ){
 					ed->file_type |= EXT2_FT_SYMLINK;				
 					fixes++;
 					printf("Fixed: Entry type vs inode mismatch: inode [%d]\n",ed->inode);			 						
 				}
 
 				// check  flie inode is in bitmap
-				used = get_inode_bitmap_by_index(sb, gd, ed->inode);
+				used = get_inode_bitmap_by_index(fs, ed->inode);
 				if (!used){
-                    update_inode_bitmap(sb, gd, ed->inode, 1);
-					sb->s_free_inodes_count --;
-					gd->bg_free_inodes_count --;
+                    set_inode_in_use(fs, ed->inode, 1);
 					// if need add used dirs count,no basis
 					if (ed->file_type == EXT2_FT_DIR){
-						gd->bg_used_dirs_count ++;
+						inode_group_desc(fs, ed->inode)->bg_used_dirs_count ++;
 					}
                     fixes++;
                     printf("Fixed: inode [%d] not marked as in-use\n",ed->inode);
@@ -80,36 +94,10 @@ int check_every_file(struct ext2_super_block *sb, struct ext2_group_desc *gd,
                     printf("Fixed: valid inode marked for deletion: [%d]\n",ed->inode);
                 }
 
-				// check data block
-				int block_nums = file_ei->i_blocks/2;
+				// check data block, and the indirect blocks that map them
 				int count = 0;
-				for (int i=0; i < block_nums; ++i){
-					// 0 - 12
-					used = get_block_bitmap_by_index(sb, gd, file_ei->i_block[i]);
-					if (!used){
-						update_block_bitmap(sb, gd, file_ei->i_block[i],1);
-						sb->s_free_blocks_count --;
-						gd->bg_free_blocks_count --;
-						fixes ++;
-						count ++;
-					}
-					
-					// Two level pointer 
-					if (i == 12){
-						unsigned int * two_level_block = (unsigned int *)(disk + 1024 + (file_ei->i_block[12] - 1) * EXT2_BLOCK_SIZE);
-						for(int j = 13; j < block_nums; j++){
-							used = get_block_bitmap_by_index(sb, gd, two_level_block[j-13]);
-							if (!used){
-								update_block_bitmap(sb, gd, two_level_block[j-13], 1);
-								sb->s_free_blocks_count --;
-								gd->bg_free_blocks_count --;
-								fixes ++;
-								count ++;
-							}
-						}
-						break;
-					}
-				}
+				ext2_walk_blocks(fs, file_ei, mark_block_in_use, &count);
+				fixes += count;
 				if (count != 0){					
                     printf("Fixed: %d in-use data blocks not marked in data bitmap for inode: [%d]\n", count, ed->inode);
 				}
@@ -119,11 +107,11 @@ int check_every_file(struct ext2_super_block *sb, struct ext2_group_desc *gd,
 				// recursion check dir
 				if (strcmp(name, ".") != 0 && strcmp(name, "..") != 0 && 
 					ed->inode != EXT2_GOOD_OLD_FIRST_INO && ed->file_type == EXT2_FT_DIR){
-					check_every_file(sb, gd, ed->inode);
+					check_every_file(fs, ed->inode);
 				}
 				
 				//next file
-				if (len + ed->rec_len >= ei->i_size)
+				if (len + ed->rec_len >= fs->block_size)
 					break;
 				len += ed->rec_len;
 			}
@@ -133,63 +121,70 @@ int check_every_file(struct ext2_super_block *sb, struct ext2_group_desc *gd,
 }
 
 
-void checker(struct ext2_super_block *sb, struct ext2_group_desc *gd){
+static void checker(struct ext2_fs *fs){
 	// check free inode,block
 	int fixes = 0;
 
 	// bitmap
-	int unused_inode_nums = get_unused_inode_num(sb, gd);
-	int unused_block_nums = get_unused_block_num(sb, gd);
+	int unused_inode_nums = get_unused_inode_num(fs);
+	int unused_block_nums = get_unused_block_num(fs);
 
 	int difference_z;
 	
-    if(unused_inode_nums != sb->s_free_inodes_count){
-        difference_z = abs(unused_inode_nums - sb->s_free_inodes_count);
+    if(unused_inode_nums != fs->sb->s_free_inodes_count){
+        difference_z = abs(unused_inode_nums - fs->sb->s_free_inodes_count);
         printf("Fixed: superblock's free inodes counter was off by %d compared to the bitmap\n",difference_z);
-        sb->s_free_inodes_count = unused_inode_nums;
+        fs->sb->s_free_inodes_count = unused_inode_nums;
         fixes += difference_z;
     }
 
-    if(unused_inode_nums != gd->bg_free_inodes_count){
-        difference_z = abs(unused_inode_nums - gd->bg_free_inodes_count);
-        printf("Fixed: block group's free inodes counter was off by %d compared to the bitmap\n",difference_z);
-        gd->bg_free_inodes_count = unused_inode_nums;
-        fixes += difference_z;
-    }
+	// and each group's counter against its own bitmap
+	for (unsigned int g = 0; g < fs->ngroups; g++){
+		int group_unused = get_group_unused_inode_num(fs, g);
+
+		if(group_unused != fs->gd[g].bg_free_inodes_count){
+			difference_z = abs(group_unused - fs->gd[g].bg_free_inodes_count);
+			printf("Fixed: block group's free inodes counter was off by %d compared to the bitmap\n",difference_z);
+			fs->gd[g].bg_free_inodes_count = group_unused;
+			fixes += difference_z;
+		}
+	}
 
-    if(unused_block_nums != sb->s_free_blocks_count){
-        difference_z = abs(unused_block_nums - sb->s_free_blocks_count);
+    if(unused_block_nums != fs->sb->s_free_blocks_count){
+        difference_z = abs(unused_block_nums - fs->sb->s_free_blocks_count);
         printf("Fixed: superblock's free blocks counter was off by %d compared to the bitmap\n",difference_z);
-        sb->s_free_blocks_count = unused_block_nums;
+        fs->sb->s_free_blocks_count = unused_block_nums;
         fixes += unused_block_nums;
     }
 
-    if(unused_block_nums != gd->bg_free_blocks_count){
-        difference_z = abs(unused_block_nums - gd->bg_free_blocks_count);
-        printf("Fixed: block group's free blocks counter was off by %d compared to the bitmap\n",difference_z);
-        gd->bg_free_blocks_count = unused_block_nums;
-        fixes += unused_block_nums;
-    }
+	for (unsigned int g = 0; g < fs->ngroups; g++){
+		int group_unused = get_group_unused_block_num(fs, g);
 
-	fixes += check_every_file(sb, gd, EXT2_ROOT_INO);
+		if(group_unused != fs->gd[g].bg_free_blocks_count){
+			difference_z = abs(group_unused - fs->gd[g].bg_free_blocks_count);
+			printf("Fixed: block group's free blocks counter was off by %d compared to the bitmap\n",difference_z);
+			fs->gd[g].bg_free_blocks_count = group_unused;
+			fixes += group_unused;
+		}
+	}
+
+	fixes += check_every_file(fs, EXT2_ROOT_INO);
 
 	// fix use directory count
 	/*struct ext2_inode * ei;
-	int len;
 	int count = 0;
 	
-	for (int i=EXT2_ROOT_INO; i <= sb->s_inodes_count; ++i){
+	for (int i=EXT2_ROOT_INO; i <= fs->sb->s_inodes_count; ++i){
 		if (i != EXT2_ROOT_INO && i < 12){
 			continue;
 		}
 
-		len = 1024+(gd->bg_inode_table-1)*EXT2_BLOCK_SIZE + (i -1)*sb->s_inode_size;
-		ei = (struct ext2_inode *) (disk + len);
+		ei = get_inode(fs, i);
 		if ((ei->i_mode & EXT2_S_IFDIR) == EXT2_S_IFDIR){
 			count ++;
 		}
 	}
-	gd->bg_used_dirs_count = count;
+	fs->gd->bg_used_dirs_count = count;
 	*/
 	if(fixes){
         printf("%d file system inconsistencies repaired!\n", fixes);        
@@ -199,6 +194,12 @@ void checker(struct ext2_super_block *sb, struct ext2_group_desc *gd){
     }
 }
 
+int ext2_checker(struct ext2_fs *fs){
+	checker(fs);
+	return 0;
+}
+
+#ifndef EXT2_BATCH
 int main(int argc, char **argv) {
 
     if(argc != 2) {
@@ -206,19 +207,10 @@ int main(int argc, char **argv) {
         exit(1);
     }
 	
-    int fd = open(argv[1], O_RDWR);
-
-    disk = mmap(NULL, 128 * 1024, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if(disk == MAP_FAILED) {
-        perror("mmap");
-        exit(1);
-    }
-
-    struct ext2_super_block *sb = (struct ext2_super_block *)(disk + 1024);
-	struct ext2_group_desc *gd = (struct ext2_group_desc *)(disk + 1024 + sizeof(struct ext2_super_block));
+    struct ext2_fs fs;
+    ext2_open_image(&fs, argv[1]);
 
-	checker(sb, gd);
-	
-    return 0;
+	return ext2_checker(&fs);
 }
+#endif
 
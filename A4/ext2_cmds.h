@@ -0,0 +1,24 @@
+#ifndef EXT2_CMDS_H
+#define EXT2_CMDS_H
+
+#include "ext2_utils.h"
+
+/*
+ * The tools, as functions on an image that is already open.  Each takes
+ * what follows the image on the tool's command line, and returns 0 or
+ * the errno the tool exits with.  Built with EXT2_BATCH defined, the tool
+ * sources leave out their main, so that ext2_batch can link them all.
+ */
+int ext2_cp(struct ext2_fs *fs, const char *src, const char *dest, int recursive);
+
+int ext2_mkdir(struct ext2_fs *fs, const char *path);
+
+int ext2_ln(struct ext2_fs *fs, const char *src, const char *dest, int symbol_link);
+
+int ext2_rm(struct ext2_fs *fs, const char *file_path);
+
+int ext2_restore(struct ext2_fs *fs, const char *file_path);
+
+int ext2_checker(struct ext2_fs *fs);
+
+#endif
@@ -24,183 +24,337 @@ Note:
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
+#include <limits.h>
+#include <dirent.h>
 #include "ext2.h"
 #include "ext2_utils.h"
+#include "ext2_blockmap.h"
+#include "ext2_cmds.h"
 
-unsigned char *disk;
+// smaller files are read rather than mapped
+#define MMAP_MIN (64 * 1024)
 
-void copy_file(struct ext2_super_block *sb, struct ext2_group_desc *gd, 
-												unsigned int parent_inode_num, 
-												const char *file_name,
-												FILE * fd){
+/*
+ * Copies count blocks of the source, from file block first on, to count
+ * consecutive blocks of the image from block_num on: one memcpy from the
+ * mapped source, or preads if it could not be mapped.  The tail of the
+ * last block, past the end of the file, is zeroed.  Returns 0, or the
+ * errno of a read that failed or came up short.
+ */
+static int copy_run(struct ext2_fs *fs, int fd, const unsigned char *src,
+					 unsigned long long file_size, unsigned long long first,
+					 unsigned int block_num, unsigned int count){
+	unsigned long long off = first * fs->block_size;
+	size_t len = (size_t)count * fs->block_size;
+	unsigned char *dst = ext2_block(fs, block_num);
+	ssize_t got;
 
-	// get parent dir,check file if exist
-	int len = 1024+(gd->bg_inode_table-1)*EXT2_BLOCK_SIZE + (parent_inode_num - 1)*sb->s_inode_size;
-	struct ext2_inode * parent_ei = (struct ext2_inode *) (disk + len);
-	struct ext2_dir_entry * parent_ed = NULL;
-	
-	parent_ed = file_dir_entry(sb, gd, parent_inode_num, file_name);
-	if (parent_ed == NULL){
-		// last file name no exist, continue cp
-		
+	if (off + len > file_size){
+		memset(dst + (file_size - off), 0, off + len - file_size);
+		len = file_size - off;
 	}
-	else{
-		if (parent_ed->file_type == EXT2_FT_DIR){
-			//last file is dir, find last ei
-			len = 1024+(gd->bg_inode_table-1)*EXT2_BLOCK_SIZE + (parent_ed->inode - 1)*sb->s_inode_size;
-			parent_ei = (struct ext2_inode *) (disk + len);
-		}
-		else {
-			exit(EEXIST);
-		}
+	if (src != NULL){
+#ifdef MADV_POPULATE_WRITE
+		// fault the run in at once, not a page at a time during the copy
+		uintptr_t page_mask = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+		uintptr_t start = (uintptr_t)dst & ~page_mask;
+		madvise((void *)start, (uintptr_t)dst + len - start, MADV_POPULATE_WRITE);
+#endif
+		memcpy(dst, src + off, len);
+		return 0;
 	}
-	
-	// get size of file
-	int file_size;
-	fseek(fd, 0, SEEK_END);
-	file_size = ftell(fd);
-	fseek(fd, 0, SEEK_SET);
-
-	// compute  need  block number
-	int file_block_num;
-	if (file_size % EXT2_BLOCK_SIZE == 0)
-		file_block_num = file_size/EXT2_BLOCK_SIZE;
-	else
-		file_block_num = file_size/EXT2_BLOCK_SIZE + 1;
-
-	if (file_block_num > 12){
-		// only need Two level pointer, because the total block is 128
-		file_block_num ++;
+	while (len > 0){
+		got = pread(fd, dst, len, off);
+		if (got < 0)
+			return errno;
+		if (got == 0)
+			// the file shrank under us
+			return EIO;
+		dst += got;
+		off += got;
+		len -= got;
 	}
+	return 0;
+}
+
+// blocks of a file that could not be linked in, given back
+static int release_block(struct ext2_fs *fs, unsigned int block_num, void *arg){
+	set_block_in_use(fs, block_num, 0);
+	return 0;
+}
+
+// a file that could not be finished: its blocks, what is left of the
+// run being mapped, and its inode are given back
+static void discard_file(struct ext2_fs *fs, struct ext2_inode *ei,
+						 unsigned int inode_num, struct ext2_extent *ext){
+	ext2_walk_blocks(fs, ei, release_block, NULL);
+	if (ext->len > 0)
+		free_blocks(fs, ext->start, ext->len);
+	set_inode_in_use(fs, inode_num, 0);
+}
+
+/*
+ * Copies the open host file into dir as file_name: allocates its inode
+ * and blocks, copies the content, and adds the entry to dir.  Returns 0,
+ * or the errno to exit with.
+ */
+static int import_file(struct ext2_fs *fs, struct ext2_dir *dir, const char *file_name,
+					   int fd, unsigned long long file_size){
+
+	// compute  need  block number, data blocks and the indirect blocks
+	// that map them
+	unsigned long long file_block_num = ext2_size_blocks(fs, file_size);
+	if (file_block_num > ext2_max_file_blocks(fs))
+		return EFBIG;
 	
-	if (file_block_num > sb->s_free_blocks_count)
+	if (ext2_blocks_needed(fs, file_block_num) > fs->sb->s_free_blocks_count)
 		// no block to save file
-		exit(ENOSPC);
+		return ENOSPC;
 
 	
-	// get filename inode number
-	int new_inode_number = get_free_inode_num(sb, gd);
+	// get filename inode number, near its directory
+	int new_inode_number = alloc_inode(fs, dir->inode_num, 0);
 	if (new_inode_number == 0){
-		exit(ENOSPC);
+		return ENOSPC;
 	}
-	len = 1024+(gd->bg_inode_table-1)*EXT2_BLOCK_SIZE + (new_inode_number-1)*sb->s_inode_size;
-	struct ext2_inode * new_ei = (struct ext2_inode *) (disk + len);
+	struct ext2_inode * new_ei = get_inode(fs, new_inode_number);
 	
 	// set file type
 	new_ei->i_mode |= EXT2_S_IFREG; 
 	// set the size
-	new_ei->i_size = file_size;
-	new_ei->i_blocks = 2*file_block_num; 
+	ext2_set_inode_size(fs, new_ei, file_size);
+	new_ei->i_blocks = 0; 
 	// . link
 	new_ei->i_links_count = 1; 
-
-	// update inode 
-	update_inode_bitmap(sb, gd, new_inode_number, 1);
+	new_ei->i_dtime = 0;
 
 	// set block poniter
 	int i;
 	for(i = 0; i < 15; i++){
 		new_ei->i_block[i] = 0; 
 	}
-	for (i = 0; i < file_block_num; ++i){
-		// 0 - 12  get free inode  
-		new_ei->i_block[i] = get_free_block_num(sb, gd);
-		update_block_bitmap(sb, gd, new_ei->i_block[i],1);
-		if (i == 12){
-			// Two level pointer
-			unsigned int * two_level_block = (unsigned int *)(disk + 1024 + (new_ei->i_block[12] - 1) * EXT2_BLOCK_SIZE);
-
-			// save block number
-			for(int j = 13; j < file_block_num; j++){
-				two_level_block[j-13] = get_free_block_num(sb, gd);
-				update_block_bitmap(sb, gd, two_level_block[j-13],1);
+
+	// map the source, to copy it straight into the image; a small one is
+	// cheaper to read than to map
+	const unsigned char *src = NULL;
+	if (file_size >= MMAP_MIN){
+		src = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+		if (src == MAP_FAILED)
+			src = NULL;
+		else
+			madvise((void *)src, file_size, MADV_SEQUENTIAL);
+	}
+
+	// allocate the blocks in as few runs as the free space allows, from
+	// the start of the inode's group on, and map them in order; copy the
+	// content a run of consecutive blocks at a time
+	struct ext2_extent ext = {0, 0};
+	unsigned long long blocks_left = ext2_blocks_needed(fs, file_block_num);
+	unsigned int goal = alloc_goal(fs, new_inode_number);
+	unsigned int block_num, run_block = 0, run_len = 0;
+	unsigned int n = 0;
+	int ret = 0;
+	while (n < file_block_num && ret == 0){
+		if (ext.len == 0){
+			unsigned int want = blocks_left < UINT_MAX ? blocks_left : UINT_MAX;
+			ext.start = alloc_blocks(fs, goal, want, &ext.len);
+			if (ext.start == 0){
+				ext.len = 0;
+				ret = ENOSPC;
+				break;
 			}
-			
-			break;
+			blocks_left -= ext.len;
+			goal = ext.start + ext.len;
 		}
+		block_num = ext2_bmap_take(fs, new_ei, n, &ext);
+		if (block_num == 0)
+			// the run ended on an indirect block; carry on in the next
+			continue;
+		if (run_len > 0 && block_num != run_block + run_len){
+			ret = copy_run(fs, fd, src, file_size, n - run_len, run_block, run_len);
+			run_len = 0;
+		}
+		if (run_len == 0)
+			run_block = block_num;
+		run_len ++;
+		n ++;
 	}
+	if (run_len > 0 && ret == 0)
+		ret = copy_run(fs, fd, src, file_size, n - run_len, run_block, run_len);
+	if (src != NULL)
+		munmap((void *)src, file_size);
 	
-	new_ei->i_dtime = 0;
-	unsigned char *block_data_ptr;
+	// add new dir entry, or give everything back if the copy failed or
+	// the directory has no room left
+	if (ret == 0 && add_dir_entry(fs, dir, file_name, new_inode_number, EXT2_FT_REG_FILE) != 0)
+		ret = ENOSPC;
+	if (ret != 0)
+		discard_file(fs, new_ei, new_inode_number, &ext);
+	return ret;
+}
+
+static int copy_file(struct ext2_fs *fs, unsigned int parent_inode_num, 
+												const char *file_name,
+												int fd){
+
+	// get parent dir,check file if exist
+	struct ext2_dir_entry * parent_ed = NULL;
 	
-	// copy file content
-	for (i = 0; i < file_block_num; ++i){
-		if (i == 12){
-			// Two level pointer
-			unsigned int * two_level_block = (unsigned int *)(disk + 1024 + (new_ei->i_block[12] - 1) * EXT2_BLOCK_SIZE);
-			for(int j = 13; j < file_block_num; j++){
-				block_data_ptr = disk + 1024 + (two_level_block[j-13] - 1)*EXT2_BLOCK_SIZE;
-				fread(block_data_ptr, sizeof(char), EXT2_BLOCK_SIZE, fd);
-			}
-			break;
+	parent_ed = file_dir_entry(fs, parent_inode_num, file_name);
+	if (parent_ed == NULL){
+		// last file name no exist, continue cp
+		
+	}
+	else{
+		if (parent_ed->file_type == EXT2_FT_DIR){
+			//last file is dir, find last ei
+			parent_inode_num = parent_ed->inode;
+		}
+		else {
+			return EEXIST;
 		}
-		// 0 - 11,  copy content
-		block_data_ptr = disk + 1024 + (new_ei->i_block[i] - 1)*EXT2_BLOCK_SIZE;
-		fread(block_data_ptr, sizeof(char), EXT2_BLOCK_SIZE, fd);
 	}
 	
-	// update parent inode data   
-	int last_len;
-	parent_ed = last_file_dir_entry(parent_ei, &last_len);
-
-	// add new dir entry
-	// modify the last dir rec_len
-	//directory entries should be aligned to 4B
-	parent_ed->rec_len = sizeof(struct ext2_dir_entry) + \
-						 parent_ed->name_len + \
-						 (4-((sizeof(struct ext2_dir_entry) + parent_ed->name_len) % 4));
-	struct ext2_dir_entry * new_ed = (struct ext2_dir_entry *)(((unsigned char *) parent_ed) + \
-										parent_ed->rec_len);
-	last_len += parent_ed->rec_len;
-	new_ed->inode = new_inode_number;
-	new_ed->name_len = strlen(file_name);
-	new_ed->file_type = EXT2_FT_REG_FILE;
-	new_ed->rec_len = EXT2_BLOCK_SIZE - last_len;
-	memcpy((char *) ((unsigned char *)new_ed + sizeof(struct ext2_dir_entry)), file_name, strlen(file_name));
-
-	// update count 
-	gd->bg_free_blocks_count -= file_block_num;
-	gd->bg_free_inodes_count -= 1;
-
-	sb->s_free_blocks_count -= file_block_num;
-	sb->s_free_inodes_count -= 1;
-	
+	// get size of file
+	struct stat st;
+	if (fstat(fd, &st) < 0){
+		return errno;
+	}
+
+	struct ext2_dir parent;
+	open_dir(fs, &parent, parent_inode_num);
+	return import_file(fs, &parent, file_name, fd, st.st_size);
 }
 
+/*
+ * Copies the host directory open as host_fd into dir: every regular file
+ * and directory under it, in one walk with the image mapped once.  Each
+ * directory being filled is held open as an ext2_dir down the walk, so a
+ * new entry is neither a path lookup nor a walk of the directory, and the
+ * allocation hints carry on from one file to the next.  Anything else,
+ * symlinks included, is skipped.  Returns 0, or the errno to exit with.
+ */
+static int import_tree(struct ext2_fs *fs, struct ext2_dir *dir, int host_fd){
+	DIR *host_dir = fdopendir(host_fd);
+	struct dirent *de;
+	struct stat st;
+	struct ext2_dir sub;
+	int fd, sub_inode_num, ret = 0;
 
-int main(int argc, char **argv) {
+	if (host_dir == NULL){
+		ret = errno;
+		close(host_fd);
+		return ret;
+	}
+	while (ret == 0 && (de = readdir(host_dir)) != NULL){
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+		if (fstatat(host_fd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0){
+			perror(de->d_name);
+			continue;
+		}
+		if (S_ISDIR(st.st_mode)){
+			fd = openat(host_fd, de->d_name, O_RDONLY | O_DIRECTORY);
+			if (fd < 0){
+				perror(de->d_name);
+				continue;
+			}
+			sub_inode_num = make_dir(fs, dir, de->d_name);
+			if (sub_inode_num == 0){
+				close(fd);
+				ret = ENOSPC;
+				break;
+			}
+			open_dir(fs, &sub, sub_inode_num);
+			ret = import_tree(fs, &sub, fd);
+		}
+		else if (S_ISREG(st.st_mode)){
+			fd = openat(host_fd, de->d_name, O_RDONLY);
+			if (fd < 0){
+				perror(de->d_name);
+				continue;
+			}
+			ret = import_file(fs, dir, de->d_name, fd, st.st_size);
+			close(fd);
+		}
+		else{
+			fprintf(stderr, "%s: not a regular file or directory, skipped\n", de->d_name);
+		}
+	}
+	closedir(host_dir);
+	return ret;
+}
+
+// cp -r: the tree goes in as dest, or under dest with the source's name if
+// dest is a directory already.  Closes fd
+static int copy_tree(struct ext2_fs *fs, unsigned int parent_inode_num,
+					 const char *dest_name, const char *src_path, int fd){
+	char src_name[256];
+	const char *p;
+	size_t len = strlen(src_path);
+	struct ext2_dir_entry *ed = NULL;
+	struct ext2_dir parent, top;
+	int top_inode_num;
+
+	if (dest_name[0] != '\0'){
+		ed = file_dir_entry(fs, parent_inode_num, dest_name);
+	}
+	if (ed != NULL && ed->file_type != EXT2_FT_DIR){
+		close(fd);
+		return EEXIST;
+	}
+	if (ed == NULL && dest_name[0] != '\0'){
+		strcpy(src_name, dest_name);
+	}
+	else{
+		// the last component of the source, trailing slashes and all
+		if (ed != NULL)
+			parent_inode_num = ed->inode;
+		while (len > 1 && src_path[len - 1] == '/')
+			len--;
+		for (p = src_path + len; p > src_path && p[-1] != '/'; p--)
+			;
+		if (src_path + len - p > 255){
+			close(fd);
+			return ENAMETOOLONG;
+		}
+		memcpy(src_name, p, src_path + len - p);
+		src_name[src_path + len - p] = '\0';
+		if (file_dir_entry(fs, parent_inode_num, src_name) != NULL){
+			close(fd);
+			return EEXIST;
+		}
+	}
+
+	open_dir(fs, &parent, parent_inode_num);
+	top_inode_num = make_dir(fs, &parent, src_name);
+	if (top_inode_num == 0){
+		close(fd);
+		return ENOSPC;
+	}
+	open_dir(fs, &top, top_inode_num);
+	return import_tree(fs, &top, fd);
+}
+
+
+int ext2_cp(struct ext2_fs *fs, const char *src, const char *dest, int recursive){
 
-    if(argc != 4) {
-        fprintf(stderr, "Usage: %s <image file name> <native file name> <absolute path name>\n", argv[0]);
-        exit(1);
-    }
 	char  input_path[1024];
 	// check path
-	if(argv[3][0] != '/'){
+	if(dest[0] != '/'){
 		return ENOENT;
 	}
-	strcpy(input_path, argv[3]);
-	
+	strcpy(input_path, dest);
 	
-    int fd = open(argv[1], O_RDWR);
-
-    disk = mmap(NULL, 128 * 1024, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if(disk == MAP_FAILED) {
-        perror("mmap");
-        exit(1);
-    }
-
-    struct ext2_super_block *sb = (struct ext2_super_block *)(disk + 1024);
-	struct ext2_group_desc *gd = (struct ext2_group_desc *)(disk + 1024 + sizeof(struct ext2_super_block));
 
 	// Check native file if exists
-	FILE *native_fd;
-	native_fd = fopen(argv[2], "r");
+	int native_fd;
+	native_fd = open(src, O_RDONLY);
 	
-	if(native_fd == NULL){
+	if(native_fd < 0){
 		printf("File not exist\n");
-		fclose(native_fd);
-		exit(ENOENT);
+		return ENOENT;
 	}
 
 	
@@ -209,8 +363,6 @@ int main(int argc, char **argv) {
 	char dest_path[1024];
 	char dest_last_file[255];
 	char *p;
-	if (argv[3][strlen(argv[3]) - 1] == '/')
-		argv[3][strlen(argv[3]) - 1] = '\0';
 	
 	p = strrchr(input_path, '/');
 	if (p != NULL){
@@ -229,10 +381,11 @@ int main(int argc, char **argv) {
 	int  ret  = -1;
 	
 	while (dir_name != NULL){
-		ret = find_dir_inode(sb, gd, inode_num, dir_name);
+		ret = find_dir_inode(fs, inode_num, dir_name);
 		dir_name = strtok(NULL, delim);
 		if (ret == -1){
 			// no exist directory
+			close(native_fd);
 			return  ENOENT;
 		}
 		
@@ -240,8 +393,44 @@ int main(int argc, char **argv) {
 		inode_num = ret;
 	}
 
+	struct stat st;
+	if (fstat(native_fd, &st) < 0){
+		ret = errno;
+		close(native_fd);
+		return ret;
+	}
+	if (S_ISDIR(st.st_mode)){
+		if (!recursive){
+			close(native_fd);
+			return EISDIR;
+		}
+		// copy the tree to ext2; the walk closes native_fd
+		return copy_tree(fs, inode_num, dest_last_file, src, native_fd);
+	}
+
 	// copy the file to ext2
-	copy_file(sb, gd, inode_num, dest_last_file, native_fd);
-	fclose(native_fd);
-    return 0;
+	ret = copy_file(fs, inode_num, dest_last_file, native_fd);
+	close(native_fd);
+    return ret;
+}
+
+#ifndef EXT2_BATCH
+int main(int argc, char **argv) {
+
+	int recursive = 0;
+	if(argc == 5 && strcmp(argv[1], "-r") == 0) {
+		recursive = 1;
+		argv++;
+		argc--;
+	}
+    if(argc != 4) {
+        fprintf(stderr, "Usage: %s [-r] <image file name> <native file name> <absolute path name>\n", argv[0]);
+        exit(1);
+    }
+	
+    struct ext2_fs fs;
+    ext2_open_image(&fs, argv[1]);
+
+	return ext2_cp(&fs, argv[2], argv[3], recursive);
 }
+#endif
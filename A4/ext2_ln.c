@@ -25,88 +25,64 @@
 #include <errno.h>
 #include "ext2.h"
 #include "ext2_utils.h"
+#include "ext2_cmds.h"
 
-unsigned char *disk;
-
-void hard_link(struct ext2_super_block *sb, struct ext2_group_desc *gd, 
-												struct ext2_dir_entry * src_file_dir_entry, 
+static int hard_link(struct ext2_fs *fs, struct ext2_dir_entry * src_file_dir_entry, 
 												int dest_inode_num,
 												const char * dest_name){
 
 	
 	// find dest dir inode
-	int len = 1024 + (gd->bg_inode_table-1)*EXT2_BLOCK_SIZE + (dest_inode_num -1)*sb->s_inode_size;
-	struct ext2_inode * dest_ei = (struct ext2_inode *) (disk + len); 
+	struct ext2_dir dest;
+	open_dir(fs, &dest, dest_inode_num);
 	
 	// find src last file inode
-	len = 1024 + (gd->bg_inode_table-1)*EXT2_BLOCK_SIZE + (src_file_dir_entry->inode -1)*sb->s_inode_size;
-	struct ext2_inode * src_last_file_ei = (struct ext2_inode *) (disk + len); 
+	unsigned int src_inode_num = src_file_dir_entry->inode;
+	struct ext2_inode * src_last_file_ei = get_inode(fs, src_inode_num); 
 
-	// dest dir add new  dir entry
-	struct ext2_dir_entry * dest_file_dir_entry;
-	int last_len;
-	dest_file_dir_entry = last_file_dir_entry(dest_ei, &last_len);	
-	
-	dest_file_dir_entry->rec_len = sizeof(struct ext2_dir_entry) + \
-							 dest_file_dir_entry->name_len + \
-							 (4-((sizeof(struct ext2_dir_entry) + dest_file_dir_entry->name_len) % 4));
-	struct ext2_dir_entry * new_ed = (struct ext2_dir_entry *)(((unsigned char *) dest_file_dir_entry) + \
-											dest_file_dir_entry->rec_len);
-	last_len += dest_file_dir_entry->rec_len;
-	new_ed->inode = src_file_dir_entry->inode;
-	new_ed->name_len = strlen(dest_name);
-	new_ed->file_type = src_file_dir_entry->file_type;
-	new_ed->rec_len = EXT2_BLOCK_SIZE - last_len;
-	memcpy((char *) ((unsigned char *)new_ed + sizeof(struct ext2_dir_entry)), dest_name, strlen(dest_name));
+	// dest dir add new  dir entry, in place of any cached one
+	dcache_forget(fs, dest_inode_num, dest_name);
+	if (add_dir_entry(fs, &dest, dest_name, src_inode_num, src_file_dir_entry->file_type) != 0)
+		return ENOSPC;
 
 	//set src file inode link count
 	src_last_file_ei->i_links_count ++;
+	return 0;
 	
 }
 
 
-void symbol_like(struct ext2_super_block *sb, struct ext2_group_desc *gd, 
-												int dest_inode_num,
+static int symbol_like(struct ext2_fs *fs, int dest_inode_num,
 												const char * src_name,
 												const char * dest_name){
 	// find dest dir inode
-	int len = 1024 + (gd->bg_inode_table-1)*EXT2_BLOCK_SIZE + (dest_inode_num -1)*sb->s_inode_size;
-	struct ext2_inode * dest_ei = (struct ext2_inode *) (disk + len); 
-	
-	// dest dir add new  dir entry	
-	struct ext2_dir_entry * dest_file_dir_entry;
-	int new_len;
-	dest_file_dir_entry = last_file_dir_entry(dest_ei, &new_len);
-	
-	dest_file_dir_entry->rec_len = sizeof(struct ext2_dir_entry) + \
-							 dest_file_dir_entry->name_len + \
-							 (4-((sizeof(struct ext2_dir_entry) + dest_file_dir_entry->name_len) % 4));
-	struct ext2_dir_entry * new_ed = (struct ext2_dir_entry *)(((unsigned char *) dest_file_dir_entry) + \
-											dest_file_dir_entry->rec_len);
-	new_len += dest_file_dir_entry->rec_len;
-
-	//get inode , block
-	int new_inode_num = get_free_inode_num(sb, gd);
+	struct ext2_dir dest;
+	open_dir(fs, &dest, dest_inode_num);
+
+	//get inode , block, near the dest dir
+	int new_inode_num = alloc_inode(fs, dest_inode_num, 0);
 	if (new_inode_num == 0){
-		exit(ENOSPC);
+		return ENOSPC;
 	}
-	int new_block_num = get_free_block_num(sb, gd);
-	if (new_block_num == 0){
-		exit(ENOSPC);
+	int new_block_num = alloc_block(fs, new_inode_num);
+	dcache_forget(fs, dest_inode_num, dest_name);
+	if (new_block_num == 0 ||
+	    add_dir_entry(fs, &dest, dest_name, new_inode_num, EXT2_FT_SYMLINK) != 0){
+		// give the inode and block back
+		if (new_block_num != 0)
+			set_block_in_use(fs, new_block_num, 0);
+		set_inode_in_use(fs, new_inode_num, 0);
+		return ENOSPC;
 	}
 
-	update_inode_bitmap(sb, gd, new_inode_num, 1);
-	update_block_bitmap(sb, gd, new_block_num,1);
-
 	//get  inode  table  position   and   set  value
-	len = 1024+(gd->bg_inode_table-1)*EXT2_BLOCK_SIZE + (new_inode_num-1)*sb->s_inode_size;
-	struct ext2_inode * new_ei = (struct ext2_inode *) (disk + len);
+	struct ext2_inode * new_ei = get_inode(fs, new_inode_num);
 
 	// set file type
 	new_ei->i_mode |= EXT2_S_IFLNK; 
 	// set the size, At least save  .   ..
 	new_ei->i_size = strlen(src_name);
-	new_ei->i_blocks = 2; 
+	new_ei->i_blocks = ext2_blocks_to_sectors(fs, 1); 
 	// . link
 	new_ei->i_links_count = 1; 
 	for(int i = 0; i < 15; i++){
@@ -115,73 +91,26 @@ void symbol_like(struct ext2_super_block *sb, struct ext2_group_desc *gd,
 	new_ei->i_block[0] = new_block_num;
 	new_ei->i_dtime = 0;
 
-	//set new dir entry value
-	new_ed->inode = new_inode_num;
-	new_ed->file_type |= EXT2_FT_SYMLINK;
-	new_ed->name_len = strlen(dest_name);
-	new_ed->rec_len = EXT2_BLOCK_SIZE - new_len;
-	memcpy((char *) ((unsigned char *)new_ed + sizeof(struct ext2_dir_entry)), dest_name, strlen(dest_name));
-
 	// set the new inode content
-	unsigned char * data_block = (unsigned char *)(disk + 1024 + (new_ei->i_block[0] - 1) * EXT2_BLOCK_SIZE ) ;
+	unsigned char * data_block = ext2_block(fs, new_ei->i_block[0]);
 
 	memcpy(data_block, src_name, strlen(src_name));
-
-
-	// update count 
-	gd->bg_free_blocks_count -= 1;
-	gd->bg_free_inodes_count -= 1;
-
-	sb->s_free_blocks_count -= 1;
-	sb->s_free_inodes_count -= 1;
+	return 0;
 	
 }
 
-int main(int argc, char **argv) {
+int ext2_ln(struct ext2_fs *fs, const char *src, const char *dest, int symbol_link){
 
-    if(argc != 4 && argc != 5) {
-        fprintf(stderr, "Usage: %s <image file name> <-s> <src file path> <dest file path>\n", argv[0]);
-        exit(1);
-    }
-
-	int symbol_link = 0;
-	char image_file[255];
 	char src_file_path[1024];
 	char dest_file_path[1024];
 
-	// get input param
-	if (argc == 5 && strcmp(argv[2], "-s") == 0){
-		symbol_link = 1;
-		strcpy(image_file, argv[1]);
-		strcat(src_file_path, argv[3]);
-		strcat(dest_file_path, argv[4]);
-	}
-	else if (argc == 4){
-		symbol_link = 0;
-		strcpy(image_file, argv[1]);
-		strcat(src_file_path, argv[2]);
-		strcat(dest_file_path, argv[3]);
-	}
-	else{
-		fprintf(stderr, "Usage: %s <image file name> <-s> <src file path> <dest file path>\n", argv[0]);
-		exit(1);
-	}
+	strcpy(src_file_path, src);
+	strcpy(dest_file_path, dest);
 
 	//check path
 	if (src_file_path[0] != '/' || dest_file_path[0] != '/'){
 		return ENOENT;
 	}
-	
-    int fd = open(image_file, O_RDWR);
-
-    disk = mmap(NULL, 128 * 1024, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if(disk == MAP_FAILED) {
-        perror("mmap");
-        exit(1);
-    }
-
-    struct ext2_super_block *sb = (struct ext2_super_block *)(disk + 1024);
-	struct ext2_group_desc *gd = (struct ext2_group_desc *)(disk + 1024 + sizeof(struct ext2_super_block));
 
 	int src_parent_inode = EXT2_ROOT_INO;
 	int dest_parent_inode = EXT2_ROOT_INO;
@@ -228,7 +157,7 @@ int main(int argc, char **argv) {
 	//    check src file path parent dir
 	dir_name = strtok(src_path, delim);
 	while (dir_name != NULL){
-		ret = find_dir_inode(sb, gd, src_parent_inode, dir_name);
+		ret = find_dir_inode(fs, src_parent_inode, dir_name);
 		dir_name = strtok(NULL, delim);
 		if (ret == -1){
 			// no exist directory
@@ -242,7 +171,7 @@ int main(int argc, char **argv) {
 	//    check dest file path parent dir
 	dir_name = strtok(dest_path, delim);
 	while (dir_name != NULL){
-		ret = find_dir_inode(sb, gd, dest_parent_inode, dir_name);
+		ret = find_dir_inode(fs, dest_parent_inode, dir_name);
 		dir_name = strtok(NULL, delim);
 		if (ret == -1){
 			// no exist directory
@@ -253,11 +182,12 @@ int main(int argc, char **argv) {
 		dest_parent_inode = ret;
 	}
 
-	struct ext2_dir_entry * src_file_dir_entry = file_dir_entry(sb, gd, src_parent_inode, src_last_file);
-	struct ext2_dir_entry * dest_file_dir_entry = file_dir_entry(sb, gd, dest_parent_inode, dest_last_file);
+	struct ext2_dir_entry * src_file_dir_entry = file_dir_entry(fs, src_parent_inode, src_last_file);
+	struct ext2_dir_entry * dest_file_dir_entry = file_dir_entry(fs, dest_parent_inode, dest_last_file);
 
 	// check src last file
-	if (src_file_dir_entry == NULL){
+	if (src_file_dir_entry == NULL){
+
 		// no src file
 		return ENOENT;
 	}
@@ -273,12 +203,35 @@ int main(int argc, char **argv) {
 
 	if (symbol_link == 0){
 		// hard link
-		hard_link(sb, gd, src_file_dir_entry, dest_parent_inode, dest_last_file);
+		return hard_link(fs, src_file_dir_entry, dest_parent_inode, dest_last_file);
 	}
 	else{
-		symbol_like(sb, gd, dest_parent_inode, src_file_path, dest_last_file);
+		return symbol_like(fs, dest_parent_inode, src_file_path, dest_last_file);
 	}
+}
 
-	
-    return 0;
+#ifndef EXT2_BATCH
+int main(int argc, char **argv) {
+
+    if(argc != 4 && argc != 5) {
+        fprintf(stderr, "Usage: %s <image file name> <-s> <src file path> <dest file path>\n", argv[0]);
+        exit(1);
+    }
+
+	int symbol_link = 0;
+
+	// get input param
+	if (argc == 5 && strcmp(argv[2], "-s") == 0){
+		symbol_link = 1;
+	}
+	else if (argc != 4){
+		fprintf(stderr, "Usage: %s <image file name> <-s> <src file path> <dest file path>\n", argv[0]);
+		exit(1);
+	}
+
+    struct ext2_fs fs;
+    ext2_open_image(&fs, argv[1]);
+
+	return ext2_ln(&fs, argv[2 + symbol_link], argv[3 + symbol_link], symbol_link);
 }
+#endif
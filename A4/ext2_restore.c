@@ -17,29 +17,39 @@
 #include <errno.h>
 #include "ext2.h"
 #include "ext2_utils.h"
+#include "ext2_blockmap.h"
+#include "ext2_cmds.h"
 
-unsigned char *disk;
+// block walks: is a block of the file taken by now, and taking it back
+static int block_in_use(struct ext2_fs *fs, unsigned int block_num, void *arg){
+	return get_block_bitmap_by_index(fs, block_num);
+}
+
+static int use_block(struct ext2_fs *fs, unsigned int block_num, void *arg){
+	set_block_in_use(fs, block_num, 1);
+	return 0;
+}
 
-void restore(struct ext2_super_block *sb, struct ext2_group_desc *gd, 
-												int parent_inode_num,
+static int restore(struct ext2_fs *fs, int parent_inode_num,
 												const char * file_name){
 	// find dir inode
-	int len = 1024 + (gd->bg_inode_table-1)*EXT2_BLOCK_SIZE + (parent_inode_num -1)*sb->s_inode_size;
-	struct ext2_inode * parent_ei = (struct ext2_inode *) (disk + len); 
+	struct ext2_inode * parent_ei = get_inode(fs, parent_inode_num); 
+	int len;
 	
 	struct ext2_dir_entry * parent_dir_entry;
 	struct ext2_dir_entry * delete_dir_entry = NULL; 
 	int real_rec_len;
-	char name[255];
+	size_t name_len = strlen(file_name);
 	struct ext2_inode * file_ei = NULL;
 	int file_inode_num;
 	
-	for (int i=0; i < parent_ei->i_blocks/2; ++i){
-		if (parent_ei->i_block[i]){
+	unsigned int block_num;
+	for (int i=0; i < ext2_size_blocks(fs, parent_ei->i_size) && file_ei == NULL; ++i){
+		if ((block_num = ext2_bmap(fs, parent_ei, i)) != 0){
 			len = 0;
 			// find delete  file_name  from dir entry
 			while (1){
-				parent_dir_entry = (struct ext2_dir_entry *) (disk+1024 + (parent_ei->i_block[i] - 1) * EXT2_BLOCK_SIZE + len);
+				parent_dir_entry = (struct ext2_dir_entry *) (ext2_block(fs, block_num) + len);
 
 				real_rec_len = sizeof(struct ext2_dir_entry) + \
 								 parent_dir_entry->name_len + \
@@ -50,21 +60,19 @@ void restore(struct ext2_super_block *sb, struct ext2_group_desc *gd,
 					int find;
 					while (1) {
 						// check  if  delete  file 
-						delete_dir_entry = (struct ext2_dir_entry *) (disk+1024 + (parent_ei->i_block[i] - 1) * EXT2_BLOCK_SIZE + len + new_len);
-						strncpy(name, delete_dir_entry->name, delete_dir_entry->name_len);
-						name[delete_dir_entry->name_len] = '\0';
-						if (strcmp(name, file_name) == 0){
+						delete_dir_entry = (struct ext2_dir_entry *) (ext2_block(fs, block_num) + len + new_len);
+						if (dir_entry_is(delete_dir_entry, file_name, name_len)){
 							// find delete name , restore
 							// parent_dir_entry->rec_len = real_rec_len;
 							// finde delete file_inode
-							int postion = 1024 + (gd->bg_inode_table-1)*EXT2_BLOCK_SIZE + (delete_dir_entry->inode -1)*sb->s_inode_size;
-							file_ei = (struct ext2_inode *) (disk + postion);
+							file_ei = get_inode(fs, delete_dir_entry->inode);
 							file_inode_num = delete_dir_entry->inode;
 							find = 1;
 							break;
 						}
 						// check if finish
-						if (new_len + delete_dir_entry->rec_len >= parent_dir_entry->rec_len){
+						if (delete_dir_entry->rec_len == 0 ||
+							new_len + delete_dir_entry->rec_len >= parent_dir_entry->rec_len){
 							find = 0;
 							break;
 						}
@@ -78,7 +86,7 @@ void restore(struct ext2_super_block *sb, struct ext2_group_desc *gd,
 				}
 			
 				//next file
-				if (len + parent_dir_entry->rec_len >= EXT2_BLOCK_SIZE)
+				if (len + parent_dir_entry->rec_len >= fs->block_size)
 					break;
 				len += parent_dir_entry->rec_len;
 			}		
@@ -86,38 +94,22 @@ void restore(struct ext2_super_block *sb, struct ext2_group_desc *gd,
 	}
 
 	//printf(" file inode %d\n",file_inode_num);
+	if (file_ei == NULL){
+		// no such deleted entry
+		return ENOENT;
+	}
 	
 	// check inode  if  used
-	int used = get_inode_bitmap_by_index(sb, gd, file_inode_num);
+	int used = get_inode_bitmap_by_index(fs, file_inode_num);
 	if (used){
 		// inode used
-		exit(ENOENT);
+		return ENOENT;
 	}
 
-	// check data block if used
-	int block_nums = file_ei->i_blocks/2;
-	//printf("[%d  %d]\n", file_ei->i_blocks, block_nums);
-	for (int i=0; i < block_nums; ++i){
-		// 0 - 12
-		used = get_block_bitmap_by_index(sb, gd, file_ei->i_block[i]);
-		if (used){
-			// block used
-			exit(ENOENT);
-		}
-		
-		// Two level pointer 
-		if (i == 12){
-			unsigned int * two_level_block = (unsigned int *)(disk + 1024 + (file_ei->i_block[12] - 1) * EXT2_BLOCK_SIZE);
-			for(int j = 13; j < block_nums; j++){
-				used = get_block_bitmap_by_index(sb, gd, two_level_block[j-13]);
-				if (used){
-					// block used
-					exit(ENOENT);
-				}
-			}
-			break;
-		}
-		
+	// check data block if used, and the indirect blocks that map them
+	if (ext2_walk_blocks(fs, file_ei, block_in_use, NULL)){
+		// block used
+		return ENOENT;
 	}
 
 	//update 
@@ -125,61 +117,26 @@ void restore(struct ext2_super_block *sb, struct ext2_group_desc *gd,
 	parent_dir_entry->rec_len = real_rec_len;
 	
 	// use inode
-	update_inode_bitmap(sb, gd, file_inode_num, 1);
-	sb->s_free_inodes_count --;
-	gd->bg_free_inodes_count --;
+	set_inode_in_use(fs, file_inode_num, 1);
 
 	// link file inode
 	file_ei->i_links_count ++;
 	file_ei->i_dtime = 0; 
 
 	// use data block	
-	for (int i=0; i < block_nums; ++i){
-		// 0 - 12
-		update_block_bitmap(sb, gd, file_ei->i_block[i], 1);
-		//printf("i_block[%d]: %d\n", i, file_ei->i_block[i]);
-		sb->s_free_blocks_count --;
-		gd->bg_free_blocks_count --;
-		
-		// Two level pointer 
-		if (i == 12){
-			unsigned int * two_level_block = (unsigned int *)(disk + 1024 + (file_ei->i_block[12] - 1) * EXT2_BLOCK_SIZE);
-			for(int j = 13; j < block_nums; j++){
-				update_block_bitmap(sb, gd, two_level_block[j-13], 1);
-				//printf("two_level_block[%d]: %d\n", j, two_level_block[j-13]);
-				sb->s_free_blocks_count --;
-				gd->bg_free_blocks_count --;
-			}
-			break;
-		}
-	}
+	ext2_walk_blocks(fs, file_ei, use_block, NULL);
+	return 0;
    
 }
 
-int main(int argc, char **argv) {
-
-    if(argc != 3) {
-        fprintf(stderr, "Usage: %s <image file name> <absolute path name>\n", argv[0]);
-        exit(1);
-    }
+int ext2_restore(struct ext2_fs *fs, const char *file_path){
 	char input_path[1024];
 	
 	// check if absolute path
-	if(argv[2][0] != '/'){
+	if(file_path[0] != '/'){
 		return ENOENT;
 	}
-	strcpy(input_path, argv[2]);
-	
-    int fd = open(argv[1], O_RDWR);
-
-    disk = mmap(NULL, 128 * 1024, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if(disk == MAP_FAILED) {
-        perror("mmap");
-        exit(1);
-    }
-
-    struct ext2_super_block *sb = (struct ext2_super_block *)(disk + 1024);
-	struct ext2_group_desc *gd = (struct ext2_group_desc *)(disk + 1024 + sizeof(struct ext2_super_block));
+	strcpy(input_path, file_path);
 
 	int parent_inode = EXT2_ROOT_INO;
 	char *delim = "/";
@@ -202,7 +159,7 @@ int main(int argc, char **argv) {
 	// check file path
 	dir_name = strtok(path, delim);
 	while (dir_name != NULL){
-		ret = find_dir_inode(sb, gd, parent_inode, dir_name);
+		ret = find_dir_inode(fs, parent_inode, dir_name);
 		dir_name = strtok(NULL, delim);
 		if (ret == -1){
 			// no exist directory
@@ -213,8 +170,20 @@ int main(int argc, char **argv) {
 		parent_inode = ret;
 	}
 	
-	restore(sb, gd, parent_inode, last_file);
-	
-    return 0;
+	return restore(fs, parent_inode, last_file);
 }
 
+#ifndef EXT2_BATCH
+int main(int argc, char **argv) {
+
+    if(argc != 3) {
+        fprintf(stderr, "Usage: %s <image file name> <absolute path name>\n", argv[0]);
+        exit(1);
+    }
+
+    struct ext2_fs fs;
+    ext2_open_image(&fs, argv[1]);
+
+	return ext2_restore(&fs, argv[2]);
+}
+#endif
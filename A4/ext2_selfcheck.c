@@ -0,0 +1,275 @@
+/*
+ * ext2_selfcheck: regression checks for the bitmap operations and the
+ * block allocator, run by "make check" (see runcheck).  It takes the
+ * names of ext2 images it may scribble on.
+ *
+ * The bitmap operations are checked against a bit at a time on random
+ * bitmaps of every length up to a few hundred bits and some longer ones,
+ * so that the word loop, its ragged ends and the AVX2 count (from
+ * AVX2_MIN bytes on) are all taken.
+ *
+ * alloc_blocks is checked against the rule in ext2_utils.h, computed a
+ * bit at a time: on each image the block bitmaps are filled at random,
+ * then runs are allocated from random goals and given back again, and
+ * the free counts of the superblock and the groups must keep matching
+ * the bitmaps.
+ *
+ * Prints what went wrong and exits with 1 at the first failure.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ext2.h"
+#include "ext2_utils.h"
+#include "ext2_bitmap.h"
+
+#define MAX_BITS 9000
+#define ROUNDS 200
+
+static unsigned long state = 0x9E3779B97F4A7C15UL;
+
+// xorshift64*, enough for test data
+static unsigned long next_rand(void){
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return state * 0x2545F4914F6CDD1DUL;
+}
+
+static void fail(const char *what, unsigned int a, unsigned int b, unsigned int c){
+	printf("ext2_selfcheck: %s (%u, %u, %u)\n", what, a, b, c);
+	exit(1);
+}
+
+// random bits, set with probability about ones / 8
+static void fill_bits(unsigned char *map, unsigned int nbytes, int ones){
+	unsigned int i;
+
+	for (i = 0; i < nbytes * 8; i++){
+		if ((int)(next_rand() % 8) < ones)
+			bitmap_set(map, i);
+		else
+			bitmap_clear(map, i);
+	}
+}
+
+static void check_bitmap_len(unsigned int nbits){
+	static unsigned char map[MAX_BITS / 8 + 16], want[MAX_BITS / 8 + 16];
+	unsigned int start, i, zeros, count;
+	int z, o;
+
+	// pad with random bits: nothing past nbits may count
+	fill_bits(map, sizeof(map), next_rand() % 9);
+	zeros = 0;
+	for (i = 0; i < nbits; i++)
+		zeros += !bitmap_test(map, i);
+	if (bitmap_count_zero(map, nbits) != zeros)
+		fail("bitmap_count_zero", nbits, bitmap_count_zero(map, nbits), zeros);
+
+	for (start = 0; start <= nbits; start++){
+		for (z = start; z < nbits && bitmap_test(map, z); z++)
+			;
+		if (z >= nbits)
+			z = -1;
+		for (o = start; o < nbits && !bitmap_test(map, o); o++)
+			;
+		if (start >= nbits)
+			o = nbits;
+		if (bitmap_find_zero(map, nbits, start) != z)
+			fail("bitmap_find_zero", nbits, start, bitmap_find_zero(map, nbits, start));
+		if (bitmap_find_one(map, nbits, start) != o)
+			fail("bitmap_find_one", nbits, start, bitmap_find_one(map, nbits, start));
+	}
+
+	// ranges, against a bit at a time; nothing else may change
+	start = next_rand() % nbits;
+	count = next_rand() % (nbits - start + 1);
+	memcpy(want, map, sizeof(map));
+	for (i = start; i < start + count; i++)
+		bitmap_set(want, i);
+	bitmap_set_range(map, start, count);
+	if (memcmp(map, want, sizeof(map)) != 0)
+		fail("bitmap_set_range", nbits, start, count);
+	for (i = start; i < start + count; i++)
+		bitmap_clear(want, i);
+	bitmap_clear_range(map, start, count);
+	if (memcmp(map, want, sizeof(map)) != 0)
+		fail("bitmap_clear_range", nbits, start, count);
+}
+
+static void check_bitmaps(void){
+	static const unsigned int long_lens[] = { 2047, 2048, 2049, 2111, 4096, 8191, 8192, MAX_BITS };
+	unsigned int n;
+	int r;
+
+	for (r = 0; r < 4; r++){
+		for (n = 1; n <= 600; n++)
+			check_bitmap_len(n);
+		for (n = 0; n < sizeof(long_lens) / sizeof(long_lens[0]); n++)
+			check_bitmap_len(long_lens[n]);
+	}
+}
+
+/*
+ * The allocator, and a model of it.  The model reads the bitmaps a bit
+ * at a time with its own geometry.
+ */
+static unsigned int group_bits(struct ext2_fs *fs, unsigned int g){
+	unsigned int left = fs->sb->s_blocks_count - fs->sb->s_first_data_block -
+		g * fs->sb->s_blocks_per_group;
+
+	return left < fs->sb->s_blocks_per_group ? left : fs->sb->s_blocks_per_group;
+}
+
+static unsigned char *group_map(struct ext2_fs *fs, unsigned int g){
+	return ext2_block(fs, fs->gd[g].bg_block_bitmap);
+}
+
+static unsigned int free_in(struct ext2_fs *fs, unsigned int g){
+	unsigned int i, n = 0;
+
+	for (i = 0; i < group_bits(fs, g); i++)
+		n += !bitmap_test(group_map(fs, g), i);
+	return n;
+}
+
+// length of the free run from bit of group g on
+static unsigned int run_at(struct ext2_fs *fs, unsigned int g, unsigned int bit){
+	unsigned int end = bit;
+
+	while (end < group_bits(fs, g) && !bitmap_test(group_map(fs, g), end))
+		end++;
+	return end - bit;
+}
+
+// what alloc_blocks should do: its first block, and the run length in *got
+static unsigned int model_alloc(struct ext2_fs *fs, unsigned int goal, unsigned int want,
+								unsigned int *got){
+	unsigned int first = fs->sb->s_first_data_block;
+	unsigned int per = fs->sb->s_blocks_per_group;
+	unsigned int group, bit, g, i, len;
+	unsigned int best_g = 0, best_bit = 0, best_len = 0;
+	unsigned int long_g = 0, long_bit = 0, long_len = 0;
+
+	*got = 0;
+	if (want == 0)
+		return 0;
+	if (goal < first || goal >= fs->sb->s_blocks_count)
+		goal = first;
+	group = (goal - first) / per;
+	bit = (goal - first) % per;
+
+	// the run at the goal, else the first long enough run after it
+	if ((len = run_at(fs, group, bit)) > 0){
+		*got = len < want ? len : want;
+		return first + group * per + bit;
+	}
+	for (; bit < group_bits(fs, group); bit += len > 0 ? len : 1){
+		len = run_at(fs, group, bit);
+		if (len >= want){
+			*got = want;
+			return first + group * per + bit;
+		}
+	}
+
+	// the smallest long enough run, from the goal's group on; else the
+	// longest run
+	for (i = 0; i < fs->ngroups; i++){
+		g = (group + i) % fs->ngroups;
+		for (bit = 0; bit < group_bits(fs, g); bit += len > 0 ? len : 1){
+			len = run_at(fs, g, bit);
+			if (len == 0)
+				continue;
+			if (len >= want && (best_len == 0 || len < best_len)){
+				best_g = g;
+				best_bit = bit;
+				best_len = len;
+			}
+			if (len > long_len){
+				long_g = g;
+				long_bit = bit;
+				long_len = len;
+			}
+		}
+	}
+	if (best_len != 0){
+		*got = want;
+		return first + best_g * per + best_bit;
+	}
+	if (long_len != 0){
+		*got = long_len;
+		return first + long_g * per + long_bit;
+	}
+	return 0;
+}
+
+static void check_counts(struct ext2_fs *fs, const char *when){
+	unsigned int g, n, total = 0;
+
+	for (g = 0; g < fs->ngroups; g++){
+		n = free_in(fs, g);
+		if (fs->gd[g].bg_free_blocks_count != n)
+			fail(when, g, fs->gd[g].bg_free_blocks_count, n);
+		total += n;
+	}
+	if (fs->sb->s_free_blocks_count != total)
+		fail(when, fs->ngroups, fs->sb->s_free_blocks_count, total);
+}
+
+static void check_alloc(const char *path){
+	struct ext2_fs fs;
+	unsigned int b, goal, want, start, got, mstart, mgot;
+	unsigned int span;
+	int round, step, density;
+
+	ext2_open_image(&fs, path);
+	span = fs.sb->s_blocks_count - fs.sb->s_first_data_block;
+	for (round = 0; round < ROUNDS; round++){
+		// a fresh random bitmap, through the helper that keeps the
+		// counts and hints
+		density = next_rand() % 9;
+		for (b = fs.sb->s_first_data_block; b < fs.sb->s_blocks_count; b++)
+			set_block_in_use(&fs, b, (int)(next_rand() % 8) < density);
+		check_counts(&fs, "free counts after filling");
+
+		for (step = 0; step < 20; step++){
+			// a goal outside the disk means its start; a group's first
+			// block, as for alloc_block, is where its hint is used
+			switch (next_rand() % 8){
+			case 0:
+				goal = next_rand() % 2 ? 0 : fs.sb->s_blocks_count;
+				break;
+			case 1:
+			case 2:
+				goal = alloc_goal(&fs, 1 + next_rand() % fs.sb->s_inodes_count);
+				break;
+			default:
+				goal = fs.sb->s_first_data_block + next_rand() % span;
+			}
+			want = 1 + next_rand() % (next_rand() % 4 == 0 ? 300 : 24);
+			mstart = model_alloc(&fs, goal, want, &mgot);
+			start = alloc_blocks(&fs, goal, want, &got);
+			if (start != mstart || got != mgot){
+				printf("ext2_selfcheck: %s: goal %u want %u: got %u+%u, want %u+%u\n",
+					   path, goal, want, start, got, mstart, mgot);
+				exit(1);
+			}
+			check_counts(&fs, "free counts after alloc_blocks");
+			if (got > 0 && next_rand() % 3 == 0){
+				free_blocks(&fs, start, got);
+				check_counts(&fs, "free counts after free_blocks");
+			}
+		}
+	}
+}
+
+int main(int argc, char **argv){
+	int i;
+
+	check_bitmaps();
+	for (i = 1; i < argc; i++)
+		check_alloc(argv[i]);
+	printf("ext2_selfcheck: ok\n");
+	return 0;
+}
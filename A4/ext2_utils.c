@@ -6,255 +6,787 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <string.h>
+#include <errno.h>
 #include "ext2_utils.h"
+#include "ext2_bitmap.h"
+#include "ext2_blockmap.h"
 
-struct ext2_dir_entry *  file_dir_entry(struct ext2_super_block *sb, struct ext2_group_desc *gd, 
-	unsigned int inode_num, const char * filename){
+#define EXT2_SUPER_MAGIC 0xEF53
+#define EXT2_MAX_LOG_BLOCK_SIZE 2   // 4096-byte blocks
 
-	int len = 1024+(gd->bg_inode_table-1)*EXT2_BLOCK_SIZE + (inode_num -1)*sb->s_inode_size;
-	struct ext2_inode * ei = (struct ext2_inode *) (disk + len);   
-	char name[255];
+static void bad_image(const char *path, const char *why){
+	fprintf(stderr, "%s: not a usable ext2 image: %s\n", path, why);
+	exit(1);
+}
 
-	// look up all file
-	struct ext2_dir_entry * ed;
-	for (int i=0; i < ei->i_blocks/2; ++i){
-		if (ei->i_block[i]){
-			len = 0;
-			while (1){
-				ed = (struct ext2_dir_entry *) (disk+1024 + (ei->i_block[i] - 1) * EXT2_BLOCK_SIZE+len);
+/*
+ * The mapping covers the whole file, as fstat reports it, and the file
+ * system described by the superblock must fit in it.  Only the metadata
+ * at the start of the image is read ahead; the tools touch few other
+ * blocks, and those in no particular order.
+ */
+void ext2_open_image(struct ext2_fs *fs, const char *path){
+	struct ext2_super_block *sb;
+	struct ext2_group_desc *gd;
+	struct stat st;
+	size_t meta, table_blocks;
+	unsigned int g;
+	int fd;
 
-				strncpy(name, ed->name, ed->name_len);
-				name[ed->name_len] = '\0';
-				if (strcmp(name, filename) == 0){
-					// return dir inode
-					return ed;
-				}
+	fd = open(path, O_RDWR);
+	if (fd < 0 || fstat(fd, &st) < 0){
+		perror(path);
+		exit(1);
+	}
+	if (st.st_size < 2048 + sizeof(struct ext2_group_desc)){
+		bad_image(path, "too small");
+	}
+	fs->size = st.st_size;
+	fs->disk = mmap(NULL, fs->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (fs->disk == MAP_FAILED){
+		perror("mmap");
+		exit(1);
+	}
+	close(fd);
 
-				//next file
-				if (len + ed->rec_len >= ei->i_size)
-					break;
-				len += ed->rec_len;
-			}
+	// the superblock is 1024 bytes in, whatever the block size
+	sb = fs->sb = (struct ext2_super_block *)(fs->disk + 1024);
+	if (sb->s_magic != EXT2_SUPER_MAGIC){
+		bad_image(path, "bad magic number");
+	}
+	if (sb->s_log_block_size > EXT2_MAX_LOG_BLOCK_SIZE){
+		bad_image(path, "block size is larger than 4096");
+	}
+	fs->block_size = 1024 << sb->s_log_block_size;
+	if (sb->s_inode_size < sizeof(struct ext2_inode) || sb->s_inode_size > fs->block_size ||
+	    sb->s_inodes_count == 0 || sb->s_blocks_count < 2 ||
+	    sb->s_first_data_block >= sb->s_blocks_count ||
+	    sb->s_inodes_per_group == 0 || sb->s_inodes_per_group > 8 * fs->block_size ||
+	    sb->s_blocks_per_group == 0 || sb->s_blocks_per_group > 8 * fs->block_size){
+		bad_image(path, "bad superblock");
+	}
+	if ((size_t)sb->s_blocks_count * fs->block_size > fs->size){
+		bad_image(path, "file system is larger than the image");
+	}
+
+	// the descriptor table is in the block after the superblock's
+	fs->ngroups = (sb->s_blocks_count - sb->s_first_data_block + sb->s_blocks_per_group - 1) /
+		      sb->s_blocks_per_group;
+	gd = fs->gd = (struct ext2_group_desc *)ext2_block(fs, sb->s_first_data_block + 1);
+	if ((size_t)fs->ngroups * sb->s_inodes_per_group != sb->s_inodes_count ||
+	    (unsigned char *)(gd + fs->ngroups) > fs->disk + fs->size){
+		bad_image(path, "bad block group layout");
+	}
+	table_blocks = ((size_t)sb->s_inodes_per_group * sb->s_inode_size - 1) / fs->block_size;
+	for (g = 0; g < fs->ngroups; g++){
+		if (gd[g].bg_block_bitmap == 0 || gd[g].bg_block_bitmap >= sb->s_blocks_count ||
+		    gd[g].bg_inode_bitmap == 0 || gd[g].bg_inode_bitmap >= sb->s_blocks_count ||
+		    gd[g].bg_inode_table == 0 ||
+		    gd[g].bg_inode_table + table_blocks >= sb->s_blocks_count){
+			bad_image(path, "group descriptor points outside the file system");
 		}
 	}
-	return NULL;
+
+	fs->inode_hint = calloc(fs->ngroups, sizeof(unsigned int));
+	fs->block_hint = calloc(fs->ngroups, sizeof(unsigned int));
+	fs->dcache = calloc(EXT2_DCACHE_SIZE, sizeof(struct ext2_dcache_slot));
+	if (fs->inode_hint == NULL || fs->block_hint == NULL || fs->dcache == NULL){
+		perror("calloc");
+		exit(1);
+	}
+
+	madvise(fs->disk, fs->size, MADV_RANDOM);
+	// the metadata of group 0, root directory and all, is needed first
+	meta = (size_t)gd->bg_inode_table * fs->block_size +
+	       (size_t)sb->s_inodes_per_group * sb->s_inode_size;
+	madvise(fs->disk, meta < fs->size ? meta : fs->size, MADV_WILLNEED);
 }
 
+void ext2_sync_image(struct ext2_fs *fs){
+	if (msync(fs->disk, fs->size, MS_SYNC) < 0){
+		perror("msync");
+	}
+}
 
+/*
+ * The dentry cache: entries found by name, so that looking the same name
+ * up again, as every path through a directory does, is one probe.  It is
+ * a table of EXT2_DCACHE_SIZE slots, indexed by the directory's inode and
+ * a hash of the name; a new entry replaces whatever was in its slot.  A
+ * slot points at the entry in the image, and a hit is checked against
+ * the entry itself, so an entry that has since been overwritten is a
+ * miss.  One that is removed but left in place, as rm does by merging it
+ * into the entry before, must be forgotten.
+ */
+static unsigned int name_hash(const char *name, size_t len){
+	unsigned int hash = 2166136261u;        // FNV-1a
+	size_t i;
 
-struct ext2_dir_entry *  last_file_dir_entry(struct ext2_inode * ei, int *last_len){
-	struct ext2_dir_entry * ed;
-	int len;
+	for (i = 0; i < len; i++){
+		hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+	}
+	return hash;
+}
 
-	// find  last dir entry
-	for (int i = 0; i < ei->i_blocks/2; ++i){
-		if (ei->i_block[i]){
-			len = 0;
-			while (1){
-				ed = (struct ext2_dir_entry *) (disk+1024 + (ei->i_block[i] - 1) * EXT2_BLOCK_SIZE + len);
-					
-				//next file
-				if (len + ed->rec_len >= EXT2_BLOCK_SIZE)
-					break;
-				len += ed->rec_len;
-			}
-		}
+static struct ext2_dcache_slot *dcache_slot(struct ext2_fs *fs, unsigned int parent,
+											unsigned int hash){
+	return &fs->dcache[(hash ^ parent * 0x9e3779b1u) & (EXT2_DCACHE_SIZE - 1)];
+}
+
+int dir_entry_is(struct ext2_dir_entry *ed, const char *name, size_t len){
+	return ed->inode != 0 && ed->name_len == len && memcmp(ed->name, name, len) == 0;
+}
+
+static struct ext2_dir_entry *dcache_lookup(struct ext2_fs *fs, unsigned int parent,
+											const char *name, size_t len, unsigned int hash){
+	struct ext2_dcache_slot *slot = dcache_slot(fs, parent, hash);
+	struct ext2_dir_entry *ed = slot->ed;
+	size_t off;
+
+	if (ed == NULL || slot->parent != parent || slot->hash != hash){
+		return NULL;
+	}
+	// what is there now may not be an entry: its name must at least be
+	// inside the block before it is compared
+	off = ((unsigned char *)ed - fs->disk) % fs->block_size;
+	if (off + sizeof(struct ext2_dir_entry) + ed->name_len > fs->block_size ||
+	    !dir_entry_is(ed, name, len)){
+		return NULL;
 	}
-	*last_len = len;
 	return ed;
 }
 
+static void dcache_insert(struct ext2_fs *fs, unsigned int parent, unsigned int hash,
+						  struct ext2_dir_entry *ed){
+	struct ext2_dcache_slot *slot = dcache_slot(fs, parent, hash);
+
+	slot->parent = parent;
+	slot->hash = hash;
+	slot->ed = ed;
+}
 
+void dcache_forget(struct ext2_fs *fs, unsigned int parent, const char *name){
+	unsigned int hash = name_hash(name, strlen(name));
+	struct ext2_dcache_slot *slot = dcache_slot(fs, parent, hash);
+
+	if (slot->parent == parent && slot->hash == hash){
+		slot->ed = NULL;
+	}
+}
 
-int find_dir_inode(struct ext2_super_block *sb, struct ext2_group_desc *gd, 
-						unsigned int inode_num, const char *dir_name){
-	// find inode table
-	int len = 1024+(gd->bg_inode_table-1)*EXT2_BLOCK_SIZE + (inode_num -1)*sb->s_inode_size;
-	struct ext2_inode * ei = (struct ext2_inode *) (disk + len);   
-	char name[255];
+/*
+ * Directories.  A directory's entries fill its blocks, each block on its
+ * own: the last entry of a block runs to the end of it.  The blocks are
+ * looked up through the block map, so a directory may have more than 12.
+ */
+struct ext2_dir_entry *  file_dir_entry(struct ext2_fs *fs, unsigned int inode_num,
+	const char * filename){
+
+	size_t name_len = strlen(filename);
+	unsigned int hash = name_hash(filename, name_len);
+	struct ext2_inode * ei;
+	unsigned int block_num;
+	int len;
+
+	struct ext2_dir_entry * ed = dcache_lookup(fs, inode_num, filename, name_len, hash);
+	if (ed != NULL){
+		return ed;
+	}
 
-	struct ext2_dir_entry * ed;
 	// look up all file
-	for (int i = 0; i < ei->i_blocks/2; ++i){
-		if (ei->i_block[i]){
+	ei = get_inode(fs, inode_num);
+	for (int i=0; i < ext2_size_blocks(fs, ei->i_size); ++i){
+		if ((block_num = ext2_bmap(fs, ei, i)) != 0){
 			len = 0;
-	
 			while (1){
-				ed = (struct ext2_dir_entry *) (disk+1024 + (ei->i_block[i] - 1) * EXT2_BLOCK_SIZE+len);
+				ed = (struct ext2_dir_entry *) (ext2_block(fs, block_num) + len);
 
-				strncpy(name, ed->name, ed->name_len);
-				name[ed->name_len] = '\0';
-				if (strcmp(name, dir_name) == 0 && ed->file_type == EXT2_FT_DIR){
+				if (dir_entry_is(ed, filename, name_len)){
 					// return dir inode
-					return ed->inode;
+					dcache_insert(fs, inode_num, hash, ed);
+					return ed;
 				}
 
 				//next file
-				if (len + ed->rec_len >= ei->i_size)
+				if (ed->rec_len == 0 || len + ed->rec_len >= fs->block_size)
 					break;
 				len += ed->rec_len;
 			}
 		}
 	}
-	return -1;
-}
-
-int get_free_inode_num(struct ext2_super_block *sb, struct ext2_group_desc *gd){
-	int len = 1024 + (gd->bg_inode_bitmap-1) * EXT2_BLOCK_SIZE;
-	char b;
-	int  inode_num = 1;
-	for (int i = len; i < len + sb->s_inodes_count/8; ++i){
-		// get one bytes
-		b = disk[i];
-		// find no use
-		for (int j = 0; j < 8; j++){
-			if ((b & 1) == 0){
-				// no use
-				return inode_num;
-			}
-			b = b >> 1;
-			inode_num ++;
+	return NULL;
+}
+
+
+
+int find_dir_inode(struct ext2_fs *fs, unsigned int inode_num, const char *dir_name){
+	struct ext2_dir_entry * ed = file_dir_entry(fs, inode_num, dir_name);
+
+	if (ed == NULL || ed->file_type != EXT2_FT_DIR){
+		return -1;
+	}
+	return ed->inode;
+}
+
+// an entry with a name of name_len bytes, padded to 4 bytes; as the tools
+// have always laid them out, a name that fits exactly gets 4 more
+static unsigned int dir_entry_size(unsigned int name_len){
+	return sizeof(struct ext2_dir_entry) + name_len +
+	       (4 - ((sizeof(struct ext2_dir_entry) + name_len) % 4));
+}
+
+static struct ext2_dir_entry *dir_entry_at(struct ext2_fs *fs, unsigned int block_num,
+										   unsigned int off){
+	return (struct ext2_dir_entry *)(ext2_block(fs, block_num) + off);
+}
+
+/*
+ * Removing the first entry of a block, which has no entry before it to
+ * take its space.  Clearing its inode would lose what restore needs, so
+ * the removed entry trades places with the next one, which then spans
+ * both records and leaves the removed entry in its gap, where restore
+ * looks.  An entry alone in its block gets an empty entry in front.
+ */
+int hide_first_dir_entry(struct ext2_fs *fs, unsigned int block_num){
+	unsigned char *block = ext2_block(fs, block_num);
+	struct ext2_dir_entry *ed = dir_entry_at(fs, block_num, 0);
+	struct ext2_dir_entry *next = NULL;
+	unsigned char removed[sizeof(struct ext2_dir_entry) + EXT2_NAME_LEN];
+	unsigned int removed_len = sizeof(struct ext2_dir_entry) + ed->name_len;
+	unsigned int span = ed->rec_len;
+	unsigned int front = dir_entry_size(0);
+
+	if (span < fs->block_size){
+		next = dir_entry_at(fs, block_num, span);
+		front = dir_entry_size(next->name_len);
+		span += next->rec_len;
+		if (front + removed_len > span){
+			// no room in the pair: the entry can only be emptied
+			ed->inode = 0;
+			return 0;
 		}
 	}
-	return 0;
+	memcpy(removed, ed, removed_len);
+	if (next != NULL){
+		memmove(block, next, sizeof(struct ext2_dir_entry) + next->name_len);
+	} else {
+		ed->inode = 0;
+		ed->name_len = 0;
+		ed->file_type = 0;
+	}
+	ed->rec_len = span;
+	memcpy(block + front, removed, removed_len);
+	dir_entry_at(fs, block_num, front)->rec_len = span - front;
+	// the entry the cache may point at has moved
+	memset(fs->dcache, 0, EXT2_DCACHE_SIZE * sizeof(struct ext2_dcache_slot));
+	return 1;
 }
 
-int get_unused_inode_num(struct ext2_super_block *sb, struct ext2_group_desc *gd){
-	int len = 1024 + (gd->bg_inode_bitmap-1) * EXT2_BLOCK_SIZE;
-	char b;
-	int  count = 0;
-	for (int i = len; i < len + sb->s_inodes_count/8; ++i){
-		// get one bytes
-		b = disk[i];
-		// find no use
-		for (int j = 0; j < 8; j++){
-			if ((b & 1) == 0){
-				// no use
-				count ++;
+void open_dir(struct ext2_fs *fs, struct ext2_dir *dir, unsigned int inode_num){
+	unsigned int nblocks;
+	struct ext2_dir_entry *ed;
+
+	dir->inode_num = inode_num;
+	dir->ei = get_inode(fs, inode_num);
+	dir->last_off = 0;
+	nblocks = ext2_size_blocks(fs, dir->ei->i_size);
+	dir->block_num = nblocks > 0 ? ext2_bmap(fs, dir->ei, nblocks - 1) : 0;
+	if (dir->block_num == 0){
+		return;
+	}
+	while (1){
+		ed = dir_entry_at(fs, dir->block_num, dir->last_off);
+		if (ed->rec_len == 0 || dir->last_off + ed->rec_len >= fs->block_size)
+			break;
+		dir->last_off += ed->rec_len;
+	}
+}
+
+// add a block to the end of the directory, with the indirect block it may
+// need, near its last one; 0 if the disk is full
+static unsigned int grow_dir(struct ext2_fs *fs, struct ext2_dir *dir){
+	unsigned int n = ext2_size_blocks(fs, dir->ei->i_size);
+	unsigned int want = ext2_blocks_needed(fs, n + 1) - ext2_blocks_needed(fs, n);
+	unsigned int goal = dir->block_num != 0 ? dir->block_num + 1 : alloc_goal(fs, dir->inode_num);
+	struct ext2_extent ext = {0, 0};
+	unsigned int block_num = 0;
+
+	if (n + 1 > ext2_max_file_blocks(fs) || want > fs->sb->s_free_blocks_count){
+		return 0;
+	}
+	while (block_num == 0){
+		if (ext.len == 0){
+			ext.start = alloc_blocks(fs, goal, want, &ext.len);
+			if (ext.len == 0){
+				// nothing left to ask for, or the free count said there
+				// was room and the bitmap disagrees; an indirect block
+				// already taken stays mapped, and the next call carries
+				// on from it
+				return 0;
 			}
-			b = b >> 1;
+			want -= ext.len;
+			goal = ext.start + ext.len;
 		}
+		block_num = ext2_bmap_take(fs, dir->ei, n, &ext);
 	}
-	return count;
+	dir->ei->i_size += fs->block_size;
+	return block_num;
 }
 
+int add_dir_entry(struct ext2_fs *fs, struct ext2_dir *dir, const char *name,
+				  unsigned int inode_num, unsigned char file_type){
+	unsigned int name_len = strlen(name);
+	struct ext2_dir_entry *ed = NULL;
+	unsigned int used = 0;
+	unsigned int block_num;
 
-int get_inode_bitmap_by_index(struct ext2_super_block *sb, struct ext2_group_desc *gd, int index){
-	int len = 1024 + (gd->bg_inode_bitmap-1) * EXT2_BLOCK_SIZE;
-	char b;
-	int  inode_num = 1;
-	for (int i = len; i < len + sb->s_inodes_count/8; ++i){
-		// get one bytes
-		b = disk[i];
-		// find index
-		for (int j = 0; j < 8; j++){
-			if (inode_num == index){
-				return (b & 1);
-			}
-			b = b >> 1;
-			inode_num ++;
+	if (dir->block_num != 0){
+		ed = dir_entry_at(fs, dir->block_num, dir->last_off);
+		used = dir_entry_size(ed->name_len);
+	}
+	if (ed != NULL && dir->last_off + used + dir_entry_size(name_len) <= fs->block_size){
+		// cut the last entry down to its size, and put the new one after it
+		ed->rec_len = used;
+		dir->last_off += used;
+	}
+	else{
+		if ((block_num = grow_dir(fs, dir)) == 0){
+			return ENOSPC;
 		}
+		dir->block_num = block_num;
+		dir->last_off = 0;
 	}
-	return 1;
+	ed = dir_entry_at(fs, dir->block_num, dir->last_off);
+	ed->inode = inode_num;
+	ed->name_len = name_len;
+	ed->file_type = file_type;
+	ed->rec_len = fs->block_size - dir->last_off;
+	memcpy(ed->name, name, name_len);
+	// it is likely to be looked up next, a directory to put things in
+	dcache_insert(fs, dir->inode_num, name_hash(name, name_len), ed);
+	return 0;
 }
 
-void update_inode_bitmap(struct ext2_super_block *sb, struct ext2_group_desc *gd, int index, int used){
-	int len = 1024 + (gd->bg_inode_bitmap-1) * EXT2_BLOCK_SIZE;
-	int inode_num = 1;
-	for (int i = len; i < len + sb->s_inodes_count/8; ++i){
-		// find index  update bit
-		for (int j = 0; j < 8; j++){
-			if (inode_num == index){
-				if (used){
-					disk[i] |= (1<<j);
-				}
-				else{
-					disk[i] &= ~(1<<j);
-				}
-				return;
-			}
-			inode_num ++;
+int make_dir(struct ext2_fs *fs, struct ext2_dir *parent, const char *dir_name){
+
+	// get dir_name inode number , block number, near the parent
+	int new_inode_number = alloc_inode(fs, parent->inode_num, 1);
+	if (new_inode_number == 0){
+		return 0;
+	}
+	int new_block_number = alloc_block(fs, new_inode_number);
+	if (new_block_number == 0 ||
+	    add_dir_entry(fs, parent, dir_name, new_inode_number, EXT2_FT_DIR) != 0){
+		// give the inode and block back
+		if (new_block_number != 0){
+			set_block_in_use(fs, new_block_number, 0);
 		}
+		set_inode_in_use(fs, new_inode_number, 0);
+		inode_group_desc(fs, new_inode_number)->bg_used_dirs_count -= 1;
+		return 0;
+	}
+
+	//get  inode  table  position   and   set  value
+	struct ext2_inode * new_ei = get_inode(fs, new_inode_number);
+
+	// set file type
+	new_ei->i_mode |= EXT2_S_IFDIR; 
+	// set the size, At least save  .   ..
+	new_ei->i_size = fs->block_size;
+	new_ei->i_blocks = ext2_blocks_to_sectors(fs, 1); 
+	// . link
+	new_ei->i_links_count = 1; 
+	for(int i = 0; i < 15; i++){
+		new_ei->i_block[i] = 0; 
 	}
+	new_ei->i_block[0] = new_block_number;
+	new_ei->i_dtime = 0;
+
+	// set . dir to new block
+	struct ext2_dir_entry * new_dot_ed = dir_entry_at(fs, new_block_number, 0);
+	new_dot_ed->file_type = EXT2_FT_DIR;
+	new_dot_ed->inode = new_inode_number;
+	new_dot_ed->name_len = 1;	
+	new_dot_ed->rec_len = dir_entry_size(1);
+	memcpy(new_dot_ed->name, ".", 1);
+
+	new_ei->i_links_count ++;
+
+	// set .. dir to new block	
+	struct ext2_dir_entry * new_dot2_ed = dir_entry_at(fs, new_block_number, new_dot_ed->rec_len);
+	new_dot2_ed->file_type = EXT2_FT_DIR;
+	new_dot2_ed->inode = parent->inode_num;
+	new_dot2_ed->name_len = 2;	
+	new_dot2_ed->rec_len = fs->block_size - new_dot_ed->rec_len;
+	memcpy(new_dot2_ed->name, "..", 2);
+
+	// ..  link  parent inode
+	parent->ei->i_links_count += 1;
+	return new_inode_number;
 }
 
+/*
+ * Block groups.  fs->gd is the group descriptor table, with one entry per
+ * group; every inode and block belongs to one group, and has one bit in
+ * that group's bitmap.  Inodes and blocks are numbered from 1 across the
+ * whole file system.
+ */
+struct ext2_inode *get_inode(struct ext2_fs *fs, unsigned int inode_num){
+	unsigned int group = (inode_num - 1) / fs->sb->s_inodes_per_group;
+	unsigned int index = (inode_num - 1) % fs->sb->s_inodes_per_group;
 
-int get_free_block_num(struct ext2_super_block *sb, struct ext2_group_desc *gd){
-	int len = 1024 + (gd->bg_block_bitmap-1) * EXT2_BLOCK_SIZE;
-	char r;
-	int  block_num = 1;
-	for (int i = len; i < len + sb->s_blocks_count/8; ++i){
-		// get one bytes
-		r = disk[i];
-		// find no use
-		for (int j = 0; j < 8; j++){
-			if ((r & 1) == 0){
-				// no use
-				return block_num;
-			}
-			r = r >> 1;
-			block_num ++;
+	return (struct ext2_inode *)(ext2_block(fs, fs->gd[group].bg_inode_table) +
+				     (size_t)index * fs->sb->s_inode_size);
+}
+
+// The group an inode or block belongs to, and its bit in the group's bitmap
+static unsigned int inode_group(struct ext2_fs *fs, unsigned int inode_num){
+	return (inode_num - 1) / fs->sb->s_inodes_per_group;
+}
+
+static unsigned int inode_bit(struct ext2_fs *fs, unsigned int inode_num){
+	return (inode_num - 1) % fs->sb->s_inodes_per_group;
+}
+
+static unsigned int block_group(struct ext2_fs *fs, unsigned int block_num){
+	return (block_num - fs->sb->s_first_data_block) / fs->sb->s_blocks_per_group;
+}
+
+static unsigned int block_bit(struct ext2_fs *fs, unsigned int block_num){
+	return (block_num - fs->sb->s_first_data_block) % fs->sb->s_blocks_per_group;
+}
+
+// The last group may have fewer blocks than the others
+static unsigned int group_blocks(struct ext2_fs *fs, unsigned int group){
+	unsigned int first = group * fs->sb->s_blocks_per_group;
+	unsigned int left = fs->sb->s_blocks_count - fs->sb->s_first_data_block - first;
+
+	return left < fs->sb->s_blocks_per_group ? left : fs->sb->s_blocks_per_group;
+}
+
+static unsigned char *inode_bitmap(struct ext2_fs *fs, unsigned int group){
+	return ext2_block(fs, fs->gd[group].bg_inode_bitmap);
+}
+
+static unsigned char *block_bitmap(struct ext2_fs *fs, unsigned int group){
+	return ext2_block(fs, fs->gd[group].bg_block_bitmap);
+}
+
+static int valid_inode(struct ext2_fs *fs, int index){
+	return index >= 1 && index <= fs->sb->s_inodes_count;
+}
+
+static int valid_block(struct ext2_fs *fs, int index){
+	return index >= fs->sb->s_first_data_block && index < fs->sb->s_blocks_count;
+}
+
+/*
+ * The first clear bit of a group's bitmap, starting from the group's hint
+ * and moving the hint up to it: every bit before the hint is set, so the
+ * part of the bitmap filled by earlier allocations is not scanned again.
+ * Freeing moves the hint back down.  -1 if the group is full.
+ */
+static int first_free_bit(const unsigned char *map, unsigned int nbits, unsigned int *hint){
+	int bit = bitmap_find_zero(map, nbits, *hint);
+
+	*hint = bit >= 0 ? (unsigned int)bit : nbits;
+	return bit;
+}
+
+static void lower_hint(unsigned int *hint, unsigned int bit){
+	if (bit < *hint){
+		*hint = bit;
+	}
+}
+
+// First free inode, searching the groups from 'group' on; 0 if none
+static int find_free_inode(struct ext2_fs *fs, unsigned int group){
+	unsigned int i, g;
+	int bit;
+
+	for (i = 0; i < fs->ngroups; i++){
+		g = (group + i) % fs->ngroups;
+		if (fs->gd[g].bg_free_inodes_count == 0){
+			continue;
+		}
+		bit = first_free_bit(inode_bitmap(fs, g), fs->sb->s_inodes_per_group,
+							 &fs->inode_hint[g]);
+		if (bit >= 0){
+			return g * fs->sb->s_inodes_per_group + bit + 1;
 		}
 	}
 	return 0;
 }
 
-int get_unused_block_num(struct ext2_super_block *sb, struct ext2_group_desc *gd){
-	int len = 1024 + (gd->bg_block_bitmap-1) * EXT2_BLOCK_SIZE;
-	char b;
-	int  count = 0;
-	for (int i = len; i < len + sb->s_blocks_count/8; ++i){
-		// get one bytes
-		b = disk[i];
-		// find no use
-		for (int j = 0; j < 8; j++){
-			if ((b & 1) == 0){
-				// no use
-				count ++;
-			}
-			b = b >> 1;
+static int find_free_block(struct ext2_fs *fs, unsigned int group){
+	unsigned int i, g;
+	int bit;
+
+	for (i = 0; i < fs->ngroups; i++){
+		g = (group + i) % fs->ngroups;
+		// a full group is not worth a scan of its bitmap
+		if (fs->gd[g].bg_free_blocks_count == 0){
+			continue;
+		}
+		bit = first_free_bit(block_bitmap(fs, g), group_blocks(fs, g), &fs->block_hint[g]);
+		if (bit >= 0){
+			return fs->sb->s_first_data_block + g * fs->sb->s_blocks_per_group + bit;
 		}
 	}
+	return 0;
+}
+
+int get_free_inode_num(struct ext2_fs *fs){
+	return find_free_inode(fs, 0);
+}
+
+int get_unused_inode_num(struct ext2_fs *fs){
+	unsigned int g, count = 0;
+
+	for (g = 0; g < fs->ngroups; g++){
+		count += get_group_unused_inode_num(fs, g);
+	}
 	return count;
 }
 
+int get_group_unused_inode_num(struct ext2_fs *fs, unsigned int group){
+	return bitmap_count_zero(inode_bitmap(fs, group), fs->sb->s_inodes_per_group);
+}
 
-int get_block_bitmap_by_index(struct ext2_super_block *sb, struct ext2_group_desc *gd, int index){
-	int len = 1024 + (gd->bg_block_bitmap-1) * EXT2_BLOCK_SIZE;
-	char b;
-	int  block_num = 1;
-	for (int i = len; i < len + sb->s_blocks_count/8; ++i){
-		// get one bytes
-		b = disk[i];
-		// find index
-		for (int j = 0; j < 8; j++){
-			if (block_num == index){
-				return (b & 1);
-			}
-			b = b >> 1;
-			block_num ++;
-		}
+
+int get_inode_bitmap_by_index(struct ext2_fs *fs, int index){
+	// out of range counts as in use
+	if (!valid_inode(fs, index)){
+		return 1;
+	}
+	return bitmap_test(inode_bitmap(fs, inode_group(fs, index)), inode_bit(fs, index));
+}
+
+void update_inode_bitmap(struct ext2_fs *fs, int index, int used){
+	if (!valid_inode(fs, index)){
+		return;
+	}
+	if (used){
+		bitmap_set(inode_bitmap(fs, inode_group(fs, index)), inode_bit(fs, index));
+	}
+	else{
+		bitmap_clear(inode_bitmap(fs, inode_group(fs, index)), inode_bit(fs, index));
+		lower_hint(&fs->inode_hint[inode_group(fs, index)], inode_bit(fs, index));
+	}
+}
+
+
+int get_free_block_num(struct ext2_fs *fs){
+	return find_free_block(fs, 0);
+}
+
+int get_unused_block_num(struct ext2_fs *fs){
+	unsigned int g, count = 0;
+
+	for (g = 0; g < fs->ngroups; g++){
+		count += get_group_unused_block_num(fs, g);
+	}
+	return count;
+}
+
+int get_group_unused_block_num(struct ext2_fs *fs, unsigned int group){
+	return bitmap_count_zero(block_bitmap(fs, group), group_blocks(fs, group));
+}
+
+
+int get_block_bitmap_by_index(struct ext2_fs *fs, int index){
+	// out of range counts as in use
+	if (!valid_block(fs, index)){
+		return 1;
+	}
+	return bitmap_test(block_bitmap(fs, block_group(fs, index)), block_bit(fs, index));
+}
+
+
+void update_block_bitmap(struct ext2_fs *fs, int index, int used){
+	if (!valid_block(fs, index)){
+		return;
+	}
+	if (used){
+		bitmap_set(block_bitmap(fs, block_group(fs, index)), block_bit(fs, index));
+	}
+	else{
+		bitmap_clear(block_bitmap(fs, block_group(fs, index)), block_bit(fs, index));
+		lower_hint(&fs->block_hint[block_group(fs, index)], block_bit(fs, index));
+	}
+}
+
+
+/*
+ * Allocation.  These keep the free counts of the superblock and of the
+ * group in step with the bitmaps.
+ */
+int set_inode_in_use(struct ext2_fs *fs, int index, int used){
+	struct ext2_group_desc *g;
+
+	if (!valid_inode(fs, index) || get_inode_bitmap_by_index(fs, index) == used){
+		return 0;
+	}
+	update_inode_bitmap(fs, index, used);
+	g = &fs->gd[inode_group(fs, index)];
+	if (used){
+		g->bg_free_inodes_count --;
+		fs->sb->s_free_inodes_count --;
+	}
+	else{
+		g->bg_free_inodes_count ++;
+		fs->sb->s_free_inodes_count ++;
 	}
 	return 1;
 }
 
+int set_block_in_use(struct ext2_fs *fs, int index, int used){
+	struct ext2_group_desc *g;
 
-void update_block_bitmap(struct ext2_super_block *sb, struct ext2_group_desc *gd, int index, int used){
-	int len = 1024 + (gd->bg_block_bitmap-1) * EXT2_BLOCK_SIZE;
-	int block_num = 1;
-	for (int i = len; i < len + sb->s_blocks_count/8; ++i){
-		for (int j = 0; j < 8; j++){
-			// find index  update bit
-			if (block_num == index){
-				if (used){
-					disk[i] |= (1<<j);
-				}
-				else{
-					disk[i] &= ~(1<<j);
+	if (!valid_block(fs, index) || get_block_bitmap_by_index(fs, index) == used){
+		return 0;
+	}
+	update_block_bitmap(fs, index, used);
+	g = &fs->gd[block_group(fs, index)];
+	if (used){
+		g->bg_free_blocks_count --;
+		fs->sb->s_free_blocks_count --;
+	}
+	else{
+		g->bg_free_blocks_count ++;
+		fs->sb->s_free_blocks_count ++;
+	}
+	return 1;
+}
+
+struct ext2_group_desc *inode_group_desc(struct ext2_fs *fs, unsigned int inode_num){
+	return &fs->gd[inode_group(fs, inode_num)];
+}
+
+int alloc_inode(struct ext2_fs *fs, unsigned int parent_inode_num, int is_dir){
+	int inode_num = find_free_inode(fs, inode_group(fs, parent_inode_num));
+
+	if (inode_num != 0){
+		set_inode_in_use(fs, inode_num, 1);
+		if (is_dir){
+			inode_group_desc(fs, inode_num)->bg_used_dirs_count ++;
+		}
+	}
+	return inode_num;
+}
+
+int alloc_block(struct ext2_fs *fs, unsigned int inode_num){
+	unsigned int got;
+
+	return alloc_blocks(fs, alloc_goal(fs, inode_num), 1, &got);
+}
+
+/*
+ * Runs of free blocks.  A run stays in one group: the next group starts
+ * with its own metadata, or may.  Each group's runs are found a bitmap
+ * word at a time, a clear bit then the next set one, so a search is
+ * linear in the size of the bitmaps, and a run is taken with one range
+ * operation on the bitmap.
+ */
+static unsigned int group_first_block(struct ext2_fs *fs, unsigned int group){
+	return fs->sb->s_first_data_block + group * fs->sb->s_blocks_per_group;
+}
+
+unsigned int alloc_goal(struct ext2_fs *fs, unsigned int inode_num){
+	return group_first_block(fs, inode_group(fs, inode_num));
+}
+
+// marks count blocks used from bit start of group on
+static unsigned int take_run(struct ext2_fs *fs, unsigned int group, unsigned int start,
+							 unsigned int count, unsigned int *got){
+	bitmap_set_range(block_bitmap(fs, group), start, count);
+	if (start == fs->block_hint[group]){
+		fs->block_hint[group] = start + count;
+	}
+	fs->gd[group].bg_free_blocks_count -= count;
+	fs->sb->s_free_blocks_count -= count;
+	*got = count;
+	return group_first_block(fs, group) + start;
+}
+
+unsigned int alloc_blocks(struct ext2_fs *fs, unsigned int goal, unsigned int want,
+						  unsigned int *got){
+	unsigned int group, g, i, nbits, len;
+	unsigned int best_group = 0, best_start = 0, best_len = 0;
+	unsigned int longest_group = 0, longest_start = 0, longest_len = 0;
+	unsigned char *map;
+	int start, end;
+
+	*got = 0;
+	if (want == 0){
+		return 0;
+	}
+	if (!valid_block(fs, goal)){
+		goal = fs->sb->s_first_data_block;
+	}
+	group = block_group(fs, goal);
+
+	// the run at the goal, however short, so the file goes on where it
+	// left off; else the first run after the goal that is long enough
+	map = block_bitmap(fs, group);
+	nbits = group_blocks(fs, group);
+	start = block_bit(fs, goal);
+	if (start <= fs->block_hint[group]){
+		// the goal is in the full part of the group
+		start = first_free_bit(map, nbits, &fs->block_hint[group]);
+	}
+	while (start >= 0 && (start = bitmap_find_zero(map, nbits, start)) >= 0){
+		end = bitmap_find_one(map, nbits, start);
+		len = end - start;
+		if (start == block_bit(fs, goal) || len >= want){
+			return take_run(fs, group, start, len < want ? len : want, got);
+		}
+		start = end;
+	}
+
+	// else the smallest run anywhere that is long enough, or failing
+	// that the longest there is
+	for (i = 0; i < fs->ngroups; i++){
+		g = (group + i) % fs->ngroups;
+		if (fs->gd[g].bg_free_blocks_count == 0){
+			continue;
+		}
+		map = block_bitmap(fs, g);
+		nbits = group_blocks(fs, g);
+		start = first_free_bit(map, nbits, &fs->block_hint[g]);
+		while (start >= 0 && (start = bitmap_find_zero(map, nbits, start)) >= 0){
+			end = bitmap_find_one(map, nbits, start);
+			len = end - start;
+			if (len >= want && (best_len == 0 || len < best_len)){
+				best_group = g;
+				best_start = start;
+				best_len = len;
+				if (len == want){
+					return take_run(fs, g, start, want, got);
 				}
-				return;
 			}
-			block_num ++;
+			if (len > longest_len){
+				longest_group = g;
+				longest_start = start;
+				longest_len = len;
+			}
+			start = end;
 		}
 	}
+	if (best_len != 0){
+		return take_run(fs, best_group, best_start, want, got);
+	}
+	if (longest_len != 0){
+		return take_run(fs, longest_group, longest_start, longest_len, got);
+	}
+	return 0;
+}
+
+void free_blocks(struct ext2_fs *fs, unsigned int block_num, unsigned int count){
+	unsigned int group = block_group(fs, block_num);
+
+	bitmap_clear_range(block_bitmap(fs, group), block_bit(fs, block_num), count);
+	lower_hint(&fs->block_hint[group], block_bit(fs, block_num));
+	fs->gd[group].bg_free_blocks_count += count;
+	fs->sb->s_free_blocks_count += count;
 }
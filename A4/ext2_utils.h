@@ -1,44 +1,179 @@
-
 #ifndef EXT2_UTILS_H
 #define EXT2_UTILS_H
 
+#include <stddef.h>
 #include "ext2.h"
 
-extern unsigned char *disk;
-// return file entry
-struct ext2_dir_entry *  file_dir_entry(struct ext2_super_block *sb, struct ext2_group_desc *gd, 
-	unsigned int inode_num, const char * filename);
-
-// find  last dir entry
-
-struct ext2_dir_entry *  last_file_dir_entry(struct ext2_inode * ei, int *last_len);
-
-
-// find  dir inode 
-int find_dir_inode(struct ext2_super_block *sb, struct ext2_group_desc *gd, 
-						unsigned int inode_num, const char *dir_name);
+// a directory entry found by name, to find it again without a scan
+struct ext2_dcache_slot {
+	unsigned int parent;            // the directory's inode
+	unsigned int hash;              // of the name
+	struct ext2_dir_entry *ed;      // NULL if the slot is empty
+};
+
+#define EXT2_DCACHE_SIZE 4096       // slots, a power of 2
+
+/*
+ * An open file system: the mapped image, its superblock and group
+ * descriptor table, and the geometry the block math needs, all taken from
+ * the superblock when the image is opened.  Every helper below takes one.
+ */
+struct ext2_fs {
+	unsigned char *disk;            // the mapped image
+	size_t size;                    // of the image file
+	struct ext2_super_block *sb;
+	struct ext2_group_desc *gd;     // the whole descriptor table
+	unsigned int block_size;        // 1024, 2048 or 4096
+	unsigned int ngroups;
+	// per group, how far the inode and block bitmaps are known to be
+	// full: searches for a free one start there
+	unsigned int *inode_hint;
+	unsigned int *block_hint;
+	struct ext2_dcache_slot *dcache;
+};
+
+// map the image at path read-write, after checking that it holds an ext2
+// file system that fits in it; exits with an error message if not
+void ext2_open_image(struct ext2_fs *fs, const char *path);
+
+// write the changes to the mapping back to the image file, and wait for
+// them; the tools leave that to the kernel, but a batch syncs at its end
+void ext2_sync_image(struct ext2_fs *fs);
+
+/*
+ * Block math.  Block n starts n blocks into the image whatever the block
+ * size: with 1K blocks the superblock is block 1, and with larger ones it
+ * is in block 0, 1024 bytes in.
+ */
+static inline unsigned char *ext2_block(struct ext2_fs *fs, unsigned int block_num){
+	return fs->disk + (size_t)block_num * fs->block_size;
+}
+
+// an indirect block, as the block numbers it holds
+static inline unsigned int *ext2_indirect(struct ext2_fs *fs, unsigned int block_num){
+	return (unsigned int *)ext2_block(fs, block_num);
+}
+
+// block numbers per indirect block
+static inline unsigned int ext2_addr_per_block(struct ext2_fs *fs){
+	return fs->block_size / sizeof(unsigned int);
+}
+
+// blocks needed to hold size bytes
+static inline unsigned int ext2_size_blocks(struct ext2_fs *fs, unsigned long size){
+	return (size + fs->block_size - 1) / fs->block_size;
+}
+
+// i_blocks counts 512-byte sectors, not blocks
+static inline unsigned int ext2_blocks_to_sectors(struct ext2_fs *fs, unsigned int nblocks){
+	return nblocks * (fs->block_size / 512);
+}
+
+static inline unsigned int ext2_inode_blocks(struct ext2_fs *fs, struct ext2_inode *ei){
+	return ei->i_blocks / (fs->block_size / 512);
+}
+
+// return file entry, from the cache of lookups if it is there
+struct ext2_dir_entry *  file_dir_entry(struct ext2_fs *fs, unsigned int inode_num,
+	const char * filename);
+
+// drop a name from the cache of lookups, when its entry is removed
+void dcache_forget(struct ext2_fs *fs, unsigned int parent, const char *name);
+
+// whether ed is a live entry for name: the lengths first, then the bytes
+int dir_entry_is(struct ext2_dir_entry *ed, const char *name, size_t len);
+
+// remove the first entry of a block other than a directory's first,
+// keeping it for restore; returns 0 if there was no room for that, and
+// the entry was emptied instead
+int hide_first_dir_entry(struct ext2_fs *fs, unsigned int block_num);
+
+// find  dir inode
+int find_dir_inode(struct ext2_fs *fs, unsigned int inode_num, const char *dir_name);
+
+/*
+ * A directory being added to, and where its last entry is.  Opening it
+ * walks its last block once; each entry added after that goes straight
+ * after the one before, so filling a directory costs no more per entry
+ * than the first one did.
+ */
+struct ext2_dir {
+	unsigned int inode_num;
+	struct ext2_inode *ei;
+	unsigned int block_num;     // the last block, 0 if it has none
+	unsigned int last_off;      // of the last entry in that block
+};
+
+void open_dir(struct ext2_fs *fs, struct ext2_dir *dir, unsigned int inode_num);
+
+// add an entry at the end of the directory, giving it another block if
+// the last one is full; returns 0, or ENOSPC
+int add_dir_entry(struct ext2_fs *fs, struct ext2_dir *dir, const char *name,
+				  unsigned int inode_num, unsigned char file_type);
+
+// create an empty directory in parent; returns its inode number, or 0 if
+// the disk is full
+int make_dir(struct ext2_fs *fs, struct ext2_dir *parent, const char *dir_name);
+
+struct ext2_inode *get_inode(struct ext2_fs *fs, unsigned int inode_num);
+
+// descriptor of the group an inode belongs to
+struct ext2_group_desc *inode_group_desc(struct ext2_fs *fs, unsigned int inode_num);
 
 // get free inode number
-int get_free_inode_num(struct ext2_super_block *sb, struct ext2_group_desc *gd);
+int get_free_inode_num(struct ext2_fs *fs);
+
+int get_unused_inode_num(struct ext2_fs *fs);
 
-int get_unused_inode_num(struct ext2_super_block *sb, struct ext2_group_desc *gd);
+int get_group_unused_inode_num(struct ext2_fs *fs, unsigned int group);
 
 // get inode bitmap by index
-int get_inode_bitmap_by_index(struct ext2_super_block *sb, struct ext2_group_desc *gd, int index);
+int get_inode_bitmap_by_index(struct ext2_fs *fs, int index);
 
 
 
 // update inode bitmap
-void update_inode_bitmap(struct ext2_super_block *sb, struct ext2_group_desc *gd, int index, int used);
+void update_inode_bitmap(struct ext2_fs *fs, int index, int used);
+
 
+int get_unused_block_num(struct ext2_fs *fs);
 
-int get_unused_block_num(struct ext2_super_block *sb, struct ext2_group_desc *gd);
+int get_group_unused_block_num(struct ext2_fs *fs, unsigned int group);
 
 // get free block number
-int get_free_block_num(struct ext2_super_block *sb, struct ext2_group_desc *gd);
+int get_free_block_num(struct ext2_fs *fs);
 
-int get_block_bitmap_by_index(struct ext2_super_block *sb, struct ext2_group_desc *gd, int index);
+int get_block_bitmap_by_index(struct ext2_fs *fs, int index);
 
 // update block bitmap
-void update_block_bitmap(struct ext2_super_block *sb, struct ext2_group_desc *gd, int index, int used);
+void update_block_bitmap(struct ext2_fs *fs, int index, int used);
+
+// mark an inode or block used or free, updating the free counts of the
+// superblock and its group; returns 1 if it changed
+int set_inode_in_use(struct ext2_fs *fs, int index, int used);
+
+int set_block_in_use(struct ext2_fs *fs, int index, int used);
+
+// allocate the first free inode, looking in the parent directory's group
+// first; a new directory is counted in its group.  Returns 0 if none
+int alloc_inode(struct ext2_fs *fs, unsigned int parent_inode_num, int is_dir);
+
+// allocate a block for an inode: the first free one in the inode's group,
+// else as alloc_blocks does.  Returns 0 if none
+int alloc_block(struct ext2_fs *fs, unsigned int inode_num);
+
+// where to start looking for an inode's blocks: the start of its group
+unsigned int alloc_goal(struct ext2_fs *fs, unsigned int inode_num);
+
+// allocate a run of up to want consecutive blocks, and mark them used.
+// The run is the free run at goal if there is one, however short; else
+// the first run of want blocks after goal in its group; else the smallest
+// run of want blocks anywhere; else the longest run there is.  Returns
+// its first block and sets *got to its length, or returns 0 if the disk
+// is full
+unsigned int alloc_blocks(struct ext2_fs *fs, unsigned int goal, unsigned int want,
+						  unsigned int *got);
+
+// free count blocks from block_num on, all in one group
+void free_blocks(struct ext2_fs *fs, unsigned int block_num, unsigned int count);
 #endif